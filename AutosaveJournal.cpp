@@ -0,0 +1,481 @@
+/**
+ * @file AutosaveJournal.cpp
+ * @brief Implementation of the autosave journal
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "AutosaveJournal.h"
+#include "FlowFormat.h"
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtEndian>
+
+namespace {
+
+const quint32 kMagic = 0x464a4e4c; // "FJNL"
+const quint16 kVersion = 1;
+// How often the writer is woken at most, and so what a crash can lose
+const int kFlushInterval = 1000;
+// Records are not compacted below this, however small the document
+const qint64 kMinCompaction = 4 * 1024 * 1024;
+const int kFrameHeader = 8;
+
+enum RecordKind : quint8 {
+    EditRecord,
+    PageRecord
+};
+
+quint32 checksum(const char* data, int size)
+{
+    // FNV-1a: enough to tell a torn record from a whole one
+    quint32 hash = 2166136261u;
+    for (int i = 0; i < size; ++i) {
+        hash = (hash ^ quint8(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+QString autosaveDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/autosave";
+}
+
+QString hashedName(const QString& path)
+{
+    return QString::fromLatin1(QCryptographicHash::hash(path.toUtf8(), QCryptographicHash::Md5).toHex());
+}
+
+// Registers a journal with the autosave directory, so it can be found
+// wherever it is
+QString referencePath(const QString& journalPath)
+{
+    return autosaveDirectory() + "/" + hashedName(journalPath) + ".ref";
+}
+
+QString lockPath(const QString& journalPath)
+{
+    return journalPath + ".lock";
+}
+
+void setUpStream(QDataStream& stream)
+{
+    stream.setVersion(QDataStream::Qt_5_12);
+}
+
+QByteArray encodeEdit(const UndoJournal::Entry& entry, bool undo)
+{
+    // Replay only goes forward, so an undo is written as the edit that
+    // has the same effect: after values taken from before, shapes that
+    // come back as inserted, and so on
+    const QVector<UndoJournal::Insertion>& inserted = undo ? entry.removed : entry.inserted;
+    const QVector<UndoJournal::Insertion>& removed = undo ? entry.inserted : entry.removed;
+
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    setUpStream(out);
+    out << quint8(EditRecord);
+
+    // Shapes that come back are stored whole, as a small document
+    FlowDocument shapes;
+    QVector<ShapeId> below;
+    for (const UndoJournal::Insertion& insertion : inserted) {
+        shapes.shapes.append(insertion.shape);
+        below.append(insertion.below);
+        if (insertion.pinned) {
+            shapes.pinned.insert(insertion.shape->getId());
+        }
+    }
+    out << (shapes.shapes.isEmpty() ? QByteArray() : FlowFormat::encode(shapes, false)) << below;
+
+    out << entry.moved << (undo ? -entry.delta : entry.delta);
+    out << entry.placed << (undo ? entry.placedBefore : entry.placedAfter);
+    out << quint32(entry.routes.size());
+    for (const UndoJournal::RouteChange& route : entry.routes) {
+        out << route.connector << (undo ? route.before : route.after);
+    }
+    out << quint32(entry.properties.size());
+    for (const UndoJournal::PropertyChange& change : entry.properties) {
+        out << change.shape << qint32(change.property) << (undo ? change.before : change.after);
+    }
+    out << quint32(entry.restacks.size());
+    for (const UndoJournal::Restack& change : entry.restacks) {
+        out << change.shape << (undo ? change.belowBefore : change.belowAfter);
+    }
+
+    QVector<ShapeId> removedIds;
+    for (const UndoJournal::Insertion& insertion : removed) {
+        removedIds.append(insertion.shape->getId());
+    }
+    out << removedIds;
+    return payload;
+}
+
+bool decodeRecord(const QByteArray& payload, AutosaveJournal::Operation& operation)
+{
+    QDataStream in(payload);
+    setUpStream(in);
+    quint8 kind = 0;
+    in >> kind;
+    if (kind == PageRecord) {
+        in >> operation.backgroundColor >> operation.canvasSize;
+        return in.status() == QDataStream::Ok;
+    }
+    if (kind != EditRecord) return false;
+
+    UndoJournal::Entry& edit = operation.edit;
+    QByteArray shapes;
+    QVector<ShapeId> below;
+    in >> shapes >> below;
+    if (!shapes.isEmpty()) {
+        FlowDocument document;
+        if (!FlowFormat::decode(shapes, document) || document.shapes.size() != below.size()) return false;
+        for (int i = 0; i < below.size(); ++i) {
+            const auto& shape = document.shapes[i];
+            edit.inserted.append({ shape, below[i], document.pinned.contains(shape->getId()) });
+        }
+    }
+
+    in >> edit.moved >> edit.delta;
+    in >> edit.placed >> edit.placedAfter;
+    if (edit.placed.size() != edit.placedAfter.size()) return false;
+
+    // A damaged count runs into the end of the payload, which stops the
+    // loops through the stream status
+    quint32 count = 0;
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        UndoJournal::RouteChange route;
+        in >> route.connector >> route.after;
+        edit.routes.append(route);
+    }
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        UndoJournal::PropertyChange change;
+        qint32 property = 0;
+        in >> change.shape >> property >> change.after;
+        change.property = UndoJournal::Property(property);
+        edit.properties.append(change);
+    }
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        UndoJournal::Restack change;
+        in >> change.shape >> change.belowAfter;
+        edit.restacks.append(change);
+    }
+    in >> operation.removed;
+    return in.status() == QDataStream::Ok;
+}
+
+} // namespace
+
+AutosaveJournal::AutosaveJournal(QObject* parent)
+    : QObject(parent)
+{
+    m_writer.setMaxThreadCount(1);
+    m_writer.setExpiryTimeout(-1);
+    // Started by the first record after a flush, so a steady stream of
+    // edits is written once per interval
+    m_flushTimer.setSingleShot(true);
+    m_flushTimer.setInterval(kFlushInterval);
+    connect(&m_flushTimer, &QTimer::timeout, this, &AutosaveJournal::flush);
+}
+
+AutosaveJournal::~AutosaveJournal()
+{
+    discard();
+    m_writer.waitForDone();
+}
+
+void AutosaveJournal::begin(const QString& documentPath)
+{
+    const QString path = journalPath(documentPath);
+    if (path != m_path) {
+        discard();
+        QDir().mkpath(autosaveDirectory());
+        // Held for the whole session, so it must not go stale with age; a
+        // crashed session's lock is stale because its process is gone
+        auto lock = std::make_shared<QLockFile>(lockPath(path));
+        lock->setStaleLockTime(0);
+        // Another instance is journalling the same document
+        if (!lock->tryLock(0)) return;
+        m_path = path;
+        m_lock = lock;
+    }
+
+    // Whatever was recorded so far is in the file now
+    m_documentPath = documentPath;
+    m_flushTimer.stop();
+    m_held = UndoJournal::Entry();
+    m_holding = false;
+    m_pending.clear();
+    m_recordBytes = 0;
+    const QFileInfo document(documentPath);
+    m_documentSize = documentPath.isEmpty() ? 0 : document.size();
+    m_documentModified = documentPath.isEmpty() ? 0 : document.lastModified().toMSecsSinceEpoch();
+    m_baseBytes = m_documentSize;
+    writeHeader(nullptr);
+}
+
+void AutosaveJournal::discard()
+{
+    if (!isActive()) return;
+    m_flushTimer.stop();
+    m_held = UndoJournal::Entry();
+    m_holding = false;
+    m_pending.clear();
+
+    // Behind any write still queued for the journal
+    const QString path = m_path;
+    const std::shared_ptr<QLockFile> lock = m_lock;
+    m_writer.start([path, lock]() {
+        remove(path);
+        lock->unlock();
+    });
+    m_path.clear();
+    m_documentPath.clear();
+    m_lock.reset();
+}
+
+void AutosaveJournal::record(const UndoJournal::Entry& entry, bool undo)
+{
+    if (!isActive()) return;
+
+    // A drag or a run of keystrokes goes out as one record per flush.
+    // Entries with shapes are written right away, while the shapes are as
+    // the entry left them.
+    const bool coalesces = !undo && entry.coalescing != UndoJournal::NoCoalescing
+        && entry.inserted.isEmpty() && entry.removed.isEmpty();
+    if (coalesces) {
+        if (!m_holding || !UndoJournal::merge(m_held, entry)) {
+            closeHeld();
+            m_held = entry;
+            m_holding = true;
+        }
+    }
+    else {
+        closeHeld();
+        append(encodeEdit(entry, undo));
+    }
+
+    if (!m_flushTimer.isActive()) {
+        m_flushTimer.start();
+    }
+}
+
+void AutosaveJournal::recordPage(const QColor& backgroundColor, const QSize& canvasSize)
+{
+    if (!isActive()) return;
+    closeHeld();
+
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    setUpStream(out);
+    out << quint8(PageRecord) << backgroundColor << canvasSize;
+    append(payload);
+
+    if (!m_flushTimer.isActive()) {
+        m_flushTimer.start();
+    }
+}
+
+void AutosaveJournal::compact(const FlowDocument& document)
+{
+    if (!isActive()) return;
+
+    // Held and pending records are part of the document already
+    m_flushTimer.stop();
+    m_held = UndoJournal::Entry();
+    m_holding = false;
+    m_pending.clear();
+
+    m_recordBytes = 0;
+    writeHeader(&document);
+}
+
+QString AutosaveJournal::journalPath(const QString& documentPath)
+{
+    if (documentPath.isEmpty()) {
+        return autosaveDirectory() + QString("/untitled-%1.journal").arg(QCoreApplication::applicationPid());
+    }
+    const QFileInfo info(documentPath);
+    if (QFileInfo(info.absolutePath()).isWritable()) {
+        return info.absolutePath() + "/." + info.fileName() + ".journal";
+    }
+    return autosaveDirectory() + "/" + hashedName(info.absoluteFilePath()) + ".journal";
+}
+
+QStringList AutosaveJournal::orphanedJournals()
+{
+    QStringList journals;
+    const QDir directory(autosaveDirectory());
+    for (const QString& name : directory.entryList({ "*.ref" }, QDir::Files)) {
+        QFile reference(directory.filePath(name));
+        if (!reference.open(QIODevice::ReadOnly)) continue;
+        const QString path = QString::fromUtf8(reference.readAll());
+        reference.close();
+        if (!QFile::exists(path)) {
+            reference.remove();
+            continue;
+        }
+        // A running session holds the lock
+        QLockFile lock(lockPath(path));
+        lock.setStaleLockTime(0);
+        if (lock.tryLock(0)) {
+            journals.append(path);
+        }
+    }
+    return journals;
+}
+
+bool AutosaveJournal::read(const QString& journalPath, Recovery& recovery)
+{
+    QFile file(journalPath);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+    const QByteArray data = file.readAll();
+
+    QDataStream in(data);
+    setUpStream(in);
+    quint32 magic = 0;
+    quint16 version = 0;
+    in >> magic >> version;
+    if (magic != kMagic || version != kVersion) return false;
+    qint64 documentSize = 0;
+    qint64 documentModified = 0;
+    in >> recovery.documentPath >> documentSize >> documentModified >> recovery.hasSnapshot;
+    if (in.status() != QDataStream::Ok) return false;
+    // The records apply to the file as it was when the journal was begun.
+    // If it is not any more (saved again just before the crash, or
+    // changed elsewhere), replaying them would apply edits twice.
+    if (!recovery.hasSnapshot && !recovery.documentPath.isEmpty()) {
+        const QFileInfo document(recovery.documentPath);
+        if (document.size() != documentSize || document.lastModified().toMSecsSinceEpoch() != documentModified) {
+            return false;
+        }
+    }
+    if (recovery.hasSnapshot) {
+        QByteArray snapshot;
+        in >> snapshot;
+        if (in.status() != QDataStream::Ok || !FlowFormat::decode(snapshot, recovery.snapshot)) return false;
+    }
+    if (in.status() != QDataStream::Ok) return false;
+
+    // Records up to the first one that was not written whole
+    qint64 at = in.device()->pos();
+    while (data.size() - at >= kFrameHeader) {
+        const uchar* frame = reinterpret_cast<const uchar*>(data.constData()) + at;
+        const quint32 size = qFromBigEndian<quint32>(frame);
+        const quint32 sum = qFromBigEndian<quint32>(frame + 4);
+        if (size > quint64(data.size() - at - kFrameHeader)) break;
+        const char* payload = data.constData() + at + kFrameHeader;
+        if (checksum(payload, int(size)) != sum) break;
+
+        Operation operation;
+        if (!decodeRecord(QByteArray::fromRawData(payload, int(size)), operation)) break;
+        recovery.operations.append(operation);
+        at += kFrameHeader + size;
+    }
+    return true;
+}
+
+void AutosaveJournal::remove(const QString& journalPath)
+{
+    QFile::remove(journalPath);
+    QFile::remove(referencePath(journalPath));
+}
+
+void AutosaveJournal::flush()
+{
+    closeHeld();
+    if (m_pending.isEmpty()) return;
+
+    const QString path = m_path;
+    const QByteArray bytes = m_pending;
+    m_pending.clear();
+    m_writer.start([this, path, bytes]() {
+        // Closing hands the bytes to the system, after which only a power
+        // loss can take them
+        QFile file(path);
+        const bool ok = file.open(QIODevice::WriteOnly | QIODevice::Append)
+            && file.write(bytes) == bytes.size() && file.flush();
+        reportWrite(ok, file);
+    });
+
+    if (m_recordBytes > qMax(kMinCompaction, m_baseBytes.load())) {
+        emit compactionDue();
+    }
+}
+
+void AutosaveJournal::closeHeld()
+{
+    if (!m_holding) return;
+    append(encodeEdit(m_held, false));
+    m_held = UndoJournal::Entry();
+    m_holding = false;
+}
+
+void AutosaveJournal::append(const QByteArray& payload)
+{
+    QByteArray frame;
+    QDataStream out(&frame, QIODevice::WriteOnly);
+    setUpStream(out);
+    out << quint32(payload.size()) << checksum(payload.constData(), payload.size());
+    out.writeRawData(payload.constData(), payload.size());
+    m_pending += frame;
+    m_recordBytes += frame.size();
+}
+
+void AutosaveJournal::writeHeader(const FlowDocument* snapshot)
+{
+    QByteArray header;
+    QDataStream out(&header, QIODevice::WriteOnly);
+    setUpStream(out);
+    out << kMagic << kVersion << m_documentPath << m_documentSize << m_documentModified << (snapshot != nullptr);
+
+    const QString path = m_path;
+    const bool hasSnapshot = snapshot != nullptr;
+    const FlowDocument document = hasSnapshot ? *snapshot : FlowDocument();
+    m_writer.start([this, path, header, hasSnapshot, document]() mutable {
+        if (hasSnapshot) {
+            // Uncompressed: deflating would not save much next to what it
+            // costs
+            const QByteArray snapshot = FlowFormat::encode(document, false);
+            QDataStream out(&header, QIODevice::WriteOnly | QIODevice::Append);
+            setUpStream(out);
+            out << snapshot;
+            m_baseBytes = snapshot.size();
+        }
+
+        // Replaces the journal in one step, so a crash leaves the old one
+        // or the new one, never a mix
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly) || file.write(header) != header.size() || !file.commit()) {
+            reportWrite(false, file);
+            return;
+        }
+        // Without it the journal is not found after a crash
+        QFile reference(referencePath(path));
+        const bool registered = reference.exists()
+            || (reference.open(QIODevice::WriteOnly) && reference.write(path.toUtf8()) >= 0 && reference.flush());
+        reportWrite(registered, reference);
+    });
+}
+
+void AutosaveJournal::reportWrite(bool ok, const QFileDevice& file)
+{
+    if (ok) {
+        m_writeFailing = false;
+    }
+    else if (!m_writeFailing) {
+        m_writeFailing = true;
+        emit writeFailed(QDir::toNativeSeparators(file.fileName()) + ": " + file.errorString());
+    }
+}
@@ -0,0 +1,139 @@
+/**
+ * @file AutosaveJournal.h
+ * @brief Append-only journal of edits for crash recovery
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QColor>
+#include <QObject>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVector>
+#include <atomic>
+#include <memory>
+#include "FlowIO.h"
+#include "UndoJournal.h"
+
+class QFileDevice;
+class QLockFile;
+
+// Autosave without full saves. Every edit the canvas records (including
+// undo and redo) is appended to a journal file next to the document as a
+// compact binary record holding only the state after the edit; shapes
+// that come back are stored whole, shapes that go by id. Replaying the
+// records over the last saved file gives the document as it was.
+//
+//   header   u32 magic "FJNL", u16 version, document path, its size
+//            and modification time, whether a snapshot follows, the
+//            snapshot (.flow version 2, see FlowFormat)
+//   records  u32 payload size, u32 FNV-1a checksum, payload
+//
+// Records are packed on the GUI thread, which is cheap, and handed to a
+// single writer thread at most once per flush interval; the GUI never
+// waits for the disk. A torn or damaged record ends the journal when it
+// is read back. Writes that fail are reported through writeFailed().
+//
+// Once the records outgrow the document they apply to, the canvas is
+// asked for a compaction: the journal is rewritten as a snapshot of the
+// current document with no records. The snapshot is encoded on the
+// writer thread too, from copies of the shapes.
+//
+// The journal is held through a lock file while a session uses it, and
+// registered in the application's data directory, so the next start can
+// find journals whose session crashed. A session that ends normally
+// removes its journal.
+class AutosaveJournal : public QObject
+{
+    Q_OBJECT
+public:
+    // An edit read back from a journal: only the parts' after values are
+    // set, and removed shapes are given by id
+    struct Operation {
+        UndoJournal::Entry edit;
+        QVector<ShapeId> removed;
+        // Valid when the edit changed the page instead
+        QColor backgroundColor;
+        QSize canvasSize;
+    };
+
+    struct Recovery {
+        QString documentPath; // empty for an untitled document
+        // Replaces the file at documentPath as the starting point
+        bool hasSnapshot = false;
+        FlowDocument snapshot;
+        QVector<Operation> operations;
+
+        bool isEmpty() const { return !hasSnapshot && operations.isEmpty(); }
+    };
+
+    explicit AutosaveJournal(QObject* parent = nullptr);
+    // A session that ends this way ended cleanly: the journal goes
+    ~AutosaveJournal() override;
+
+    // Starts journalling edits to the document saved at documentPath
+    // (empty while untitled), whose file holds everything so far. Begin
+    // again after saving.
+    void begin(const QString& documentPath);
+    // Stops journalling and removes the journal
+    void discard();
+    bool isActive() const { return !m_path.isEmpty(); }
+
+    // Called for every entry the undo journal records, and for every entry
+    // it undoes (undo = true) or redoes
+    void record(const UndoJournal::Entry& entry, bool undo = false);
+    void recordPage(const QColor& backgroundColor, const QSize& canvasSize);
+    // Rewrites the journal as a snapshot of document, which must include
+    // every edit recorded so far. The writer thread reads the shapes
+    // later, so they must be copies nothing else changes (see
+    // DiagramShape::clone()).
+    void compact(const FlowDocument& document);
+
+    // Where the journal for a document goes: a hidden file beside it, or
+    // the autosave directory if that is not writable or it is untitled
+    static QString journalPath(const QString& documentPath);
+    // Journals left behind by sessions that did not end cleanly
+    static QStringList orphanedJournals();
+    // Reads a journal up to its first damaged record; false if even the
+    // header is unusable, or the document file changed since the journal
+    // was begun
+    static bool read(const QString& journalPath, Recovery& recovery);
+    static void remove(const QString& journalPath);
+
+signals:
+    // The records have outgrown the document; see compact()
+    void compactionDue();
+    // The journal could not be written, so edits since are not safe.
+    // Emitted from the writer thread, once per run of failures.
+    void writeFailed(const QString& message);
+
+private:
+    void flush();
+    void closeHeld();
+    void append(const QByteArray& payload);
+    // Replaces the journal with a header, and the snapshot if given
+    void writeHeader(const FlowDocument* snapshot);
+    // On the writer thread, after each write
+    void reportWrite(bool ok, const QFileDevice& file);
+
+    QString m_path;
+    QString m_documentPath;
+    // Identify the file the records apply to
+    qint64 m_documentSize = 0;
+    qint64 m_documentModified = 0;
+    std::shared_ptr<QLockFile> m_lock;
+    // The newest entry while it may still coalesce with the next one
+    UndoJournal::Entry m_held;
+    bool m_holding = false;
+    QByteArray m_pending; // framed records not yet handed to the writer
+    qint64 m_recordBytes = 0;
+    // Set by the writer once a snapshot is encoded
+    std::atomic<qint64> m_baseBytes { 0 };
+    bool m_writeFailing = false; // writer thread only
+    QTimer m_flushTimer;
+    QThreadPool m_writer; // one thread, so writes land in order
+};
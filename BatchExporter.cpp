@@ -0,0 +1,276 @@
+/**
+ * @file BatchExporter.cpp
+ * @brief Implementation of the headless batch converter
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "BatchExporter.h"
+#include "FlowIO.h"
+#include "DiagramShape.h"
+#include "SvgWriter.h"
+#include "TiledImageExporter.h"
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutex>
+#include <QPageSize>
+#include <QPainter>
+#include <QPdfWriter>
+#include <QSaveFile>
+#include <QSet>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QtConcurrentMap>
+#include <atomic>
+#include <cstring>
+
+namespace {
+
+// Document units are 96 DPI pixels
+const qreal kDocumentDpi = 96.0;
+
+struct Job {
+    QString input;
+    QString output;
+};
+
+QString extensionFor(BatchExporter::Format format)
+{
+    switch (format) {
+    case BatchExporter::Png: return QStringLiteral("png");
+    case BatchExporter::Svg: return QStringLiteral("svg");
+    case BatchExporter::Pdf: return QStringLiteral("pdf");
+    }
+    return QString();
+}
+
+bool setError(QString* error, const QString& message)
+{
+    if (error) *error = message;
+    return false;
+}
+
+// Draws the document's background and shapes in document coordinates
+void paintDocument(QPainter* painter, const QVector<DiagramShape*>& shapes, const QRectF& area,
+                   const QColor& background)
+{
+    painter->setRenderHint(QPainter::Antialiasing);
+    painter->fillRect(area, background);
+    // Vector output is resolution independent, so it gets full detail
+    RenderList list(1.0);
+    list.setDrawSelection(false);
+    list.addShapes(shapes);
+    list.replay(painter);
+}
+
+} // namespace
+
+bool BatchExporter::isRequested(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--export") == 0 || std::strncmp(argv[i], "--export=", 9) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int BatchExporter::run(const QStringList& arguments)
+{
+    QTextStream err(stderr);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Converts .flow diagrams to images without opening a window."));
+    parser.addHelpOption();
+    QCommandLineOption exportOption(QStringLiteral("export"),
+        QStringLiteral("Output format: png, svg or pdf."), QStringLiteral("format"));
+    QCommandLineOption outputOption(QStringList() << QStringLiteral("o") << QStringLiteral("output"),
+        QStringLiteral("Directory for the output files."), QStringLiteral("dir"), QStringLiteral("."));
+    QCommandLineOption dpiOption(QStringLiteral("dpi"),
+        QStringLiteral("Resolution of PNG output."), QStringLiteral("dpi"), QStringLiteral("96"));
+    QCommandLineOption areaOption(QStringLiteral("area"),
+        QStringLiteral("Exported area: page or content."), QStringLiteral("area"), QStringLiteral("page"));
+    QCommandLineOption jobsOption(QStringList() << QStringLiteral("j") << QStringLiteral("jobs"),
+        QStringLiteral("Files converted at the same time (default: number of cores)."), QStringLiteral("n"));
+    parser.addOption(exportOption);
+    parser.addOption(outputOption);
+    parser.addOption(dpiOption);
+    parser.addOption(areaOption);
+    parser.addOption(jobsOption);
+    parser.addPositionalArgument(QStringLiteral("files"), QStringLiteral("Input .flow files."),
+                                 QStringLiteral("in.flow..."));
+
+    if (!parser.parse(arguments)) {
+        err << parser.errorText() << "\n";
+        return UsageError;
+    }
+    if (parser.isSet(QStringLiteral("help"))) {
+        QTextStream(stdout) << parser.helpText();
+        return Success;
+    }
+
+    // Validate everything before converting anything
+    Format format;
+    const QString formatName = parser.value(exportOption).toLower();
+    if (formatName == QLatin1String("png")) format = Png;
+    else if (formatName == QLatin1String("svg")) format = Svg;
+    else if (formatName == QLatin1String("pdf")) format = Pdf;
+    else {
+        err << "Unknown export format: " << formatName << "\n";
+        return UsageError;
+    }
+
+    bool ok = false;
+    const qreal dpi = parser.value(dpiOption).toDouble(&ok);
+    if (!ok || dpi <= 0) {
+        err << "Invalid DPI: " << parser.value(dpiOption) << "\n";
+        return UsageError;
+    }
+
+    const QString area = parser.value(areaOption);
+    if (area != QLatin1String("page") && area != QLatin1String("content")) {
+        err << "Unknown area: " << area << "\n";
+        return UsageError;
+    }
+    const bool contentOnly = area == QLatin1String("content");
+
+    int jobs = 0;
+    if (parser.isSet(jobsOption)) {
+        jobs = parser.value(jobsOption).toInt(&ok);
+        if (!ok || jobs <= 0) {
+            err << "Invalid job count: " << parser.value(jobsOption) << "\n";
+            return UsageError;
+        }
+    }
+
+    const QStringList inputs = parser.positionalArguments();
+    if (inputs.isEmpty()) {
+        err << "No input files\n";
+        return UsageError;
+    }
+
+    const QDir outputDir(parser.value(outputOption));
+    if (!QDir().mkpath(outputDir.path())) {
+        err << "Cannot create output directory: " << outputDir.path() << "\n";
+        return WriteFailed;
+    }
+
+    // One output per input, named after it; two inputs with the same base
+    // name would silently overwrite each other
+    QVector<Job> jobList;
+    QSet<QString> outputs;
+    for (const QString& input : inputs) {
+        const QString output = outputDir.filePath(QFileInfo(input).completeBaseName() + "." + extensionFor(format));
+        if (outputs.contains(output)) {
+            err << "Two inputs would both be written to " << output << "\n";
+            return UsageError;
+        }
+        outputs.insert(output);
+        jobList.append(Job{ input, output });
+    }
+
+    // Files are converted on the global pool; PNG exports also split
+    // their tiles over the same pool
+    if (jobs > 0) {
+        QThreadPool::globalInstance()->setMaxThreadCount(jobs);
+    }
+
+    QMutex reportMutex;
+    QTextStream out(stdout);
+    auto report = [&](const char* status, const QString& input, const QString& detail) {
+        QMutexLocker locker(&reportMutex);
+        out << status << '\t' << input << '\t' << detail << '\n';
+        out.flush();
+    };
+
+    std::atomic<int> exitCode(Success);
+    QtConcurrent::blockingMap(jobList.constBegin(), jobList.constEnd(), [&](const Job& job) {
+        FlowDocument document;
+        if (!FlowIO::load(job.input, document)) {
+            report("load-error", job.input, QStringLiteral("cannot read document"));
+            exitCode |= LoadFailed;
+            return;
+        }
+        QString error;
+        if (!exportDocument(document, format, job.output, dpi, contentOnly, &error)) {
+            report("write-error", job.input, error);
+            exitCode |= WriteFailed;
+            return;
+        }
+        report("ok", job.input, job.output);
+    });
+    return exitCode;
+}
+
+bool BatchExporter::exportDocument(const FlowDocument& document, Format format, const QString& fileName,
+                                   qreal dpi, bool contentOnly, QString* error)
+{
+    QVector<DiagramShape*> shapes;
+    shapes.reserve(document.shapes.size());
+    for (const auto& shape : document.shapes) {
+        shapes.append(shape.get());
+    }
+
+    QRectF area(QPointF(0, 0), QSizeF(document.canvasSize));
+    if (contentOnly) {
+        const QRectF content = TiledImageExporter::contentBounds(shapes);
+        // An empty document still produces its (empty) page
+        if (!content.isEmpty()) {
+            area = content;
+        }
+    }
+    if (area.isEmpty()) {
+        return setError(error, QStringLiteral("empty page"));
+    }
+
+    switch (format) {
+    case Png: {
+        TiledImageExporter exporter(shapes, area, document.backgroundColor, dpi / kDocumentDpi);
+        if (!exporter.exportToPng(fileName, dpi)) {
+            return setError(error, QStringLiteral("cannot write PNG"));
+        }
+        return true;
+    }
+    case Svg: {
+        SvgWriter writer(shapes, area, document.backgroundColor);
+        if (!writer.write(fileName)) {
+            return setError(error, writer.errorString());
+        }
+        return true;
+    }
+    case Pdf: {
+        // Through QSaveFile like the other formats, so a failed write
+        // leaves no truncated PDF behind
+        QSaveFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly)) {
+            return setError(error, file.errorString());
+        }
+        // One page exactly the size of the area; at 96 DPI one device unit
+        // is one document unit
+        QPdfWriter writer(&file);
+        writer.setResolution(int(kDocumentDpi));
+        writer.setPageSize(QPageSize(area.size() * 72.0 / kDocumentDpi, QPageSize::Point,
+                                     QString(), QPageSize::ExactMatch));
+        writer.setPageMargins(QMarginsF(0, 0, 0, 0));
+        QPainter painter;
+        if (!painter.begin(&writer)) {
+            file.cancelWriting();
+            return setError(error, QStringLiteral("cannot write PDF"));
+        }
+        painter.translate(-area.topLeft());
+        paintDocument(&painter, shapes, area, document.backgroundColor);
+        // end() writes the rest of the document out. Write errors on the
+        // way are remembered by QSaveFile, so commit() catches those.
+        if (!painter.end()) {
+            file.cancelWriting();
+            return setError(error, QStringLiteral("cannot write PDF"));
+        }
+        if (!file.commit()) {
+            return setError(error, file.errorString());
+        }
+        return true;
+    }
+    }
+    return setError(error, QStringLiteral("unknown format"));
+}
@@ -0,0 +1,57 @@
+/**
+ * @file BatchExporter.h
+ * @brief Headless command-line conversion of .flow files to images
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QString>
+#include <QStringList>
+
+struct FlowDocument;
+
+// Runs when the program is started with --export, e.g.
+//
+//   flow --export png|svg|pdf [-o outdir] [--dpi 96] [--area page|content]
+//        [-j jobs] in.flow...
+//
+// Documents are loaded with FlowIO and rendered without creating any
+// widget, on the offscreen platform, several files at a time. For every
+// input one tab-separated line is printed to stdout:
+//
+//   ok          <input>  <output>
+//   load-error  <input>  <message>
+//   write-error <input>  <message>
+//
+// and the exit code is a combination of the ExitCode flags.
+class BatchExporter
+{
+public:
+    enum Format {
+        Png,
+        Svg,
+        Pdf
+    };
+
+    enum ExitCode {
+        Success = 0,
+        UsageError = 1,     // bad arguments; nothing was exported
+        LoadFailed = 2,     // at least one input could not be read
+        WriteFailed = 4     // at least one output could not be written
+    };
+
+    // True if the raw arguments ask for batch mode. Checked before any
+    // application object exists, to pick the platform plugin.
+    static bool isRequested(int argc, char* argv[]);
+
+    // Parses the arguments (including the program name) and converts all
+    // inputs. Needs a QGuiApplication for fonts.
+    static int run(const QStringList& arguments);
+
+    // Renders one document, either the whole page or cropped to the
+    // content's extent. dpi sets the PNG resolution; vector output keeps
+    // document units (96 per inch).
+    static bool exportDocument(const FlowDocument& document, Format format, const QString& fileName,
+                               qreal dpi, bool contentOnly, QString* error = nullptr);
+};
@@ -0,0 +1,60 @@
+/**
+ * @file ConnectionIndex.cpp
+ * @brief Implementation of the shape-to-connector adjacency index
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "ConnectionIndex.h"
+
+void ConnectionIndex::attach(ShapeId connector, ShapeId start, ShapeId end)
+{
+    detach(connector);
+    if (start == 0 && end == 0) return;
+
+    m_ends.insert(connector, Ends{ start, end });
+    link(start, connector);
+    // A connector looping back to the same shape is listed there once
+    if (end != start) {
+        link(end, connector);
+    }
+}
+
+void ConnectionIndex::detach(ShapeId connector)
+{
+    auto it = m_ends.find(connector);
+    if (it == m_ends.end()) return;
+    unlink(it->start, connector);
+    unlink(it->end, connector);
+    m_ends.erase(it);
+}
+
+void ConnectionIndex::clear()
+{
+    m_byShape.clear();
+    m_ends.clear();
+}
+
+void ConnectionIndex::link(ShapeId shape, ShapeId connector)
+{
+    if (shape != 0) {
+        m_byShape[shape].append(connector);
+    }
+}
+
+void ConnectionIndex::unlink(ShapeId shape, ShapeId connector)
+{
+    auto it = m_byShape.find(shape);
+    if (it == m_byShape.end()) return;
+
+    QVector<ShapeId>& connectors = *it;
+    const int i = connectors.indexOf(connector);
+    if (i >= 0) {
+        // Order is irrelevant, so swap-remove
+        connectors[i] = connectors.last();
+        connectors.removeLast();
+    }
+    if (connectors.isEmpty()) {
+        m_byShape.erase(it);
+    }
+}
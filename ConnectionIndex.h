@@ -0,0 +1,39 @@
+/**
+ * @file ConnectionIndex.h
+ * @brief Adjacency index from shapes to the connectors attached to them
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QHash>
+#include <QVector>
+#include "DiagramShape.h"
+
+// Maps every shape to the connectors bound to it, so that moving a shape
+// re-anchors just its own connectors instead of scanning all of them.
+// Everything is referenced by id; the index does not own anything.
+class ConnectionIndex
+{
+public:
+    // Records (or replaces) the shapes a connector is bound to; 0 for a
+    // free end
+    void attach(ShapeId connector, ShapeId start, ShapeId end);
+    void detach(ShapeId connector);
+    void clear();
+
+    // Connectors with at least one end on the shape, each listed once
+    QVector<ShapeId> connectorsOf(ShapeId shape) const { return m_byShape.value(shape); }
+
+private:
+    struct Ends {
+        ShapeId start;
+        ShapeId end;
+    };
+
+    void link(ShapeId shape, ShapeId connector);
+    void unlink(ShapeId shape, ShapeId connector);
+
+    QHash<ShapeId, QVector<ShapeId>> m_byShape;
+    QHash<ShapeId, Ends> m_ends;
+};
@@ -6,151 +6,155 @@
  */
 
 #include "ConnectorShape.h"
-#include <QPainterPath>
 #include <QtMath>
 #include <limits>
 
+namespace {
+
+// Liang-Barsky: does the segment a-b pass through the rect?
+bool segmentIntersects(const QPointF& a, const QPointF& b, const QRectF& rect)
+{
+    const qreal dx = b.x() - a.x();
+    const qreal dy = b.y() - a.y();
+    const qreal p[4] = { -dx, dx, -dy, dy };
+    const qreal q[4] = { a.x() - rect.left(), rect.right() - a.x(),
+                         a.y() - rect.top(), rect.bottom() - a.y() };
+    qreal t0 = 0.0;
+    qreal t1 = 1.0;
+    for (int i = 0; i < 4; ++i) {
+        if (p[i] == 0) {
+            // Parallel to this edge: either fully outside or no constraint
+            if (q[i] < 0) return false;
+            continue;
+        }
+        const qreal t = q[i] / p[i];
+        if (p[i] < 0) {
+            if (t > t1) return false;
+            t0 = qMax(t0, t);
+        }
+        else {
+            if (t < t0) return false;
+            t1 = qMin(t1, t);
+        }
+    }
+    return true;
+}
+
+} // namespace
+
 ConnectorShape::ConnectorShape()
     : DiagramShape(Connector)
     , arrowStyle(End)
 {
+    updateGeometry();
 }
 
-void ConnectorShape::paint(QPainter* painter)
+void ConnectorShape::updateGeometry()
 {
-    painter->save();
+    polyline.resize(controlPoints.size() + 2);
+    polyline[0] = startPoint;
+    for (int i = 0; i < controlPoints.size(); ++i) {
+        polyline[i + 1] = controlPoints[i];
+    }
+    polyline[polyline.size() - 1] = endPoint;
+
+    segments.assign(polyline);
 
+    // Hit tolerance, arrowheads and the selected pen all fit in the margin
+    const qreal margin = 10.0;
+    pointBounds = polyline.boundingRect().adjusted(-margin, -margin, margin, margin);
+}
+
+void ConnectorShape::compile(RenderList& list) const
+{
     // Set line style
     QPen pen(lineColor, lineWidth);
-    if (isSelected) {
+    if (showSelection(list)) {
         pen.setWidth(lineWidth + 1);
         pen.setColor(Qt::blue);
     }
-    painter->setPen(pen);
+    list.setPen(pen);
 
-    // Draw connector line (straight or with control points)
-    if (controlPoints.isEmpty()) {
-        // Straight line
-        painter->drawLine(startPoint, endPoint);
+    // Arrowheads and handles are skipped when zoomed far out
+    const bool decorate = showDecorations(list);
 
-        // Draw arrows
-        if (arrowStyle == Start || arrowStyle == Both) {
-            drawArrow(painter, startPoint, endPoint);
-        }
-        if (arrowStyle == End || arrowStyle == Both) {
-            drawArrow(painter, endPoint, startPoint);
-        }
+    // Straight connectors share one drawLines call per style; polylines
+    // keep their joins
+    if (controlPoints.isEmpty()) {
+        list.addLine(QLineF(startPoint, endPoint));
     }
     else {
-        // Polyline or curve
-        QPainterPath path;
-        path.moveTo(startPoint);
-        for (const QPointF& point : controlPoints) {
-            path.lineTo(point);
-        }
-        path.lineTo(endPoint);
-        painter->drawPath(path);
+        list.addPolyline(polyline);
+    }
 
-        // Draw arrows
-        if (arrowStyle == Start || arrowStyle == Both) {
-            QPointF dir = controlPoints.isEmpty() ? endPoint : controlPoints.first();
-            drawArrow(painter, startPoint, dir);
-        }
-        if (arrowStyle == End || arrowStyle == Both) {
-            QPointF dir = controlPoints.isEmpty() ? startPoint : controlPoints.last();
-            drawArrow(painter, endPoint, dir);
-        }
+    // Draw arrows
+    if (decorate && (arrowStyle == Start || arrowStyle == Both)) {
+        QPointF dir = controlPoints.isEmpty() ? endPoint : controlPoints.first();
+        compileArrow(list, startPoint, dir);
+    }
+    if (decorate && (arrowStyle == End || arrowStyle == Both)) {
+        QPointF dir = controlPoints.isEmpty() ? startPoint : controlPoints.last();
+        compileArrow(list, endPoint, dir);
     }
 
     // Draw handles if selected
-    if (isSelected) {
-        painter->setBrush(Qt::white);
-        painter->setPen(QPen(Qt::blue, 1));
-        const int handleSize = 6;
-        QRectF handleRect(-handleSize / 2, -handleSize / 2, handleSize, handleSize);
+    if (showSelection(list) && decorate) {
+        list.setBrush(Qt::white);
+        list.setPen(QPen(Qt::blue, 1));
+        const qreal handleSize = 6;
+        const qreal radius = handleSize / 2;
 
         // Start and end points
-        painter->drawEllipse(startPoint, handleSize / 2, handleSize / 2);
-        painter->drawEllipse(endPoint, handleSize / 2, handleSize / 2);
+        list.addEllipse(QRectF(startPoint.x() - radius, startPoint.y() - radius, handleSize, handleSize));
+        list.addEllipse(QRectF(endPoint.x() - radius, endPoint.y() - radius, handleSize, handleSize));
 
         // Control points
         for (const QPointF& point : controlPoints) {
-            painter->drawRect(handleRect.translated(point));
+            list.addRect(QRectF(point.x() - radius, point.y() - radius, handleSize, handleSize));
         }
     }
 
     // Draw text at midpoint if any
-    if (!m_text.isEmpty()) {
-        QPointF midPoint;
-        if (controlPoints.isEmpty()) {
-            midPoint = (startPoint + endPoint) / 2;
-        }
-        else {
-            int midIndex = controlPoints.size() / 2;
-            midPoint = controlPoints[midIndex];
-        }
-        QRectF textRect(midPoint.x() - 50, midPoint.y() - 20, 100, 40);
-        painter->setPen(Qt::black);
-        painter->drawText(textRect, Qt::AlignCenter, m_text);
+    const QFont labelFont;
+    if (!labelText().isEmpty() && isTextReadable(list, labelFont)) {
+        list.setPen(QPen(Qt::black));
+        list.addText(textLayout(), labelRect(), labelText(), labelFont, Qt::AlignCenter);
     }
-
-    painter->restore();
 }
 
 bool ConnectorShape::contains(const QPointF& point) const
 {
-    // Check if the point is near the connector
-    const qreal threshold = 5.0; // tolerance
+    // Check if the point is within tolerance of any segment, using the
+    // exact point-to-segment distance
+    if (!pointBounds.contains(point)) {
+        return false;
+    }
+    return segments.anyWithin(point, kHitTolerance);
+}
 
-    if (controlPoints.isEmpty()) {
-        // Straight line
-        QLineF line(startPoint, endPoint);
-        qreal distance = QLineF(line.p1(), point).length() + QLineF(line.p2(), point).length();
-        qreal lineLength = line.length();
-        return qAbs(distance - lineLength) < threshold;
+bool ConnectorShape::intersects(const QRectF& rect) const
+{
+    // The bounds of a diagonal line are mostly empty, so a marquee has to
+    // touch the line itself (or the label)
+    if (!pointBounds.intersects(rect)) {
+        return false;
     }
-    else {
-        // Polyline
-        QPointF prevPoint = startPoint;
-        for (const QPointF& currPoint : controlPoints) {
-            QLineF segment(prevPoint, currPoint);
-            qreal distance = QLineF(segment.p1(), point).length() + QLineF(segment.p2(), point).length();
-            qreal segmentLength = segment.length();
-            if (qAbs(distance - segmentLength) < threshold) {
-                return true;
-            }
-            prevPoint = currPoint;
+    for (int i = 1; i < polyline.size(); ++i) {
+        if (segmentIntersects(polyline[i - 1], polyline[i], rect)) {
+            return true;
         }
-        // Last segment to endPoint
-        QLineF segment(prevPoint, endPoint);
-        qreal distance = QLineF(segment.p1(), point).length() + QLineF(segment.p2(), point).length();
-        qreal segmentLength = segment.length();
-        return qAbs(distance - segmentLength) < threshold;
     }
+    return !labelText().isEmpty() && labelRect().intersects(rect);
 }
 
 QRectF ConnectorShape::boundingRect() const
 {
-    // Calculate bounding rect for all points
-    QVector<QPointF> allPoints = controlPoints;
-    allPoints.prepend(startPoint);
-    allPoints.append(endPoint);
-
-    qreal minX = std::numeric_limits<qreal>::max();
-    qreal minY = std::numeric_limits<qreal>::max();
-    qreal maxX = std::numeric_limits<qreal>::lowest();
-    qreal maxY = std::numeric_limits<qreal>::lowest();
-
-    for (const QPointF& point : allPoints) {
-        minX = qMin(minX, point.x());
-        minY = qMin(minY, point.y());
-        maxX = qMax(maxX, point.x());
-        maxY = qMax(maxY, point.y());
+    // Point bounds (with margin) are cached by updateGeometry(). The label
+    // box is centred on the midpoint and may stick out past the line.
+    if (labelText().isEmpty()) {
+        return pointBounds;
     }
-
-    // Add margin
-    const qreal margin = 10.0;
-    return QRectF(minX - margin, minY - margin, maxX - minX + 2 * margin, maxY - minY + 2 * margin);
+    return pointBounds | labelRect();
 }
 
 void ConnectorShape::moveBy(const QPointF& delta)
@@ -160,6 +164,9 @@ void ConnectorShape::moveBy(const QPointF& delta)
     for (QPointF& point : controlPoints) {
         point += delta;
     }
+    segments.translate(delta);
+    polyline.translate(delta);
+    pointBounds.translate(delta);
 }
 
 void ConnectorShape::setSize(const QSizeF& newSize)
@@ -170,6 +177,7 @@ void ConnectorShape::setSize(const QSizeF& newSize)
     if (length > 0) {
         direction /= length;
         endPoint = startPoint + direction * newSize.width();
+        updateGeometry();
     }
 }
 
@@ -182,11 +190,13 @@ QSizeF ConnectorShape::getSize() const
 void ConnectorShape::setStartPoint(const QPointF& point)
 {
     startPoint = point;
+    updateGeometry();
 }
 
 void ConnectorShape::setEndPoint(const QPointF& point)
 {
     endPoint = point;
+    updateGeometry();
 }
 
 QPointF ConnectorShape::getStartPoint() const
@@ -212,11 +222,13 @@ ConnectorShape::ArrowStyle ConnectorShape::getArrowStyle() const
 void ConnectorShape::addControlPoint(const QPointF& point)
 {
     controlPoints.append(point);
+    updateGeometry();
 }
 
 void ConnectorShape::clearControlPoints()
 {
     controlPoints.clear();
+    updateGeometry();
 }
 
 QVector<QPointF> ConnectorShape::getControlPoints() const
@@ -224,19 +236,75 @@ QVector<QPointF> ConnectorShape::getControlPoints() const
     return controlPoints;
 }
 
-void ConnectorShape::drawArrow(QPainter* painter, const QPointF& tip, const QPointF& from) const
+void ConnectorShape::setRoute(const QPointF& start, const QVector<QPointF>& points, const QPointF& end)
+{
+    startPoint = start;
+    controlPoints = points;
+    endPoint = end;
+    updateGeometry();
+}
+
+void ConnectorShape::setStartBinding(ShapeId shape, Port port)
+{
+    startShape = shape;
+    startPort = port;
+}
+
+void ConnectorShape::setEndBinding(ShapeId shape, Port port)
+{
+    endShape = shape;
+    endPort = port;
+}
+
+void ConnectorShape::reanchor(const DiagramShape* start, const DiagramShape* end)
+{
+    if (!start && !end) return;
+
+    // An auto port aims at the first bend, or else at where the other end
+    // is attached (its port, or the centre of its shape before clipping)
+    auto anchorOf = [](const DiagramShape* shape, Port port, const QPointF& point) {
+        if (!shape) return point;
+        return port == AutoPort ? shape->boundingRect().center() : shape->portPosition(port);
+    };
+    const QPointF startTarget = controlPoints.isEmpty() ? anchorOf(end, endPort, endPoint) : controlPoints.first();
+    const QPointF endTarget = controlPoints.isEmpty() ? anchorOf(start, startPort, startPoint) : controlPoints.last();
+
+    if (start) {
+        startPoint = startPort == AutoPort ? start->outlinePoint(startTarget) : start->portPosition(startPort);
+    }
+    if (end) {
+        endPoint = endPort == AutoPort ? end->outlinePoint(endTarget) : end->portPosition(endPort);
+    }
+    updateGeometry();
+}
+
+QRectF ConnectorShape::labelRect() const
+{
+    QPointF midPoint;
+    if (controlPoints.isEmpty()) {
+        midPoint = (startPoint + endPoint) / 2;
+    }
+    else {
+        int midIndex = controlPoints.size() / 2;
+        midPoint = controlPoints[midIndex];
+    }
+    return QRectF(midPoint.x() - 50, midPoint.y() - 20, 100, 40);
+}
+
+void ConnectorShape::compileArrow(RenderList& list, const QPointF& tip, const QPointF& from) const
 {
     const qreal arrowSize = 10.0; // arrow size
+    // Equilateral head: both back corners 30 degrees off the line direction
     QLineF line(from, tip);
-    qreal angle = std::atan2(-line.dy(), -line.dx());
-    QPointF arrowP1 = tip + QPointF(qSin(angle + M_PI / 3) * arrowSize,
-        qCos(angle + M_PI / 3) * arrowSize);
-    QPointF arrowP2 = tip + QPointF(qSin(angle + M_PI - M_PI / 3) * arrowSize,
-        qCos(angle + M_PI - M_PI / 3) * arrowSize);
+    qreal angle = std::atan2(line.dy(), line.dx());
+    QPointF arrowP1 = tip - QPointF(qCos(angle - M_PI / 6) * arrowSize,
+        qSin(angle - M_PI / 6) * arrowSize);
+    QPointF arrowP2 = tip - QPointF(qCos(angle + M_PI / 6) * arrowSize,
+        qSin(angle + M_PI / 6) * arrowSize);
     QPolygonF arrowHead;
     arrowHead << tip << arrowP1 << arrowP2;
-    painter->setBrush(lineColor);
-    painter->drawPolygon(arrowHead);
+    list.setBrush(lineColor);
+    list.addPolygon(arrowHead);
 }
 
 void ConnectorShape::save(QDataStream& out) const
@@ -245,13 +313,19 @@ void ConnectorShape::save(QDataStream& out) const
     out << startPoint;
     out << endPoint;
     out << (int)arrowStyle;
-    out << controlPoints.size();
+    // Fixed width: qsizetype is 64-bit on Qt 6 but read back as an int
+    out << qint32(controlPoints.size());
     for (const QPointF& point : controlPoints) {
         out << point;
     }
 }
 
 void ConnectorShape::load(QDataStream& in)
+{
+    load(in, false);
+}
+
+void ConnectorShape::load(QDataStream& in, bool wideCount)
 {
     DiagramShape::load(in);
     in >> startPoint;
@@ -259,12 +333,20 @@ void ConnectorShape::load(QDataStream& in)
     int style;
     in >> style;
     arrowStyle = (ArrowStyle)style;
-    int pointCount;
-    in >> pointCount;
+    qint32 pointCount;
+    if (wideCount) {
+        qint64 count;
+        in >> count;
+        pointCount = qint32(qMin<qint64>(count, std::numeric_limits<qint32>::max()));
+    }
+    else {
+        in >> pointCount;
+    }
     controlPoints.clear();
-    for (int i = 0; i < pointCount; ++i) {
+    for (int i = 0; i < pointCount && in.status() == QDataStream::Ok; ++i) {
         QPointF point;
         in >> point;
         controlPoints.append(point);
     }
-}
\ No newline at end of file
+    updateGeometry();
+}
\ No newline at end of file
@@ -7,6 +7,7 @@
 
 #pragma once
 #include "DiagramShape.h"
+#include "SegmentHitTest.h"
 #include <QPointF>
 #include <QVector>
 
@@ -14,11 +15,18 @@
 class ConnectorShape : public DiagramShape {
 public:
     enum ArrowStyle { None, Start, End, Both };
+    // Direct connectors keep the control points they are given;
+    // orthogonal ones get theirs from the canvas' router
+    enum RoutingStyle { Direct, Orthogonal };
     
+    // How close to the line contains() counts as a hit, in document units
+    static constexpr qreal kHitTolerance = 5.0;
+
     ConnectorShape();
     
-    void paint(QPainter *painter) override;
+    void compile(RenderList& list) const override;
     bool contains(const QPointF &point) const override;
+    bool intersects(const QRectF& rect) const override;
     QRectF boundingRect() const override;
     void moveBy(const QPointF& delta) override;
     void setSize(const QSizeF& newSize) override;
@@ -35,15 +43,54 @@ public:
     void addControlPoint(const QPointF& point);
     void clearControlPoints();
     QVector<QPointF> getControlPoints() const;
+
+    void setRoutingStyle(RoutingStyle style) { routingStyle = style; }
+    RoutingStyle getRoutingStyle() const { return routingStyle; }
+    // Replaces ends and control points in one go, for routers
+    void setRoute(const QPointF& start, const QVector<QPointF>& points, const QPointF& end);
+
+    // An end bound to a shape follows it: the canvas calls reanchor() with
+    // the bound shapes whenever one of them moves or changes size. 0 means
+    // the end is free.
+    void setStartBinding(ShapeId shape, Port port = AutoPort);
+    void setEndBinding(ShapeId shape, Port port = AutoPort);
+    ShapeId getStartShape() const { return startShape; }
+    ShapeId getEndShape() const { return endShape; }
+    Port getStartPort() const { return startPort; }
+    Port getEndPort() const { return endPort; }
+    bool isBound() const { return startShape != 0 || endShape != 0; }
+    // start/end are the bound shapes, null for free ends
+    void reanchor(const DiagramShape* start, const DiagramShape* end);
+
+    // Box the label text is centred in
+    QRectF labelRect() const;
+    // The packed segments, for hit testing many connectors in one batch
+    // (see SegmentBuffer); a hit there is a hit of contains()
+    const SegmentBuffer& hitSegments() const { return segments; }
     
     void save(QDataStream &out) const override;
     void load(QDataStream &in) override;
+    // Version 1 documents from Qt 6 builds wrote the point count as a
+    // 64-bit qsizetype; FlowIO tells by the document's shape count
+    void load(QDataStream &in, bool wideCount);
     
 private:
     QPointF startPoint;
     QPointF endPoint;
     QVector<QPointF> controlPoints;
     ArrowStyle arrowStyle;
+    RoutingStyle routingStyle = Direct;
+    ShapeId startShape = 0;
+    ShapeId endShape = 0;
+    Port startPort = AutoPort;
+    Port endPort = AutoPort;
+
+    // Derived from the points above by updateGeometry(); moveBy translates
+    // them in place instead of rebuilding
+    SegmentBuffer segments;
+    QPolygonF polyline;
+    QRectF pointBounds;
     
-    void drawArrow(QPainter* painter, const QPointF& start, const QPointF& end) const;
+    void updateGeometry();
+    void compileArrow(RenderList& list, const QPointF& tip, const QPointF& from) const;
 };
\ No newline at end of file
@@ -0,0 +1,240 @@
+/**
+ * @file DeflateEncoder.cpp
+ * @brief Implementation of the streaming zlib compressor
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "DeflateEncoder.h"
+#include <algorithm>
+
+namespace {
+
+const int kWindowSize = 32768;
+const int kWindowMask = kWindowSize - 1;
+const int kHashBits = 15;
+const int kMinMatch = 3;
+const int kMaxMatch = 258;
+// Candidates tried per position; more compresses a little better and runs
+// a lot slower
+const int kMaxChain = 32;
+// Largest number of bytes Adler-32 can sum before its sums must be reduced
+const int kAdlerBlock = 5552;
+const quint32 kAdlerModulus = 65521;
+
+// RFC 1951, 3.2.5: base value and extra bits of each length and distance
+// code
+const int kLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                              35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const int kLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                               3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const int kDistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                8193, 12289, 16385, 24577 };
+const int kDistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// Huffman codes go out most significant bit first, everything else least
+// significant bit first
+quint32 reversed(quint32 code, int length)
+{
+    quint32 result = 0;
+    for (int i = 0; i < length; ++i) {
+        result = (result << 1) | ((code >> i) & 1);
+    }
+    return result;
+}
+
+} // namespace
+
+DeflateEncoder::DeflateEncoder()
+    : m_bufferStart(0)
+    , m_pos(0)
+    , m_end(0)
+    , m_head(1 << kHashBits, -1)
+    , m_prev(kWindowSize, -1)
+    , m_adlerA(1)
+    , m_adlerB(0)
+    , m_bits(0)
+    , m_bitCount(0)
+    , m_finished(false)
+{
+    // zlib header: deflate with a 32 KiB window, no dictionary, check
+    // bits making it a multiple of 31
+    m_out.append(char(0x78));
+    m_out.append(char(0x01));
+    // One block for the whole stream: not final, fixed Huffman codes
+    writeBits(0, 1);
+    writeBits(1, 2);
+}
+
+void DeflateEncoder::write(const uchar* data, int size)
+{
+    if (m_finished || size <= 0) return;
+
+    for (int offset = 0; offset < size; offset += kAdlerBlock) {
+        const int end = qMin(size, offset + kAdlerBlock);
+        for (int i = offset; i < end; ++i) {
+            m_adlerA += data[i];
+            m_adlerB += m_adlerA;
+        }
+        m_adlerA %= kAdlerModulus;
+        m_adlerB %= kAdlerModulus;
+    }
+
+    m_buffer.append(reinterpret_cast<const char*>(data), size);
+    m_end += size;
+    compress(false);
+}
+
+void DeflateEncoder::finish()
+{
+    if (m_finished) return;
+    compress(true);
+    writeCode(256);
+    // An empty final block closes the stream
+    writeBits(1, 1);
+    writeBits(1, 2);
+    writeCode(256);
+    alignToByte();
+
+    const quint32 adler = (m_adlerB << 16) | m_adlerA;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        m_out.append(char((adler >> shift) & 0xff));
+    }
+    m_buffer.clear();
+    m_finished = true;
+}
+
+void DeflateEncoder::compress(bool flush)
+{
+    while (m_pos < m_end) {
+        const int available = int(qMin<qint64>(m_end - m_pos, kMaxMatch));
+        if (!flush && available < kMaxMatch) break;
+
+        int distance = 0;
+        const int length = available >= kMinMatch ? longestMatch(m_pos, available, &distance) : 0;
+        if (length >= kMinMatch) {
+            writeMatch(length, distance);
+            for (int i = 0; i < length; ++i) {
+                insertHash(m_pos + i);
+            }
+            m_pos += length;
+        }
+        else {
+            writeLiteral(byteAt(m_pos));
+            insertHash(m_pos);
+            ++m_pos;
+        }
+    }
+
+    // Only the window behind the next position is needed any more
+    if (m_pos - m_bufferStart > 2 * kWindowSize) {
+        const int drop = int(m_pos - kWindowSize - m_bufferStart);
+        m_buffer.remove(0, drop);
+        m_bufferStart += drop;
+    }
+}
+
+int DeflateEncoder::longestMatch(qint64 pos, int available, int* distance) const
+{
+    const char* current = m_buffer.constData() + (pos - m_bufferStart);
+    int best = 0;
+    int chain = kMaxChain;
+    qint64 candidate = m_head[hashAt(pos)];
+    while (candidate >= 0 && pos - candidate <= kWindowSize && chain-- > 0) {
+        const char* earlier = m_buffer.constData() + (candidate - m_bufferStart);
+        // Only a match that beats the best so far is worth comparing
+        if (earlier[best] == current[best]) {
+            int length = 0;
+            while (length < available && earlier[length] == current[length]) {
+                ++length;
+            }
+            if (length > best) {
+                best = length;
+                *distance = int(pos - candidate);
+                if (length == available) break;
+            }
+        }
+        // A slot taken over by a newer position ends the chain
+        const qint64 next = m_prev[int(candidate & kWindowMask)];
+        if (next >= candidate) break;
+        candidate = next;
+    }
+    return best;
+}
+
+void DeflateEncoder::insertHash(qint64 pos)
+{
+    if (pos + kMinMatch > m_end) return;
+    const quint32 hash = hashAt(pos);
+    m_prev[int(pos & kWindowMask)] = m_head[int(hash)];
+    m_head[int(hash)] = pos;
+}
+
+quint32 DeflateEncoder::hashAt(qint64 pos) const
+{
+    const quint32 key = (quint32(byteAt(pos)) << 16) | (quint32(byteAt(pos + 1)) << 8) | byteAt(pos + 2);
+    return (key * 2654435761u) >> (32 - kHashBits);
+}
+
+void DeflateEncoder::writeLiteral(int literal)
+{
+    writeCode(literal);
+}
+
+void DeflateEncoder::writeMatch(int length, int distance)
+{
+    const int lengthCode = int(std::upper_bound(kLengthBase, kLengthBase + 29, length) - kLengthBase) - 1;
+    writeCode(257 + lengthCode);
+    writeBits(quint32(length - kLengthBase[lengthCode]), kLengthExtra[lengthCode]);
+
+    // Distance codes are all five bits long in the fixed code
+    const int distanceCode = int(std::upper_bound(kDistanceBase, kDistanceBase + 30, distance) - kDistanceBase) - 1;
+    writeBits(reversed(quint32(distanceCode), 5), 5);
+    writeBits(quint32(distance - kDistanceBase[distanceCode]), kDistanceExtra[distanceCode]);
+}
+
+void DeflateEncoder::writeCode(int symbol)
+{
+    // The fixed literal/length code of RFC 1951, 3.2.6
+    quint32 code;
+    int length;
+    if (symbol < 144) {
+        code = 0x30 + symbol;
+        length = 8;
+    }
+    else if (symbol < 256) {
+        code = 0x190 + (symbol - 144);
+        length = 9;
+    }
+    else if (symbol < 280) {
+        code = symbol - 256;
+        length = 7;
+    }
+    else {
+        code = 0xc0 + (symbol - 280);
+        length = 8;
+    }
+    writeBits(reversed(code, length), length);
+}
+
+void DeflateEncoder::writeBits(quint32 value, int count)
+{
+    m_bits |= quint64(value) << m_bitCount;
+    m_bitCount += count;
+    while (m_bitCount >= 8) {
+        m_out.append(char(m_bits & 0xff));
+        m_bits >>= 8;
+        m_bitCount -= 8;
+    }
+}
+
+void DeflateEncoder::alignToByte()
+{
+    if (m_bitCount > 0) {
+        m_out.append(char(m_bits & 0xff));
+        m_bits = 0;
+        m_bitCount = 0;
+    }
+}
@@ -0,0 +1,65 @@
+/**
+ * @file DeflateEncoder.h
+ * @brief Streaming zlib (RFC 1950/1951) compressor without external libraries
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QByteArray>
+#include <QVector>
+
+// Compresses a stream of unknown length into one zlib stream, the way PNG
+// needs its IDAT data. qCompress() cannot do that: it wants all input at
+// once. The zlib inside Qt is private, so this is a small encoder of its
+// own: LZ77 over a 32 KiB window with hash chains, written as a single
+// fixed-Huffman block. That suits rendered images well, where most of the
+// gain is long runs of identical pixels.
+//
+// Input is fed with write(); compressed bytes collect in output(), which
+// the caller drains whenever it likes.
+class DeflateEncoder
+{
+public:
+    DeflateEncoder();
+
+    void write(const uchar* data, int size);
+    // Compresses what is left and ends the stream; write() may not be
+    // called afterwards
+    void finish();
+
+    QByteArray& output() { return m_out; }
+
+private:
+    // Encodes positions while enough lookahead is buffered for the longest
+    // match, or up to the end of the input once finishing
+    void compress(bool flush);
+    int longestMatch(qint64 pos, int available, int* distance) const;
+    void insertHash(qint64 pos);
+    quint32 hashAt(qint64 pos) const;
+    uchar byteAt(qint64 pos) const { return uchar(m_buffer[int(pos - m_bufferStart)]); }
+
+    void writeLiteral(int literal);
+    void writeMatch(int length, int distance);
+    void writeCode(int symbol);
+    void writeBits(quint32 value, int count);
+    void alignToByte();
+
+    // Uncompressed bytes from m_bufferStart on: the window behind the
+    // next position to encode plus the lookahead
+    QByteArray m_buffer;
+    qint64 m_bufferStart;
+    qint64 m_pos;  // next position to encode
+    qint64 m_end;  // end of the input so far
+    // Most recent position per hash, and the previous position with the
+    // same hash per window slot; -1 for none
+    QVector<qint64> m_head;
+    QVector<qint64> m_prev;
+
+    quint32 m_adlerA;
+    quint32 m_adlerB;
+    quint64 m_bits;
+    int m_bitCount;
+    bool m_finished;
+    QByteArray m_out;
+};
@@ -1,5 +1,10 @@
 #include "DiagramCanvas.h"
 #include "ConnectorShape.h"
+#include "FlowFormat.h"
+#include "SvgWriter.h"
+#include "TiledImageExporter.h"
+#include <QtConcurrentRun>
+#include <QSemaphore>
 #include <QPainter>
 #include <QPaintEvent>
 #include <QMouseEvent>
@@ -8,17 +13,46 @@
 #include <QInputDialog>
 #include <QMenu>
 #include <QFileDialog>
-#include <QSvgGenerator>
 #include <QApplication>
 #include <QClipboard>
 #include <QMimeData>
 #include <QBuffer>
 #include <QDebug>
+#include <QSet>
+#include <QWheelEvent>
+#include <QtMath>
+#include <algorithm>
+
+namespace {
+
+const qreal kMinZoom = 0.01;
+const qreal kMaxZoom = 16.0;
+const qreal kZoomStep = 1.25;
+// A loading worker holds back while this many batches wait in the event
+// loop, so input and paint events get their turn in between
+const int kQueuedBatches = 2;
+
+// Start point, bends and end point, as the undo journal stores routes
+QPolygonF routeOf(const ConnectorShape* connector)
+{
+    QPolygonF route;
+    route << connector->getStartPoint() << connector->getControlPoints() << connector->getEndPoint();
+    return route;
+}
+
+QVariant bindingValue(ShapeId shape, DiagramShape::Port port)
+{
+    return QVariantList{ QVariant(qulonglong(shape)), QVariant(int(port)) };
+}
+
+} // namespace
 
 DiagramCanvas::DiagramCanvas(QWidget* parent)
     : QWidget(parent)
     , m_backgroundColor(Qt::white)
     , m_canvasSize(1200, 800)
+    , m_zoom(1.0)
+    , m_isPanning(false)
     , m_modified(false)
     , m_isDragging(false)
     , m_isCreating(false)
@@ -27,159 +61,424 @@ DiagramCanvas::DiagramCanvas(QWidget* parent)
     , m_activeShapeTool(DiagramShape::None)
     , m_isConnecting(false)
     , m_startConnectShape(nullptr)
+    , m_isMarqueeSelecting(false)
 {
     setMinimumSize(600, 400);
     setFocusPolicy(Qt::StrongFocus);
     setAcceptDrops(true);
+
+    // Short delay so a drag's mouse moves are routed together
+    m_routeTimer.setSingleShot(true);
+    m_routeTimer.setInterval(15);
+    connect(&m_routeTimer, &QTimer::timeout, this, &DiagramCanvas::startRouting);
+    connect(&m_routeWatcher, &QFutureWatcherBase::finished, this, &DiagramCanvas::applyRoutes);
+    connect(&m_layoutWatcher, &QFutureWatcherBase::finished, this, &DiagramCanvas::applyLayout);
+    connect(&m_forceWatcher, &QFutureWatcherBase::finished, this, &DiagramCanvas::finishForceLayout);
+    connect(&m_loadWatcher, &QFutureWatcherBase::finished, this, &DiagramCanvas::finishLoading);
+    connect(&m_autosave, &AutosaveJournal::compactionDue, this, [this]() {
+        // Not in the middle of a drag; the next flush asks again
+        if (!m_isDragging && !m_isCreating) {
+            compactAutosave();
+        }
+    });
+    connect(&m_autosave, &AutosaveJournal::writeFailed, this, &DiagramCanvas::autosaveFailed);
+}
+
+DiagramCanvas::~DiagramCanvas()
+{
+    if (m_routeCancel) {
+        *m_routeCancel = true;
+    }
+    m_routeWatcher.waitForFinished();
+    if (m_layoutCancel) {
+        *m_layoutCancel = true;
+    }
+    m_layoutWatcher.waitForFinished();
+    if (m_forceCancel) {
+        *m_forceCancel = true;
+    }
+    m_forceWatcher.waitForFinished();
+    abandonLoading();
+    m_loadWatcher.waitForFinished();
 }
 
 void DiagramCanvas::addShape(std::shared_ptr<DiagramShape> shape)
 {
     if (shape) {
-        m_shapes.append(shape);
-        m_modified = true;
-        update();
+        addShapes({ shape });
+    }
+}
+
+void DiagramCanvas::addShapes(const QList<std::shared_ptr<DiagramShape>>& shapes, const QSet<ShapeId>& pinned)
+{
+    // All are stored before any connector is anchored, so a connector
+    // finds ends that come later in the list
+    QList<std::shared_ptr<DiagramShape>> added;
+    for (const auto& shape : shapes) {
+        if (shape && !m_store.contains(shape.get())) {
+            m_store.append(shape, pinned.contains(shape->getId()) ? ShapeStore::Pinned : 0);
+            added.append(shape);
+        }
     }
+    if (added.isEmpty()) return;
+
+    // One undo step for the lot; each shape goes back above the one added
+    // before it
+    UndoJournal::Entry entry;
+    QVector<DiagramShape*> routed;
+    QRectF dirty;
+    for (const auto& shape : added) {
+        if (shape->getType() == DiagramShape::Connector) {
+            // Bound ends are clipped to their shapes before the first paint
+            anchorConnector(static_cast<ConnectorShape*>(shape.get()));
+            attachConnector(static_cast<ConnectorShape*>(shape.get()));
+            m_store.updateBounds(shape.get());
+        }
+        entry.inserted.append({ shape, m_store.idBelow(shape.get()), m_store.isPinned(shape.get()) });
+        routed.append(shape.get());
+        dirty |= shape->boundingRect();
+    }
+    m_modified = true;
+    invalidateArea(dirtyRect(dirty));
+    scheduleRoutes(routed, dirty);
+    record(std::move(entry));
 }
 
 void DiagramCanvas::clear()
 {
-    m_shapes.clear();
+    m_store.clear();
+    m_connections.clear();
+    m_routesPending.clear();
+    if (m_layoutCancel) {
+        *m_layoutCancel = true;
+    }
+    m_layoutWatermark = 0;
+    abandonForceLayout();
+    abandonLoading();
+    m_journal.clear();
+    emit undoStateChanged(false, false);
     m_selectedShape = nullptr;
     m_selectedShapes.clear();
     m_modified = false;
-    update();
+    invalidateAll();
     emit selectionChanged(false);
 }
 
 bool DiagramCanvas::exportToPng(const QString& filename)
 {
-    QPixmap pixmap(m_canvasSize);
-    pixmap.fill(m_backgroundColor);
+    // Blocks until done; MainWindow runs the same exporter in the
+    // background with progress
+    TiledImageExporter exporter(shapesInPaintOrder(), QRectF(QPointF(0, 0), QSizeF(m_canvasSize)),
+                                m_backgroundColor);
+    return exporter.exportToPng(filename);
+}
 
-    QPainter painter(&pixmap);
-    painter.setRenderHint(QPainter::Antialiasing);
+bool DiagramCanvas::exportToSvg(const QString& filename)
+{
+    SvgWriter writer(shapesInPaintOrder(), QRectF(QPointF(0, 0), QSizeF(m_canvasSize)), m_backgroundColor);
+    return writer.write(filename);
+}
 
-    for (auto& shape : m_shapes) {
-        shape->paint(&painter);
+void DiagramCanvas::setAllShapes(const QList<std::shared_ptr<DiagramShape>>& shapes, const QSet<ShapeId>& pinned)
+{
+    m_store.assign(shapes, pinned);
+    rebuildConnections();
+    // Saved routes are loaded as they are
+    m_routesPending.clear();
+    // A loaded document counts as laid out
+    if (m_layoutCancel) {
+        *m_layoutCancel = true;
     }
-
-    return pixmap.save(filename, "PNG");
+    m_layoutWatermark = 0;
+    for (ShapeId id : m_store.ids()) {
+        m_layoutWatermark = qMax(m_layoutWatermark, id);
+    }
+    abandonForceLayout();
+    abandonLoading();
+    m_journal.clear();
+    emit undoStateChanged(false, false);
+    m_selectedShape = nullptr;
+    m_selectedShapes.clear();
+    invalidateAll();
+    emit selectionChanged(false);
 }
 
-bool DiagramCanvas::exportToSvg(const QString& filename)
+void DiagramCanvas::loadDocument(const QString& filename)
 {
-    QSvgGenerator generator;
-    generator.setFileName(filename);
-    generator.setSize(m_canvasSize);
-    generator.setViewBox(QRect(0, 0, m_canvasSize.width(), m_canvasSize.height()));
-    generator.setTitle("Diagram");
-    generator.setDescription("Generated by DiagramEditor");
+    clear();
+    auto cancel = std::make_shared<std::atomic<bool>>(false);
+    auto batchSlots = std::make_shared<QSemaphore>(kQueuedBatches);
+    m_loadCancel = cancel;
+    m_loadSlots = batchSlots;
+    m_loadTotal = 0;
+    const QRectF priorityArea = mapToDocument(QRectF(rect()));
 
-    QPainter painter(&generator);
-    painter.setRenderHint(QPainter::Antialiasing);
+    // Both run on the worker and forward to the GUI thread; anything still
+    // queued from an abandoned load sees a different cancel flag
+    auto onOpened = [this, cancel](const FlowDocument& document, int shapeCount, ShapeId highestId) {
+        QMetaObject::invokeMethod(this, [this, cancel, document, shapeCount, highestId]() {
+            if (cancel != m_loadCancel) return;
+            setBackgroundColor(document.backgroundColor);
+            setCanvasSize(document.canvasSize);
+            // Shapes added meanwhile must not take the id of one still
+            // on its way, and do not count as laid out
+            m_store.reserveIds(highestId);
+            m_layoutWatermark = qMax(m_layoutWatermark, highestId);
+            m_loadTotal = shapeCount;
+            emit loadProgress(0, shapeCount);
+        }, Qt::QueuedConnection);
+    };
+    auto onBatch = [this, cancel, batchSlots](const FlowIO::Batch& batch) {
+        // Each queued batch holds a slot until the GUI thread takes it;
+        // cancelling releases enough for the worker to get out
+        batchSlots->acquire();
+        if (*cancel) return;
+        QMetaObject::invokeMethod(this, [this, cancel, batchSlots, batch]() {
+            batchSlots->release();
+            if (cancel == m_loadCancel) {
+                addLoadedShapes(batch);
+            }
+        }, Qt::QueuedConnection);
+    };
+    m_loadWatcher.setFuture(QtConcurrent::run([filename, priorityArea, onOpened, onBatch, cancel]() {
+        return FlowIO::loadInBatches(filename, priorityArea, onOpened, onBatch, cancel.get());
+    }));
+}
 
-    painter.fillRect(QRect(0, 0, m_canvasSize.width(), m_canvasSize.height()), m_backgroundColor);
+void DiagramCanvas::cancelLoading()
+{
+    if (m_loadCancel) {
+        clear();
+    }
+}
 
-    for (auto& shape : m_shapes) {
-        shape->paint(&painter);
+void DiagramCanvas::abandonLoading()
+{
+    if (m_loadCancel) {
+        *m_loadCancel = true;
+        m_loadSlots->release(kQueuedBatches);
+        m_loadCancel.reset();
+        m_loadSlots.reset();
     }
+}
 
-    return true;
+void DiagramCanvas::finishLoading()
+{
+    // The last batches were queued before the worker returned, so they
+    // are in by now
+    if (!m_loadCancel) return;
+    m_loadCancel.reset();
+    m_loadSlots.reset();
+    const bool ok = m_loadWatcher.result();
+    if (!ok) {
+        clear();
+    }
+    emit loadFinished(ok);
 }
 
-void DiagramCanvas::setAllShapes(const QList<std::shared_ptr<DiagramShape>>& shapes)
+void DiagramCanvas::addLoadedShapes(const FlowIO::Batch& batch)
 {
-    m_shapes = shapes;
-    m_selectedShape = nullptr;
-    m_selectedShapes.clear();
-    update();
-    emit selectionChanged(false);
+    // Saved routes are loaded as they are, and bound ends whose shape
+    // has not arrived yet are left where the file put them
+    QRectF dirty;
+    for (int i = 0; i < batch.shapes.size(); ++i) {
+        const auto& shape = batch.shapes[i];
+        m_store.insert(shape, batch.keys[i], batch.pinned[i] ? ShapeStore::Pinned : 0);
+        if (shape->getType() == DiagramShape::Connector) {
+            attachConnector(static_cast<ConnectorShape*>(shape.get()));
+        }
+        dirty |= shape->boundingRect();
+    }
+    invalidateArea(dirtyRect(dirty));
+    emit loadProgress(batch.loaded, m_loadTotal);
 }
 
 void DiagramCanvas::bringToFront()
 {
-    if (!m_selectedShape) return;
-    m_shapes.removeOne(m_selectedShape);
-    m_shapes.append(m_selectedShape);
-    m_modified = true;
-    update();
+    arrangeSelection(&ShapeStore::bringToFront);
 }
 
 void DiagramCanvas::sendToBack()
 {
-    if (!m_selectedShape) return;
-    m_shapes.removeOne(m_selectedShape);
-    m_shapes.prepend(m_selectedShape);
-    m_modified = true;
-    update();
+    arrangeSelection(&ShapeStore::sendToBack);
 }
 
 void DiagramCanvas::bringForward()
 {
-    if (!m_selectedShape) return;
-    int index = m_shapes.indexOf(m_selectedShape);
-    if (index < m_shapes.size() - 1) {
-        m_shapes.removeAt(index);
-        m_shapes.insert(index + 1, m_selectedShape);
-        m_modified = true;
-        update();
-    }
+    arrangeSelection(&ShapeStore::bringForward);
 }
 
 void DiagramCanvas::sendBackward()
 {
-    if (!m_selectedShape) return;
-    int index = m_shapes.indexOf(m_selectedShape);
-    if (index > 0) {
-        m_shapes.removeAt(index);
-        m_shapes.insert(index - 1, m_selectedShape);
-        m_modified = true;
-        update();
+    arrangeSelection(&ShapeStore::sendBackward);
+}
+
+void DiagramCanvas::layoutLayered(bool incremental)
+{
+    abandonForceLayout();
+    LayeredLayout::Request request;
+    request.incremental = incremental;
+    QHash<ShapeId, int> nodeIndex;
+    auto nodeOf = [&](ShapeId id) {
+        auto it = nodeIndex.constFind(id);
+        if (it != nodeIndex.constEnd()) return it.value();
+        LayeredLayout::Node node;
+        node.id = id;
+        node.bounds = m_store.find(id)->boundingRect();
+        node.placed = id <= m_layoutWatermark;
+        const int index = int(request.nodes.size());
+        request.nodes.append(node);
+        nodeIndex.insert(id, index);
+        return index;
+    };
+    for (const ConnectorShape* connector : layoutEdges()) {
+        LayeredLayout::Edge edge;
+        edge.connector = connector->getId();
+        edge.from = nodeOf(connector->getStartShape());
+        edge.to = nodeOf(connector->getEndShape());
+        request.edges.append(edge);
+    }
+    if (request.nodes.isEmpty()) return;
+
+    if (m_layoutWatcher.isRunning()) {
+        *m_layoutCancel = true;
+    }
+    auto cancel = std::make_shared<std::atomic<bool>>(false);
+    m_layoutCancel = cancel;
+    m_layoutWatcher.setFuture(QtConcurrent::run([request, cancel]() {
+        return LayeredLayout::layout(request, cancel.get());
+    }));
+}
+
+void DiagramCanvas::startForceLayout()
+{
+    abandonForceLayout();
+
+    ForceLayout::Request request;
+    QHash<ShapeId, int> nodeIndex;
+    QRectF dirty;
+    QVector<UndoJournal::RouteChange> routes;
+    auto nodeOf = [&](ShapeId id) {
+        auto it = nodeIndex.constFind(id);
+        if (it != nodeIndex.constEnd()) return it.value();
+        const DiagramShape* shape = m_store.find(id);
+        ForceLayout::Node node;
+        node.id = id;
+        node.bounds = shape->boundingRect();
+        node.pinned = m_store.isPinned(shape);
+        const int index = int(request.nodes.size());
+        request.nodes.append(node);
+        nodeIndex.insert(id, index);
+        return index;
+    };
+    for (ConnectorShape* connector : layoutEdges()) {
+        ForceLayout::Edge edge;
+        edge.from = nodeOf(connector->getStartShape());
+        edge.to = nodeOf(connector->getEndShape());
+        request.edges.append(edge);
+        // Bends would point the wrong way once the ends start moving
+        if (connector->getRoutingStyle() == ConnectorShape::Direct && !connector->getControlPoints().isEmpty()) {
+            const QPolygonF before = routeOf(connector);
+            dirty |= connector->boundingRect();
+            connector->clearControlPoints();
+            anchorConnector(connector);
+            m_store.updateBounds(connector);
+            dirty |= connector->boundingRect();
+            routes.append({ connector->getId(), before, routeOf(connector) });
+        }
+    }
+    // The whole run, frames included, becomes one step
+    m_journal.seal();
+    UndoJournal::Entry entry;
+    entry.coalescing = UndoJournal::Layout;
+    entry.routes = routes;
+    record(std::move(entry));
+    invalidateArea(dirtyRect(dirty));
+    if (request.nodes.isEmpty()) {
+        emit forceLayoutFinished();
+        return;
+    }
+
+    m_forceNodes.clear();
+    for (const ForceLayout::Node& node : request.nodes) {
+        m_forceNodes.append(node.id);
+    }
+
+    // Frames travel to the GUI thread through the event loop; the pending
+    // flag holds the worker back until the last one has been shown
+    auto cancel = std::make_shared<std::atomic<bool>>(false);
+    auto pending = std::make_shared<std::atomic<bool>>(false);
+    m_forceCancel = cancel;
+    auto onFrame = [this, cancel, pending](const QVector<QPointF>& positions) {
+        QMetaObject::invokeMethod(this, [this, cancel, pending, positions]() {
+            *pending = false;
+            if (cancel == m_forceCancel) {
+                applyForceFrame(positions);
+            }
+        }, Qt::QueuedConnection);
+    };
+    m_forceWatcher.setFuture(QtConcurrent::run([request, onFrame, pending, cancel]() {
+        return ForceLayout::layout(request, onFrame, pending.get(), cancel.get());
+    }));
+}
+
+void DiagramCanvas::stopForceLayout()
+{
+    // The worker returns where it got to, which finishForceLayout() applies
+    if (m_forceCancel) {
+        *m_forceCancel = true;
     }
 }
 
+void DiagramCanvas::abandonForceLayout()
+{
+    // Nothing of the running layout is applied any more; frames already
+    // queued see a different cancel flag and are dropped
+    if (m_forceCancel) {
+        *m_forceCancel = true;
+        m_forceCancel.reset();
+    }
+    m_forceNodes.clear();
+}
+
 void DiagramCanvas::chooseBackgroundColor()
 {
     QColor color = QColorDialog::getColor(m_backgroundColor, this, tr("选择背景颜色"));
     if (color.isValid()) {
         m_backgroundColor = color;
         m_modified = true;
-        update();
+        m_autosave.recordPage(m_backgroundColor, m_canvasSize);
+        invalidateAll();
     }
 }
 
 void DiagramCanvas::setCanvasSize()
 {
     bool ok;
-    int width = QInputDialog::getInt(this, tr("设置宽度"), tr("宽度 (像素):"), m_canvasSize.width(), 200, 5000, 10, &ok);
+    int width = QInputDialog::getInt(this, tr("设置宽度"), tr("宽度 (像素):"), m_canvasSize.width(), 200, 100000, 10, &ok);
     if (!ok) return;
-    int height = QInputDialog::getInt(this, tr("设置高度"), tr("高度 (像素):"), m_canvasSize.height(), 200, 5000, 10, &ok);
+    int height = QInputDialog::getInt(this, tr("设置高度"), tr("高度 (像素):"), m_canvasSize.height(), 200, 100000, 10, &ok);
     if (!ok) return;
     m_canvasSize = QSize(width, height);
-    resize(m_canvasSize);
     m_modified = true;
+    m_autosave.recordPage(m_backgroundColor, m_canvasSize);
     update();
 }
 
 void DiagramCanvas::copySelectedToClipboard()
 {
-    if (!m_selectedShape) return;
-
-    QByteArray itemData;
-    QDataStream dataStream(&itemData, QIODevice::WriteOnly);
-
-    m_selectedShape->save(dataStream);
+    const QVector<DiagramShape*> shapes = selectionInPaintOrder();
+    if (shapes.isEmpty()) return;
 
     QMimeData* mimeData = new QMimeData;
-    mimeData->setData("application/x-flowchart-shape", itemData);
+    mimeData->setData("application/x-flowchart-shapes", encodeShapes(shapes));
 
     QApplication::clipboard()->setMimeData(mimeData);
 }
 
 void DiagramCanvas::cutSelectedToClipboard()
 {
-    if (!m_selectedShape) return;
+    if (selectionInPaintOrder().isEmpty()) return;
 
     copySelectedToClipboard();
     deleteSelected();
@@ -188,8 +487,18 @@ void DiagramCanvas::cutSelectedToClipboard()
 void DiagramCanvas::pasteFromClipboard()
 {
     const QMimeData* mimeData = QApplication::clipboard()->mimeData();
+    if (!mimeData) return;
 
-    if (mimeData->hasFormat("application/x-flowchart-shape")) {
+    QList<std::shared_ptr<DiagramShape>> shapes;
+    QSet<ShapeId> pinned;
+    if (mimeData->hasFormat("application/x-flowchart-shapes")) {
+        FlowDocument document;
+        if (!FlowFormat::decode(mimeData->data("application/x-flowchart-shapes"), document)) return;
+        shapes = document.shapes;
+        pinned = document.pinned;
+    }
+    else if (mimeData->hasFormat("application/x-flowchart-shape")) {
+        // A single shape, as earlier versions copied it
         QByteArray itemData = mimeData->data("application/x-flowchart-shape");
         QDataStream dataStream(&itemData, QIODevice::ReadOnly);
 
@@ -200,46 +509,137 @@ void DiagramCanvas::pasteFromClipboard()
         if (newShape) {
             dataStream.device()->seek(0);
             newShape->load(dataStream);
-            newShape->moveBy(QPointF(20, 20));
-            addShape(newShape);
-            m_selectedShape = newShape;
-            updateSelectionState();
-            m_modified = true;
+            shapes.append(newShape);
         }
     }
+    pasteShapes(shapes, pinned);
 }
 
 void DiagramCanvas::duplicateSelected()
 {
-    if (!m_selectedShape) return;
+    const QVector<DiagramShape*> shapes = selectionInPaintOrder();
+    if (shapes.isEmpty()) return;
 
-    QByteArray itemData;
-    QDataStream dataStream(&itemData, QIODevice::WriteOnly);
+    FlowDocument document;
+    if (FlowFormat::decode(encodeShapes(shapes), document)) {
+        pasteShapes(document.shapes, document.pinned);
+    }
+}
 
-    m_selectedShape->save(dataStream);
+void DiagramCanvas::deleteSelected()
+{
+    const QVector<DiagramShape*> shapes = selectionInPaintOrder();
+    if (shapes.isEmpty()) return;
 
-    int type = (int)m_selectedShape->getType();
-    auto newShape = DiagramShape::createShape((DiagramShape::Type)type);
+    QSet<ShapeId> removedIds;
+    QRectF dirty;
+    for (DiagramShape* shape : shapes) {
+        removedIds.insert(shape->getId());
+        dirty |= shape->boundingRect();
+    }
 
-    if (newShape) {
-        dataStream.device()->seek(0);
-        newShape->load(dataStream);
-        newShape->moveBy(QPointF(20, 20));
-        addShape(newShape);
-        m_selectedShape = newShape;
-        updateSelectionState();
-        m_modified = true;
+    UndoJournal::Entry entry;
+    for (DiagramShape* shape : shapes) {
+        if (shape->getType() == DiagramShape::Connector) continue;
+        // Connectors that stay keep their place, with that end set free
+        const ShapeId id = shape->getId();
+        for (ShapeId connectorId : m_connections.connectorsOf(id)) {
+            if (removedIds.contains(connectorId)) continue;
+            auto* connector = static_cast<ConnectorShape*>(m_store.find(connectorId));
+            if (!connector) continue;
+            if (connector->getStartShape() == id) {
+                entry.properties.append({ connectorId, UndoJournal::StartBinding,
+                                          bindingValue(id, connector->getStartPort()), bindingValue(0, DiagramShape::AutoPort) });
+                connector->setStartBinding(0);
+            }
+            if (connector->getEndShape() == id) {
+                entry.properties.append({ connectorId, UndoJournal::EndBinding,
+                                          bindingValue(id, connector->getEndPort()), bindingValue(0, DiagramShape::AutoPort) });
+                connector->setEndBinding(0);
+            }
+            attachConnector(connector);
+        }
+    }
+
+    // Neighbours are taken before any shape goes, bottom first, so undo
+    // puts each one back above the shape that was below it
+    for (DiagramShape* shape : shapes) {
+        entry.removed.append({ m_store.shared(shape), m_store.idBelow(shape), m_store.isPinned(shape) });
+    }
+    for (DiagramShape* shape : shapes) {
+        dropShape(shape);
+    }
+    record(std::move(entry));
+    updateSelectionState();
+    m_modified = true;
+    invalidateArea(dirtyRect(dirty));
+}
+
+QVector<DiagramShape*> DiagramCanvas::selectionInPaintOrder() const
+{
+    QVector<DiagramShape*> shapes;
+    shapes.reserve(m_selectedShapes.size() + 1);
+    for (auto& shape : m_selectedShapes) {
+        shapes.append(shape.get());
+    }
+    if (m_selectedShape) {
+        shapes.append(m_selectedShape.get());
     }
+    return m_store.inPaintOrder(shapes);
 }
 
-void DiagramCanvas::deleteSelected()
+QByteArray DiagramCanvas::encodeShapes(const QVector<DiagramShape*>& shapes) const
 {
-    if (!m_selectedShape) return;
-    m_shapes.removeOne(m_selectedShape);
-    m_selectedShape = nullptr;
+    // A small document: it carries the ids, so connectors copied along
+    // with the shapes they are bound to can stay bound to the copies
+    FlowDocument document;
+    for (DiagramShape* shape : shapes) {
+        document.shapes.append(m_store.shared(shape));
+        if (m_store.isPinned(shape)) {
+            document.pinned.insert(shape->getId());
+        }
+    }
+    return FlowFormat::encode(document, false);
+}
+
+void DiagramCanvas::pasteShapes(const QList<std::shared_ptr<DiagramShape>>& shapes, const QSet<ShapeId>& pinned)
+{
+    if (shapes.isEmpty()) return;
+
+    // The copies get ids of their own. Connector ends bound to a shape that
+    // came along follow it to its copy; the others are set free, since
+    // the shape may not exist in this document.
+    QHash<ShapeId, ShapeId> copies;
+    QSet<ShapeId> pinnedCopies;
+    for (const auto& shape : shapes) {
+        const ShapeId id = m_store.newId();
+        if (shape->getId() != 0) {
+            copies.insert(shape->getId(), id);
+            if (pinned.contains(shape->getId())) {
+                pinnedCopies.insert(id);
+            }
+        }
+        shape->setId(id);
+    }
+    for (const auto& shape : shapes) {
+        if (shape->getType() == DiagramShape::Connector) {
+            auto* connector = static_cast<ConnectorShape*>(shape.get());
+            const ShapeId start = copies.value(connector->getStartShape(), 0);
+            const ShapeId end = copies.value(connector->getEndShape(), 0);
+            connector->setStartBinding(start, start ? connector->getStartPort() : DiagramShape::AutoPort);
+            connector->setEndBinding(end, end ? connector->getEndPort() : DiagramShape::AutoPort);
+        }
+        shape->moveBy(QPointF(20, 20));
+    }
+
+    clearSelectionFlags();
+    for (const auto& shape : shapes) {
+        shape->setSelected(true);
+        m_selectedShapes.append(shape);
+    }
+    m_selectedShape = shapes.last();
+    addShapes(shapes, pinnedCopies);
     updateSelectionState();
-    m_modified = true;
-    update();
 }
 
 void DiagramCanvas::setActiveShapeTool(int type)
@@ -248,44 +648,103 @@ void DiagramCanvas::setActiveShapeTool(int type)
     setCursor(m_activeShapeTool == DiagramShape::None ? Qt::ArrowCursor : Qt::CrossCursor);
 }
 
-void DiagramCanvas::paintEvent(QPaintEvent* /*event*/)
+void DiagramCanvas::paintEvent(QPaintEvent* event)
 {
     QPainter painter(this);
-    painter.setRenderHint(QPainter::Antialiasing);
-    painter.fillRect(rect(), m_backgroundColor);
-    for (auto& shape : m_shapes) {
-        shape->paint(&painter);
+
+    if (!m_dragBackdrop.isNull()) {
+        // Drag mode: blit the static backbuffer, then the moving shapes
+        if (m_dragBackdrop.size() != size() * m_dragBackdrop.devicePixelRatio()) {
+            beginDragLayer();
+        }
+        painter.drawImage(QPoint(0, 0), m_dragBackdrop);
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.setTransform(viewTransform());
+        const QRectF exposed = mapToDocument(QRectF(event->rect())).adjusted(-12, -12, 12, 12);
+        QVector<DiagramShape*> exposedShapes;
+        for (DiagramShape* shape : m_dragShapes) {
+            if (shape->boundingRect().intersects(exposed)) {
+                exposedShapes.append(shape);
+            }
+        }
+        RenderList::paintShapes(&painter, exposedShapes);
+    }
+    else {
+        // Shapes are blitted from cached tiles; only tiles that were
+        // invalidated (or evicted) since the last paint get rendered again.
+        // Tiles live in zoomed document pixels, so panning only shifts them.
+        m_tileCache.setDevicePixelRatio(devicePixelRatioF());
+        const QRect tiles = TileCache::tilesCovering(event->rect().translated(m_scroll));
+        for (int ty = tiles.top(); ty <= tiles.bottom(); ++ty) {
+            for (int tx = tiles.left(); tx <= tiles.right(); ++tx) {
+                const QPoint tile(tx, ty);
+                const QPoint origin = TileCache::tileRect(tile).topLeft() - m_scroll;
+                if (const QImage* cached = m_tileCache.find(tile)) {
+                    painter.drawImage(origin, *cached);
+                }
+                else {
+                    QImage image = renderTile(tile);
+                    painter.drawImage(origin, image);
+                    m_tileCache.insert(tile, image);
+                }
+            }
+        }
     }
+
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setTransform(viewTransform());
     if (m_isConnecting && m_startConnectShape) {
-        painter.setPen(QPen(Qt::darkGray, 1, Qt::DashLine));
+        QPen pen(Qt::darkGray, 1, Qt::DashLine);
+        pen.setCosmetic(true);
+        painter.setPen(pen);
         painter.drawLine(m_connectStartPoint, m_lastMousePos);
     }
+    if (m_isMarqueeSelecting) {
+        // Solid box selects contained shapes, dashed box touched ones
+        const bool intersecting = m_lastMousePos.x() < m_marqueeOrigin.x();
+        QPen pen(QColor(0, 120, 215), 1, intersecting ? Qt::DashLine : Qt::SolidLine);
+        pen.setCosmetic(true);
+        painter.setPen(pen);
+        painter.setBrush(QColor(0, 120, 215, 40));
+        painter.drawRect(QRectF(m_marqueeOrigin, m_lastMousePos).normalized());
+    }
 }
 
 void DiagramCanvas::mousePressEvent(QMouseEvent* event)
 {
-    m_lastMousePos = event->pos();
+    const QPointF pos = mapToDocument(event->pos());
+    m_lastMousePos = pos;
+    // Every gesture is a step of its own
+    m_journal.seal();
+
+    if (event->button() == Qt::MiddleButton) {
+        m_isPanning = true;
+        m_panLastPos = event->pos();
+        setCursor(Qt::ClosedHandCursor);
+        return;
+    }
 
     if (m_activeShapeTool != DiagramShape::None) {
         if (event->button() == Qt::LeftButton) {
-            createNewShape(m_activeShapeTool, event->pos());
+            m_holdingCreation = true;
+            createNewShape(m_activeShapeTool, pos);
             m_isCreating = true;
         }
     }
     else {
         if (event->button() == Qt::LeftButton) {
-            auto shape = findShapeAt(event->pos());
+            auto shape = findShapeAt(pos);
 
             if (shape) {
-                if (!(event->modifiers() & Qt::ControlModifier)) {
-                    for (auto& s : m_selectedShapes) {
-                        s->setSelected(false);
-                    }
-                    m_selectedShapes.clear();
+                // Clicking a shape that is already selected keeps the rest of
+                // the selection, so a marquee-selected group can be dragged
+                if (!(event->modifiers() & Qt::ControlModifier) && !shape->getSelected()) {
+                    clearSelectionFlags();
                 }
 
                 m_selectedShape = shape;
                 m_selectedShape->setSelected(true);
+                invalidateArea(dirtyRect(shape->boundingRect()));
 
                 if (!m_selectedShapes.contains(m_selectedShape)) {
                     m_selectedShapes.append(m_selectedShape);
@@ -296,22 +755,21 @@ void DiagramCanvas::mousePressEvent(QMouseEvent* event)
                 if (event->modifiers() & Qt::ShiftModifier) {
                     m_isConnecting = true;
                     m_startConnectShape = shape;
-                    m_connectStartPoint = event->pos();
+                    m_connectStartPoint = pos;
                 }
                 else {
                     m_isDragging = true;
                 }
-
-                update();
             }
             else {
-                for (auto& s : m_selectedShapes) {
-                    s->setSelected(false);
+                // Empty space starts a marquee; Ctrl adds to the selection
+                if (!(event->modifiers() & Qt::ControlModifier)) {
+                    clearSelectionFlags();
+                    m_selectedShape = nullptr;
+                    updateSelectionState();
                 }
-                m_selectedShape = nullptr;
-                m_selectedShapes.clear();
-                updateSelectionState();
-                update();
+                m_isMarqueeSelecting = true;
+                m_marqueeOrigin = pos;
             }
         }
     }
@@ -319,71 +777,142 @@ void DiagramCanvas::mousePressEvent(QMouseEvent* event)
 
 void DiagramCanvas::mouseMoveEvent(QMouseEvent* event)
 {
-    QPointF delta = event->pos() - m_lastMousePos;
+    if (m_isPanning) {
+        scrollViewBy(m_panLastPos - event->pos());
+        m_panLastPos = event->pos();
+        return;
+    }
+
+    const QPointF pos = mapToDocument(event->pos());
+    QPointF delta = pos - m_lastMousePos;
 
     if (m_isCreating && m_selectedShape) {
         QSizeF newSize(
-            qAbs(event->pos().x() - m_selectedShape->getPos().x()),
-            qAbs(event->pos().y() - m_selectedShape->getPos().y())
+            qAbs(pos.x() - m_selectedShape->getPos().x()),
+            qAbs(pos.y() - m_selectedShape->getPos().y())
         );
         m_selectedShape->setSize(newSize);
+        invalidateShape(m_selectedShape);
         m_modified = true;
-        update();
     }
     else if (m_isDragging && m_selectedShape) {
+        if (m_dragBackdrop.isNull()) {
+            beginDragLayer();
+        }
+
+        // One combined dirty rect for the whole selection keeps the update
+        // region simple even when many shapes move together. Tiles are left
+        // alone until the drag ends; the backbuffer covers the static part.
+        QRectF dirty;
+        QVector<DiagramShape*> moved;
+        moved.reserve(m_selectedShapes.size());
+        UndoJournal::Entry entry;
+        entry.coalescing = UndoJournal::Drag;
+        entry.delta = delta;
+        entry.moved.reserve(m_selectedShapes.size());
         for (auto& shape : m_selectedShapes) {
+            dirty |= shape->boundingRect();
             shape->moveBy(delta);
+            reindexShape(shape);
+            dirty |= shape->boundingRect();
+            moved.append(shape.get());
+            entry.moved.append(shape->getId());
         }
+        // Merges with the previous mouse moves into one step
+        record(std::move(entry));
+        dirty |= reanchorConnectors(moved);
+        // Only the selection's own routes follow during the drag; routes
+        // the selection passed over are redone when it is dropped
+        scheduleRoutes(moved);
+        m_dragBounds |= dirty;
         m_modified = true;
-        update();
+        update(dirtyRect(dirty));
     }
     else if (m_isConnecting) {
-        m_lastMousePos = event->pos();
-        update();
+        update(connectPreviewRect());
+        m_lastMousePos = pos;
+        update(connectPreviewRect());
+    }
+    else if (m_isMarqueeSelecting) {
+        // Only the overlay is repainted while dragging; the selection is
+        // applied once on release
+        update(marqueePreviewRect());
+        m_lastMousePos = pos;
+        update(marqueePreviewRect());
     }
 
-    m_lastMousePos = event->pos();
+    m_lastMousePos = pos;
 }
 
 void DiagramCanvas::mouseReleaseEvent(QMouseEvent* event)
 {
+    if (m_isPanning) {
+        if (event->button() == Qt::MiddleButton) {
+            m_isPanning = false;
+            setActiveShapeTool(m_activeShapeTool);
+        }
+        return;
+    }
+
+    const QPointF pos = mapToDocument(event->pos());
+    m_journal.seal();
+
     if (m_isCreating) {
         m_isCreating = false;
+        releaseCreation();
         if (m_selectedShape) {
             emit shapeSelected(m_selectedShape);
         }
     }
     else if (m_isDragging) {
         m_isDragging = false;
+        scheduleRoutes({}, m_dragBounds);
+        endDragLayer();
     }
     else if (m_isConnecting) {
-        auto endShape = findShapeAt(event->pos());
+        auto endShape = findShapeAt(pos);
         if (endShape && endShape != m_startConnectShape) {
-            auto connector = std::make_shared<ConnectorShape>();
+            auto connector = ShapeStore::allocate<ConnectorShape>();
             connector->setStartPoint(m_connectStartPoint);
-            connector->setEndPoint(event->pos());
+            connector->setEndPoint(pos);
+            // The ends stay attached to the two shapes from now on;
+            // connectors themselves cannot be attached to
+            if (m_startConnectShape->getType() != DiagramShape::Connector) {
+                connector->setStartBinding(m_startConnectShape->getId());
+            }
+            if (endShape->getType() != DiagramShape::Connector) {
+                connector->setEndBinding(endShape->getId());
+            }
             addShape(connector);
             m_selectedShape = connector;
             updateSelectionState();
         }
+        update(connectPreviewRect());
         m_isConnecting = false;
         m_startConnectShape = nullptr;
-        update();
+    }
+    else if (m_isMarqueeSelecting) {
+        update(marqueePreviewRect());
+        m_isMarqueeSelecting = false;
+        selectInMarquee(QRectF(m_marqueeOrigin, pos).normalized(), pos.x() < m_marqueeOrigin.x());
     }
 }
 
 void DiagramCanvas::mouseDoubleClickEvent(QMouseEvent* event)
 {
-    auto shape = findShapeAt(event->pos());
+    auto shape = findShapeAt(mapToDocument(event->pos()));
     if (shape) {
         bool ok;
         QString text = QInputDialog::getText(this, tr("编辑文本"),
             tr("文本:"), QLineEdit::Normal,
             shape->getText(), &ok);
         if (ok) {
+            UndoJournal::Entry entry;
+            entry.properties.append({ shape->getId(), UndoJournal::Text, shape->getText(), text });
             shape->setText(text);
+            invalidateShape(shape);
             m_modified = true;
-            update();
+            record(std::move(entry));
         }
     }
 }
@@ -395,10 +924,21 @@ void DiagramCanvas::keyPressEvent(QKeyEvent* event)
         deleteSelected();
         break;
     case Qt::Key_Escape:
-        if (m_isCreating || m_isDragging || m_isConnecting) {
+        if (m_isCreating || m_isDragging || m_isConnecting || m_isMarqueeSelecting) {
+            if (m_isCreating) {
+                releaseCreation();
+            }
+            // The shapes stay where the drag left them, so their connectors
+            // are routed as on release
+            if (m_isDragging) {
+                scheduleRoutes({}, m_dragBounds);
+            }
+            m_journal.seal();
             m_isCreating = false;
             m_isDragging = false;
             m_isConnecting = false;
+            m_isMarqueeSelecting = false;
+            endDragLayer();
             update();
         }
         break;
@@ -429,12 +969,12 @@ void DiagramCanvas::contextMenuEvent(QContextMenuEvent* event)
 {
     QMenu menu(this);
 
-    auto shape = findShapeAt(event->pos());
+    auto shape = findShapeAt(mapToDocument(event->pos()));
     if (shape) {
         m_selectedShape = shape;
         shape->setSelected(true);
         updateSelectionState();
-        update();
+        invalidateArea(dirtyRect(shape->boundingRect()));
 
         QAction* copyAction = menu.addAction(tr("复制"));
         QAction* cutAction = menu.addAction(tr("剪切"));
@@ -449,6 +989,26 @@ void DiagramCanvas::contextMenuEvent(QContextMenuEvent* event)
         connect(deleteAction, &QAction::triggered, this, &DiagramCanvas::deleteSelected);
         connect(bringToFrontAction, &QAction::triggered, this, &DiagramCanvas::bringToFront);
         connect(sendToBackAction, &QAction::triggered, this, &DiagramCanvas::sendToBack);
+
+        if (shape->getType() != DiagramShape::Connector) {
+            // Applies to every selected shape
+            menu.addSeparator();
+            QAction* pinAction = menu.addAction(tr("固定位置"));
+            pinAction->setCheckable(true);
+            pinAction->setChecked(m_store.isPinned(shape.get()));
+            connect(pinAction, &QAction::toggled, this, &DiagramCanvas::setSelectedPinned);
+        }
+        else {
+            // Applies to every selected connector
+            menu.addSeparator();
+            QAction* orthogonalAction = menu.addAction(tr("正交布线"));
+            orthogonalAction->setCheckable(true);
+            orthogonalAction->setChecked(static_cast<ConnectorShape*>(shape.get())->getRoutingStyle()
+                                         == ConnectorShape::Orthogonal);
+            connect(orthogonalAction, &QAction::toggled, this, [this](bool checked) {
+                setSelectedRoutingStyle(checked ? ConnectorShape::Orthogonal : ConnectorShape::Direct);
+            });
+        }
     }
     else {
         QAction* pasteAction = menu.addAction(tr("粘贴"));
@@ -460,12 +1020,33 @@ void DiagramCanvas::contextMenuEvent(QContextMenuEvent* event)
 
 std::shared_ptr<DiagramShape> DiagramCanvas::findShapeAt(const QPointF& pos)
 {
-    for (int i = m_shapes.size() - 1; i >= 0; --i) {
-        if (m_shapes[i]->contains(pos)) {
-            return m_shapes[i];
+    // Only shapes whose bounds cover the point are tested; the topmost hit
+    // wins, so skip the contains() call for anything below the current best.
+    // Connectors are tested together afterwards, in one batched call over
+    // their segments.
+    DiagramShape* topmost = nullptr;
+    QVector<DiagramShape*> connectors;
+    QVector<const SegmentBuffer*> segments;
+    for (DiagramShape* candidate : m_store.query(pos)) {
+        if (topmost && m_store.zOf(candidate) < m_store.zOf(topmost)) continue;
+        if (candidate->getType() == DiagramShape::Connector) {
+            connectors.append(candidate);
+            segments.append(&static_cast<ConnectorShape*>(candidate)->hitSegments());
+        }
+        else if (candidate->contains(pos)) {
+            topmost = candidate;
+        }
+    }
+    if (!connectors.isEmpty()) {
+        QVector<bool> hits;
+        SegmentBuffer::anyWithin(segments, pos, ConnectorShape::kHitTolerance, hits);
+        for (int i = 0; i < connectors.size(); ++i) {
+            if (hits[i] && (!topmost || m_store.zOf(connectors[i]) > m_store.zOf(topmost))) {
+                topmost = connectors[i];
+            }
         }
     }
-    return nullptr;
+    return m_store.shared(topmost);
 }
 
 void DiagramCanvas::createNewShape(DiagramShape::Type type, const QPointF& pos)
@@ -477,6 +1058,7 @@ void DiagramCanvas::createNewShape(DiagramShape::Type type, const QPointF& pos)
 
         m_selectedShape = shape;
         shape->setSelected(true);
+        invalidateArea(dirtyRect(shape->boundingRect()));
         updateSelectionState();
         m_modified = true;
     }
@@ -488,6 +1070,1034 @@ void DiagramCanvas::updateSelectionState()
     emit selectionChanged(m_selectedShape != nullptr);
 }
 
-void DiagramCanvas::refreshCanvas() {
+void DiagramCanvas::reindexShape(const std::shared_ptr<DiagramShape>& shape)
+{
+    // Shapes that were removed from the canvas must not sneak back in
+    if (shape) {
+        m_store.updateBounds(shape.get());
+    }
+}
+
+void DiagramCanvas::invalidateShape(const std::shared_ptr<DiagramShape>& shape)
+{
+    if (!shape) return;
+    // The store still holds the bounds from before the change, so both the
+    // old and the new footprint get repainted
+    QRectF oldRect = m_store.boundsOf(shape.get());
+    reindexShape(shape);
+    QRectF dirty = oldRect | shape->boundingRect();
+    if (m_store.contains(shape.get())) {
+        dirty |= reanchorConnectors({ shape.get() });
+        if (shape->getType() != DiagramShape::Connector) {
+            scheduleRoutes({ shape.get() }, oldRect | shape->boundingRect());
+        }
+    }
+    invalidateArea(dirtyRect(dirty));
+}
+
+void DiagramCanvas::invalidateArea(const QRect& area)
+{
+    m_tileCache.invalidate(area.translated(m_scroll));
+    update(area);
+}
+
+void DiagramCanvas::invalidateAll()
+{
+    m_tileCache.clear();
     update();
-}
\ No newline at end of file
+}
+
+QImage DiagramCanvas::renderTile(const QPoint& tile) const
+{
+    // Only shapes reaching into this tile are drawn; painting outside the
+    // image is clipped by QPainter. Tile coordinates are zoomed document
+    // pixels, independent of the scroll offset.
+    const QRect area = TileCache::tileRect(tile);
+    QImage image = m_tileCache.createTileImage();
+    image.fill(m_backgroundColor);
+
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.translate(-area.topLeft());
+    painter.scale(m_zoom, m_zoom);
+    const QRectF docArea(QPointF(area.topLeft()) / m_zoom, QSizeF(area.size()) / m_zoom);
+    RenderList::paintShapes(&painter, shapesIn(docArea));
+    return image;
+}
+
+void DiagramCanvas::beginDragLayer()
+{
+    // Snapshot of the visible area without the dragged shapes. The dragged
+    // shapes are painted above it, so while dragging they appear on top of
+    // everything; their real stacking shows again when the drag ends.
+    // Connectors attached to the selection move with it, so they are
+    // painted per frame as well
+    QSet<DiagramShape*> dragged;
+    m_dragShapes.clear();
+    for (auto& shape : m_selectedShapes) {
+        if (!dragged.contains(shape.get())) {
+            dragged.insert(shape.get());
+            m_dragShapes.append(shape.get());
+        }
+        for (ShapeId connectorId : m_connections.connectorsOf(shape->getId())) {
+            DiagramShape* connector = m_store.find(connectorId);
+            if (connector && !dragged.contains(connector)) {
+                dragged.insert(connector);
+                m_dragShapes.append(connector);
+            }
+        }
+    }
+    m_dragShapes = m_store.inPaintOrder(m_dragShapes);
+
+    const qreal ratio = devicePixelRatioF();
+    m_dragBackdrop = QImage(size() * ratio, QImage::Format_ARGB32_Premultiplied);
+    m_dragBackdrop.setDevicePixelRatio(ratio);
+    m_dragBackdrop.fill(m_backgroundColor);
+
+    QVector<DiagramShape*> shapes = shapesIn(mapToDocument(QRectF(rect())));
+    shapes.erase(std::remove_if(shapes.begin(), shapes.end(), [&dragged](DiagramShape* shape) {
+        return dragged.contains(shape);
+    }), shapes.end());
+
+    QPainter painter(&m_dragBackdrop);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setTransform(viewTransform());
+    RenderList::paintShapes(&painter, shapes);
+}
+
+void DiagramCanvas::endDragLayer()
+{
+    if (m_dragBackdrop.isNull()) return;
+    m_dragBackdrop = QImage();
+    m_dragShapes.clear();
+
+    // Tiles still show the selection where the drag started
+    invalidateArea(dirtyRect(m_dragBounds));
+    m_dragBounds = QRectF();
+}
+
+void DiagramCanvas::clearSelectionFlags()
+{
+    QRectF dirty;
+    for (auto& s : m_selectedShapes) {
+        s->setSelected(false);
+        dirty |= s->boundingRect();
+    }
+    if (m_selectedShape) {
+        m_selectedShape->setSelected(false);
+        dirty |= m_selectedShape->boundingRect();
+    }
+    m_selectedShapes.clear();
+    invalidateArea(dirtyRect(dirty));
+}
+
+QRect DiagramCanvas::dirtyRect(const QRectF& rect) const
+{
+    if (rect.isNull()) return QRect();
+    // Covers pens up to the maximum line width, selection handles that
+    // straddle the outline and antialiasing fringe
+    const qreal margin = 12.0;
+    QRectF viewRect = mapFromDocument(rect.adjusted(-margin, -margin, margin, margin));
+    return viewRect.toAlignedRect().adjusted(-2, -2, 2, 2);
+}
+
+QRect DiagramCanvas::connectPreviewRect() const
+{
+    QRectF viewRect = mapFromDocument(QRectF(m_connectStartPoint, m_lastMousePos).normalized());
+    return viewRect.toAlignedRect().adjusted(-2, -2, 2, 2);
+}
+
+QRect DiagramCanvas::marqueePreviewRect() const
+{
+    QRectF viewRect = mapFromDocument(QRectF(m_marqueeOrigin, m_lastMousePos).normalized());
+    return viewRect.toAlignedRect().adjusted(-2, -2, 2, 2);
+}
+
+void DiagramCanvas::selectInMarquee(const QRectF& rect, bool intersecting)
+{
+    // Dragging to the right selects the shapes fully inside the box,
+    // dragging to the left also the ones it touches (the CAD convention).
+    // Either way the grid index supplies the candidates.
+    if (rect.isEmpty()) return;
+
+    QVector<DiagramShape*> hits;
+    if (intersecting) {
+        hits = m_store.query(rect);
+        hits.erase(std::remove_if(hits.begin(), hits.end(), [&rect](DiagramShape* shape) {
+            return !shape->intersects(rect);
+        }), hits.end());
+    }
+    else {
+        hits = m_store.queryContained(rect);
+    }
+    if (hits.isEmpty()) return;
+
+    // With Ctrl the previous selection is kept; a set keeps adding
+    // thousands of shapes linear
+    QSet<DiagramShape*> selected;
+    selected.reserve(m_selectedShapes.size());
+    for (auto& shape : m_selectedShapes) {
+        selected.insert(shape.get());
+    }
+    m_selectedShapes.reserve(m_selectedShapes.size() + hits.size());
+
+    QRectF dirty;
+    DiagramShape* topmost = nullptr;
+    for (DiagramShape* shape : hits) {
+        if (!topmost || m_store.zOf(shape) > m_store.zOf(topmost)) {
+            topmost = shape;
+        }
+        if (selected.contains(shape)) continue;
+        shape->setSelected(true);
+        m_selectedShapes.append(m_store.shared(shape));
+        dirty |= shape->boundingRect();
+    }
+
+    // The topmost hit is the one the property panel shows
+    m_selectedShape = m_store.shared(topmost);
+    invalidateArea(dirtyRect(dirty));
+    updateSelectionState();
+}
+
+QVector<DiagramShape*> DiagramCanvas::shapesIn(const QRectF& docArea) const
+{
+    // Shapes paint slightly outside their bounds (pens, handles), so the
+    // query area is widened by the same margin used for invalidation
+    const qreal margin = 12.0;
+    return m_store.queryInPaintOrder(docArea.adjusted(-margin, -margin, margin, margin));
+}
+
+QVector<DiagramShape*> DiagramCanvas::shapesInPaintOrder() const
+{
+    return m_store.paintOrder();
+}
+
+QTransform DiagramCanvas::viewTransform() const
+{
+    QTransform transform;
+    transform.translate(-m_scroll.x(), -m_scroll.y());
+    transform.scale(m_zoom, m_zoom);
+    return transform;
+}
+
+QPointF DiagramCanvas::mapToDocument(const QPointF& viewPos) const
+{
+    return (viewPos + QPointF(m_scroll)) / m_zoom;
+}
+
+QRectF DiagramCanvas::mapToDocument(const QRectF& viewRect) const
+{
+    return QRectF(mapToDocument(viewRect.topLeft()), viewRect.size() / m_zoom);
+}
+
+QPointF DiagramCanvas::mapFromDocument(const QPointF& docPos) const
+{
+    return docPos * m_zoom - QPointF(m_scroll);
+}
+
+QRectF DiagramCanvas::mapFromDocument(const QRectF& docRect) const
+{
+    return QRectF(mapFromDocument(docRect.topLeft()), docRect.size() * m_zoom);
+}
+
+void DiagramCanvas::setZoom(qreal zoom)
+{
+    setZoom(zoom, QRectF(rect()).center());
+}
+
+void DiagramCanvas::setZoom(qreal zoom, const QPointF& anchor)
+{
+    zoom = qBound(kMinZoom, zoom, kMaxZoom);
+    if (qFuzzyCompare(zoom, m_zoom)) return;
+
+    // Keep the document point under the anchor where it is on screen
+    const QPointF docAnchor = mapToDocument(anchor);
+    m_zoom = zoom;
+    const QPointF scroll = docAnchor * m_zoom - anchor;
+    m_scroll = QPoint(qRound(scroll.x()), qRound(scroll.y()));
+
+    // Every tile was rendered at the old scale
+    m_tileCache.clear();
+    if (!m_dragBackdrop.isNull()) {
+        beginDragLayer();
+    }
+    update();
+    emit zoomChanged(m_zoom);
+}
+
+void DiagramCanvas::zoomIn()
+{
+    setZoom(m_zoom * kZoomStep);
+}
+
+void DiagramCanvas::zoomOut()
+{
+    setZoom(m_zoom / kZoomStep);
+}
+
+void DiagramCanvas::resetZoom()
+{
+    setZoom(1.0);
+}
+
+void DiagramCanvas::zoomToFit()
+{
+    QRectF bounds = m_store.boundsUnion();
+    if (bounds.isEmpty()) {
+        bounds = QRectF(QPointF(0, 0), QSizeF(m_canvasSize));
+    }
+
+    const qreal margin = 20.0;
+    qreal zoom = qMin((width() - 2 * margin) / bounds.width(),
+                      (height() - 2 * margin) / bounds.height());
+    zoom = qBound(kMinZoom, zoom, kMaxZoom);
+
+    const QPointF scroll = bounds.center() * zoom - QRectF(rect()).center();
+    m_zoom = zoom;
+    m_scroll = QPoint(qRound(scroll.x()), qRound(scroll.y()));
+    m_tileCache.clear();
+    if (!m_dragBackdrop.isNull()) {
+        beginDragLayer();
+    }
+    update();
+    emit zoomChanged(m_zoom);
+}
+
+void DiagramCanvas::scrollViewBy(const QPoint& delta)
+{
+    if (delta.isNull()) return;
+    m_scroll += delta;
+
+    if (!m_dragBackdrop.isNull()) {
+        // The backbuffer is in view space and has to follow the scroll
+        beginDragLayer();
+        update();
+    }
+    else {
+        // Moves the existing pixels; only the uncovered strip is repainted
+        scroll(-delta.x(), -delta.y());
+    }
+}
+
+void DiagramCanvas::wheelEvent(QWheelEvent* event)
+{
+    const QPoint steps = event->angleDelta();
+    if (event->modifiers() & Qt::ControlModifier) {
+        if (steps.y() != 0) {
+            setZoom(m_zoom * qPow(kZoomStep, steps.y() / 120.0), event->position());
+        }
+    }
+    else if (event->modifiers() & Qt::ShiftModifier) {
+        scrollViewBy(QPoint(-steps.y(), 0));
+    }
+    else {
+        scrollViewBy(-steps);
+    }
+    event->accept();
+}
+
+void DiagramCanvas::rebuildConnections()
+{
+    m_connections.clear();
+    const QVector<DiagramShape::Type>& types = m_store.types();
+    for (int row = 0; row < types.size(); ++row) {
+        if (types[row] == DiagramShape::Connector) {
+            attachConnector(static_cast<ConnectorShape*>(m_store.at(row)));
+        }
+    }
+}
+
+void DiagramCanvas::attachConnector(ConnectorShape* connector)
+{
+    m_connections.attach(connector->getId(), connector->getStartShape(), connector->getEndShape());
+}
+
+void DiagramCanvas::anchorConnector(ConnectorShape* connector)
+{
+    connector->reanchor(m_store.find(connector->getStartShape()), m_store.find(connector->getEndShape()));
+}
+
+QRectF DiagramCanvas::reanchorConnectors(const QVector<DiagramShape*>& shapes)
+{
+    // Only connectors attached to the given shapes are visited (plus bound
+    // connectors among the shapes themselves, which snap back to their
+    // anchors); every other connector is left alone. Returns the area
+    // that needs repainting.
+    QSet<DiagramShape*> connectors;
+    for (DiagramShape* shape : shapes) {
+        if (shape->getType() == DiagramShape::Connector) {
+            if (static_cast<ConnectorShape*>(shape)->isBound()) {
+                connectors.insert(shape);
+            }
+            continue;
+        }
+        for (ShapeId connectorId : m_connections.connectorsOf(shape->getId())) {
+            if (DiagramShape* connector = m_store.find(connectorId)) {
+                connectors.insert(connector);
+            }
+        }
+    }
+
+    QRectF dirty;
+    for (DiagramShape* shape : connectors) {
+        dirty |= shape->boundingRect();
+        anchorConnector(static_cast<ConnectorShape*>(shape));
+        dirty |= shape->boundingRect();
+        m_store.updateBounds(shape);
+    }
+    return dirty;
+}
+
+void DiagramCanvas::setSelectedRoutingStyle(int style)
+{
+    QList<std::shared_ptr<DiagramShape>> shapes = m_selectedShapes;
+    if (m_selectedShape && !shapes.contains(m_selectedShape)) {
+        shapes.append(m_selectedShape);
+    }
+
+    QVector<DiagramShape*> rerouted;
+    QRectF dirty;
+    UndoJournal::Entry entry;
+    for (auto& shape : shapes) {
+        if (shape->getType() != DiagramShape::Connector) continue;
+        auto* connector = static_cast<ConnectorShape*>(shape.get());
+        if (connector->getRoutingStyle() == style) continue;
+
+        entry.properties.append({ connector->getId(), UndoJournal::RoutingStyle,
+                                  int(connector->getRoutingStyle()), style });
+        connector->setRoutingStyle(ConnectorShape::RoutingStyle(style));
+        if (style == ConnectorShape::Orthogonal) {
+            rerouted.append(connector);
+        }
+        else {
+            // Back to a straight line between the (re-clipped) ends
+            const QPolygonF before = routeOf(connector);
+            dirty |= connector->boundingRect();
+            connector->clearControlPoints();
+            anchorConnector(connector);
+            reindexShape(shape);
+            dirty |= connector->boundingRect();
+            entry.routes.append({ connector->getId(), before, routeOf(connector) });
+        }
+        m_modified = true;
+    }
+    record(std::move(entry));
+    scheduleRoutes(rerouted);
+    invalidateArea(dirtyRect(dirty));
+}
+
+void DiagramCanvas::scheduleRoutes(const QVector<DiagramShape*>& shapes, const QRectF& area)
+{
+    // Orthogonal connectors among the shapes or attached to them, and
+    // those whose route runs through area (where an obstacle appeared,
+    // moved or went away). Everything else keeps its route.
+    auto isOrthogonal = [](const DiagramShape* shape) {
+        return shape->getType() == DiagramShape::Connector
+            && static_cast<const ConnectorShape*>(shape)->getRoutingStyle() == ConnectorShape::Orthogonal;
+    };
+    const int before = m_routesPending.size();
+    for (DiagramShape* shape : shapes) {
+        if (isOrthogonal(shape)) {
+            m_routesPending.insert(shape->getId());
+        }
+        for (ShapeId connectorId : m_connections.connectorsOf(shape->getId())) {
+            DiagramShape* connector = m_store.find(connectorId);
+            if (connector && isOrthogonal(connector)) {
+                m_routesPending.insert(connectorId);
+            }
+        }
+    }
+    if (!area.isEmpty()) {
+        for (DiagramShape* shape : m_store.query(area)) {
+            if (isOrthogonal(shape) && shape->intersects(area)) {
+                m_routesPending.insert(shape->getId());
+            }
+        }
+    }
+    if (m_routesPending.size() != before && !m_routeTimer.isActive()) {
+        m_routeTimer.start();
+    }
+}
+
+void DiagramCanvas::startRouting()
+{
+    if (m_routesPending.isEmpty()) return;
+
+    // A running batch is superseded; whatever it was routing goes into
+    // the new batch instead
+    if (m_routeWatcher.isRunning()) {
+        *m_routeCancel = true;
+        m_routesPending.unite(m_routesInFlight);
+    }
+
+    // Requests are value snapshots, so the document can change while the
+    // worker runs
+    QVector<OrthogonalRouter::Request> requests;
+    requests.reserve(m_routesPending.size());
+    for (ShapeId id : m_routesPending) {
+        DiagramShape* shape = m_store.find(id);
+        if (shape && shape->getType() == DiagramShape::Connector) {
+            requests.append(routeRequest(static_cast<ConnectorShape*>(shape)));
+        }
+    }
+    m_routesInFlight = m_routesPending;
+    m_routesPending.clear();
+
+    auto cancel = std::make_shared<std::atomic<bool>>(false);
+    m_routeCancel = cancel;
+    m_routeWatcher.setFuture(QtConcurrent::run([requests, cancel]() {
+        QVector<OrthogonalRouter::Result> results;
+        results.reserve(requests.size());
+        for (const OrthogonalRouter::Request& request : requests) {
+            if (cancel->load()) break;
+            results.append(OrthogonalRouter::route(request, cancel.get()));
+        }
+        return results;
+    }));
+}
+
+void DiagramCanvas::applyRoutes()
+{
+    if (m_routeCancel && m_routeCancel->load()) return;
+    const QVector<OrthogonalRouter::Result> results = m_routeWatcher.result();
+    m_routesInFlight.clear();
+
+    QRectF dirty;
+    bool backdropStale = false;
+    for (const OrthogonalRouter::Result& result : results) {
+        // Changed again since the snapshot; the newer request wins
+        if (m_routesPending.contains(result.connector)) continue;
+        DiagramShape* shape = m_store.find(result.connector);
+        if (!shape || shape->getType() != DiagramShape::Connector) continue;
+        auto* connector = static_cast<ConnectorShape*>(shape);
+        if (connector->getRoutingStyle() != ConnectorShape::Orthogonal) continue;
+
+        dirty |= connector->boundingRect();
+        connector->setRoute(result.start, result.controlPoints, result.end);
+        m_store.updateBounds(connector);
+        dirty |= connector->boundingRect();
+        backdropStale |= !m_dragShapes.contains(connector);
+    }
+    if (dirty.isNull()) return;
+
+    if (!m_dragBackdrop.isNull()) {
+        // Rerouted connectors outside the drag live in the backbuffer
+        if (backdropStale) {
+            beginDragLayer();
+        }
+        m_dragBounds |= dirty;
+        update(dirtyRect(dirty));
+    }
+    else {
+        invalidateArea(dirtyRect(dirty));
+    }
+}
+
+OrthogonalRouter::Request DiagramCanvas::routeRequest(const ConnectorShape* connector) const
+{
+    OrthogonalRouter::Request request;
+    request.connector = connector->getId();
+
+    // Each end attaches on the side of its shape facing the other end
+    const DiagramShape* start = m_store.find(connector->getStartShape());
+    const DiagramShape* end = m_store.find(connector->getEndShape());
+    const QPointF startTarget = end ? end->boundingRect().center() : connector->getEndPoint();
+    const QPointF endTarget = start ? start->boundingRect().center() : connector->getStartPoint();
+    request.start = start
+        ? OrthogonalRouter::attachPoint(start, connector->getStartPort(), startTarget, request.startDirection)
+        : connector->getStartPoint();
+    request.end = end
+        ? OrthogonalRouter::attachPoint(end, connector->getEndPort(), endTarget, request.endDirection)
+        : connector->getEndPoint();
+
+    // Only the neighbourhood of the two ends is searched
+    const qreal border = 200.0;
+    QRectF area = QRectF(request.start, request.end).normalized().adjusted(-border, -border, border, border);
+    if (start) area |= start->boundingRect();
+    if (end) area |= end->boundingRect();
+    for (DiagramShape* shape : m_store.query(area)) {
+        if (shape == connector) continue;
+        if (shape->getType() != DiagramShape::Connector) {
+            request.obstacles.append(shape->boundingRect());
+            continue;
+        }
+        const auto* other = static_cast<const ConnectorShape*>(shape);
+        QPointF previous = other->getStartPoint();
+        const QVector<QPointF> points = other->getControlPoints();
+        for (const QPointF& point : points) {
+            request.otherSegments.append(QLineF(previous, point));
+            previous = point;
+        }
+        request.otherSegments.append(QLineF(previous, other->getEndPoint()));
+    }
+    return request;
+}
+
+void DiagramCanvas::applyLayout()
+{
+    if (m_layoutCancel && m_layoutCancel->load()) return;
+    const LayeredLayout::Result result = m_layoutWatcher.result();
+    if (result.nodes.isEmpty()) return;
+
+    // Shapes deleted since the snapshot are skipped
+    QVector<DiagramShape*> moved;
+    UndoJournal::Entry entry;
+    for (int i = 0; i < result.nodes.size(); ++i) {
+        DiagramShape* shape = m_store.find(result.nodes[i]);
+        if (!shape) continue;
+        m_layoutWatermark = qMax(m_layoutWatermark, result.nodes[i]);
+        if (shape->boundingRect().topLeft() == result.positions[i]) continue;
+        entry.placed.append(shape->getId());
+        entry.placedBefore.append(shape->boundingRect().topLeft());
+        entry.placedAfter.append(result.positions[i]);
+        shape->setPos(result.positions[i]);
+        m_store.updateBounds(shape);
+        moved.append(shape);
+    }
+
+    // Direct connectors along long edges bend where the edge crosses a
+    // layer; the old bends of the others are dropped
+    bool rerouted = false;
+    for (int i = 0; i < result.connectors.size(); ++i) {
+        DiagramShape* shape = m_store.find(result.connectors[i]);
+        if (!shape || shape->getType() != DiagramShape::Connector) continue;
+        auto* connector = static_cast<ConnectorShape*>(shape);
+        if (connector->getRoutingStyle() != ConnectorShape::Direct) continue;
+        const QPolygonF before = routeOf(connector);
+        connector->setRoute(connector->getStartPoint(), result.bends[i], connector->getEndPoint());
+        anchorConnector(connector);
+        m_store.updateBounds(connector);
+        entry.routes.append({ connector->getId(), before, routeOf(connector) });
+        rerouted = true;
+    }
+    if (moved.isEmpty() && !rerouted) return;
+    record(std::move(entry));
+
+    reanchorConnectors(moved);
+    scheduleRoutes(moved);
+    m_modified = true;
+    if (!m_dragBackdrop.isNull()) {
+        beginDragLayer();
+    }
+    invalidateAll();
+}
+
+void DiagramCanvas::finishForceLayout()
+{
+    // Abandoned runs (the document was replaced) leave no cancel flag
+    if (m_forceCancel) {
+        m_forceCancel.reset();
+        applyForceFrame(m_forceWatcher.result());
+    }
+    m_journal.seal();
+    emit forceLayoutFinished();
+}
+
+void DiagramCanvas::applyForceFrame(const QVector<QPointF>& positions)
+{
+    QVector<DiagramShape*> moved;
+    UndoJournal::Entry entry;
+    entry.coalescing = UndoJournal::Layout;
+    for (int i = 0; i < positions.size() && i < m_forceNodes.size(); ++i) {
+        DiagramShape* shape = m_store.find(m_forceNodes[i]);
+        if (!shape || shape->boundingRect().topLeft() == positions[i]) continue;
+        entry.placed.append(shape->getId());
+        entry.placedBefore.append(shape->boundingRect().topLeft());
+        entry.placedAfter.append(positions[i]);
+        shape->setPos(positions[i]);
+        m_store.updateBounds(shape);
+        moved.append(shape);
+    }
+    if (moved.isEmpty()) return;
+    record(std::move(entry));
+
+    reanchorConnectors(moved);
+    scheduleRoutes(moved);
+    m_modified = true;
+    if (!m_dragBackdrop.isNull()) {
+        beginDragLayer();
+    }
+    invalidateAll();
+}
+
+QVector<ConnectorShape*> DiagramCanvas::layoutEdges() const
+{
+    // Nodes are shapes with a connector bound to them at both ends; loose
+    // shapes such as titles and notes stay where they are
+    auto isNode = [this](ShapeId id) {
+        const DiagramShape* shape = m_store.find(id);
+        return shape && shape->getType() != DiagramShape::Connector;
+    };
+    QVector<ConnectorShape*> edges;
+    const QVector<DiagramShape::Type>& types = m_store.types();
+    for (int row = 0; row < types.size(); ++row) {
+        if (types[row] != DiagramShape::Connector) continue;
+        auto* connector = static_cast<ConnectorShape*>(m_store.at(row));
+        if (isNode(connector->getStartShape()) && isNode(connector->getEndShape())) {
+            edges.append(connector);
+        }
+    }
+    return edges;
+}
+
+void DiagramCanvas::setSelectedPinned(bool pinned)
+{
+    QList<std::shared_ptr<DiagramShape>> shapes = m_selectedShapes;
+    if (m_selectedShape && !shapes.contains(m_selectedShape)) {
+        shapes.append(m_selectedShape);
+    }
+    UndoJournal::Entry entry;
+    for (auto& shape : shapes) {
+        if (shape->getType() != DiagramShape::Connector && m_store.isPinned(shape.get()) != pinned) {
+            entry.properties.append({ shape->getId(), UndoJournal::Pinned, !pinned, pinned });
+            m_store.setPinned(shape.get(), pinned);
+            m_modified = true;
+        }
+    }
+    record(std::move(entry));
+}
+
+void DiagramCanvas::arrangeSelection(bool (ShapeStore::*arrange)(const QVector<DiagramShape*>&))
+{
+    // The whole selection moves in one operation and keeps its own
+    // stacking; only the selected shapes get new z keys
+    QVector<DiagramShape*> shapes;
+    shapes.reserve(m_selectedShapes.size() + 1);
+    QRectF dirty;
+    for (auto& shape : m_selectedShapes) {
+        shapes.append(shape.get());
+        dirty |= shape->boundingRect();
+    }
+    if (m_selectedShape) {
+        shapes.append(m_selectedShape.get());
+        dirty |= m_selectedShape->boundingRect();
+    }
+
+    // Undo puts each shape back above its old neighbour, bottom first
+    shapes = m_store.inPaintOrder(shapes);
+    UndoJournal::Entry entry;
+    for (DiagramShape* shape : shapes) {
+        entry.restacks.append({ shape->getId(), m_store.idBelow(shape), 0 });
+    }
+    if (!(m_store.*arrange)(shapes)) return;
+    for (int i = 0; i < shapes.size(); ++i) {
+        entry.restacks[i].belowAfter = m_store.idBelow(shapes[i]);
+    }
+    record(std::move(entry));
+    m_modified = true;
+    invalidateArea(dirtyRect(dirty));
+}
+
+void DiagramCanvas::undo()
+{
+    // A layout still running would keep writing over the restored state
+    abandonForceLayout();
+    if (m_layoutCancel) {
+        *m_layoutCancel = true;
+    }
+    releaseCreation();
+    if (const UndoJournal::Entry* entry = m_journal.undo()) {
+        m_autosave.record(*entry, true);
+        replay(*entry, true);
+    }
+}
+
+void DiagramCanvas::redo()
+{
+    abandonForceLayout();
+    if (m_layoutCancel) {
+        *m_layoutCancel = true;
+    }
+    releaseCreation();
+    if (const UndoJournal::Entry* entry = m_journal.redo()) {
+        m_autosave.record(*entry);
+        replay(*entry, false);
+    }
+}
+
+void DiagramCanvas::recordPropertyChange(std::shared_ptr<DiagramShape> shape, int property,
+                                         const QVariant& before, const QVariant& after)
+{
+    if (!shape || !m_store.contains(shape.get())) return;
+    UndoJournal::Entry entry;
+    entry.properties.append({ shape->getId(), UndoJournal::Property(property), before, after });
+    // A spin box or text field reports every step; the run is one edit,
+    // as long as it stays on the same property (see UndoJournal::merge)
+    if (property == UndoJournal::Text || property == UndoJournal::LineWidth) {
+        entry.coalescing = UndoJournal::Typing;
+    }
+    record(std::move(entry));
+}
+
+void DiagramCanvas::record(UndoJournal::Entry entry)
+{
+    // Property panels report values that did not change, too; neither
+    // journal should see them
+    entry.properties.erase(std::remove_if(entry.properties.begin(), entry.properties.end(),
+                                          [](const UndoJournal::PropertyChange& change) {
+                                              return change.before == change.after;
+                                          }),
+                           entry.properties.end());
+    if (entry.isEmpty()) return;
+
+    // The autosave journal stores inserted shapes as they are when
+    // recorded, and resizing while drawing is not journalled, so a shape
+    // being drawn waits for the mouse release
+    if (m_holdingCreation && m_heldCreation.isEmpty() && !entry.inserted.isEmpty()) {
+        m_heldCreation = entry;
+    }
+    else {
+        releaseCreation();
+        m_autosave.record(entry);
+    }
+    m_journal.record(std::move(entry));
+    emit undoStateChanged(m_journal.canUndo(), m_journal.canRedo());
+}
+
+void DiagramCanvas::startAutosave(const QString& documentPath)
+{
+    // The file or the snapshot below has the shape being drawn
+    m_heldCreation = UndoJournal::Entry();
+    m_holdingCreation = false;
+    m_autosave.begin(documentPath);
+    // Edits the file does not have (made while it loaded, or recovered)
+    // and untitled documents start from a snapshot
+    if (m_modified || documentPath.isEmpty()) {
+        compactAutosave();
+    }
+}
+
+bool DiagramCanvas::recover(const AutosaveJournal::Recovery& recovery)
+{
+    FlowDocument document = recovery.snapshot;
+    if (!recovery.hasSnapshot && !recovery.documentPath.isEmpty()
+        && !FlowIO::load(recovery.documentPath, document)) {
+        return false;
+    }
+    clear();
+    setBackgroundColor(document.backgroundColor);
+    setCanvasSize(document.canvasSize);
+    setAllShapes(document.shapes, document.pinned);
+
+    // The records hold after values only, so they replay forwards and are
+    // not undoable
+    for (const AutosaveJournal::Operation& operation : recovery.operations) {
+        if (operation.backgroundColor.isValid()) {
+            setBackgroundColor(operation.backgroundColor);
+            setCanvasSize(operation.canvasSize);
+            continue;
+        }
+        UndoJournal::Entry entry = operation.edit;
+        for (ShapeId id : operation.removed) {
+            if (DiagramShape* shape = m_store.find(id)) {
+                entry.removed.append({ m_store.shared(shape), m_store.idBelow(shape), m_store.isPinned(shape) });
+            }
+        }
+        replay(entry, false);
+    }
+    m_modified = true;
+    invalidateAll();
+    return true;
+}
+
+void DiagramCanvas::releaseCreation()
+{
+    m_holdingCreation = false;
+    if (!m_heldCreation.isEmpty()) {
+        m_autosave.record(m_heldCreation);
+        m_heldCreation = UndoJournal::Entry();
+    }
+}
+
+void DiagramCanvas::compactAutosave()
+{
+    FlowDocument document;
+    document.backgroundColor = m_backgroundColor;
+    document.canvasSize = m_canvasSize;
+    // Encoding a large document stalls input, so the journal's writer does
+    // it; the copies stay as they are while the user edits on
+    const QList<std::shared_ptr<DiagramShape>> shapes = m_store.toList();
+    document.shapes.reserve(shapes.size());
+    for (const auto& shape : shapes) {
+        document.shapes.append(shape->clone());
+    }
+    document.pinned = m_store.pinnedIds();
+    m_autosave.compact(document);
+}
+
+void DiagramCanvas::replay(const UndoJournal::Entry& entry, bool undo)
+{
+    QVector<ShapeId> touched;
+    auto restore = [&](const QVector<UndoJournal::Insertion>& shapes) {
+        for (const UndoJournal::Insertion& insertion : shapes) {
+            restoreShape(insertion);
+            touched.append(insertion.shape->getId());
+        }
+    };
+    auto drop = [&](const QVector<UndoJournal::Insertion>& shapes) {
+        for (int i = shapes.size() - 1; i >= 0; --i) {
+            dropShape(shapes[i].shape.get());
+        }
+    };
+    auto move = [&]() {
+        // One translation for the whole selection, however large
+        const QPointF delta = undo ? -entry.delta : entry.delta;
+        for (ShapeId id : entry.moved) {
+            if (DiagramShape* shape = m_store.find(id)) {
+                shape->moveBy(delta);
+                touched.append(id);
+            }
+        }
+    };
+    auto place = [&]() {
+        const QVector<QPointF>& positions = undo ? entry.placedBefore : entry.placedAfter;
+        for (int i = 0; i < entry.placed.size(); ++i) {
+            if (DiagramShape* shape = m_store.find(entry.placed[i])) {
+                shape->setPos(positions[i]);
+                touched.append(entry.placed[i]);
+            }
+        }
+    };
+    auto route = [&]() {
+        for (const UndoJournal::RouteChange& change : entry.routes) {
+            DiagramShape* shape = m_store.find(change.connector);
+            const QPolygonF& path = undo ? change.before : change.after;
+            if (!shape || shape->getType() != DiagramShape::Connector || path.size() < 2) continue;
+            static_cast<ConnectorShape*>(shape)->setRoute(path.first(), path.mid(1, path.size() - 2), path.last());
+            touched.append(change.connector);
+        }
+    };
+    auto set = [&]() {
+        for (const UndoJournal::PropertyChange& change : entry.properties) {
+            if (DiagramShape* shape = m_store.find(change.shape)) {
+                setShapeProperty(shape, change.property, undo ? change.before : change.after);
+                touched.append(change.shape);
+            }
+        }
+    };
+    auto restack = [&]() {
+        // Bottom first either way, so every neighbour is in place before
+        // the shape above it is put back
+        for (const UndoJournal::Restack& change : entry.restacks) {
+            if (DiagramShape* shape = m_store.find(change.shape)) {
+                m_store.placeAbove(shape, undo ? change.belowBefore : change.belowAfter);
+            }
+        }
+    };
+
+    if (undo) {
+        restore(entry.removed);
+        restack();
+        set();
+        route();
+        place();
+        move();
+        drop(entry.inserted);
+    }
+    else {
+        restore(entry.inserted);
+        move();
+        place();
+        route();
+        set();
+        restack();
+        drop(entry.removed);
+    }
+
+    QVector<DiagramShape*> present;
+    for (ShapeId id : touched) {
+        if (DiagramShape* shape = m_store.find(id)) {
+            m_store.updateBounds(shape);
+            present.append(shape);
+        }
+    }
+    reanchorConnectors(present);
+    scheduleRoutes(present);
+    m_modified = true;
+    invalidateAll();
+    updateSelectionState();
+    emit undoStateChanged(m_journal.canUndo(), m_journal.canRedo());
+}
+
+void DiagramCanvas::restoreShape(const UndoJournal::Insertion& insertion)
+{
+    const std::shared_ptr<DiagramShape>& shape = insertion.shape;
+    if (m_store.contains(shape.get())) return;
+    m_store.append(shape, insertion.pinned ? ShapeStore::Pinned : 0);
+    m_store.placeAbove(shape.get(), insertion.below);
+    if (shape->getType() == DiagramShape::Connector) {
+        attachConnector(static_cast<ConnectorShape*>(shape.get()));
+    }
+    shape->setSelected(false);
+    scheduleRoutes({ shape.get() }, shape->boundingRect());
+}
+
+void DiagramCanvas::dropShape(DiagramShape* shape)
+{
+    if (shape->getType() == DiagramShape::Connector) {
+        m_connections.detach(shape->getId());
+    }
+    m_store.remove(shape);
+    for (int i = m_selectedShapes.size() - 1; i >= 0; --i) {
+        if (m_selectedShapes[i].get() == shape) {
+            m_selectedShapes.removeAt(i);
+        }
+    }
+    if (m_selectedShape.get() == shape) {
+        m_selectedShape = nullptr;
+    }
+    // Routes that went around the shape may be shorter now
+    if (shape->getType() != DiagramShape::Connector) {
+        scheduleRoutes({}, shape->boundingRect());
+    }
+}
+
+void DiagramCanvas::setShapeProperty(DiagramShape* shape, UndoJournal::Property property, const QVariant& value)
+{
+    switch (property) {
+    case UndoJournal::FillColor:
+        shape->setColor(value.value<QColor>());
+        break;
+    case UndoJournal::LineColor:
+        shape->setLineColor(value.value<QColor>());
+        break;
+    case UndoJournal::LineWidth:
+        shape->setLineWidth(value.toInt());
+        break;
+    case UndoJournal::Text:
+        shape->setText(value.toString());
+        break;
+    case UndoJournal::Pinned:
+        m_store.setPinned(shape, value.toBool());
+        break;
+    case UndoJournal::RoutingStyle:
+    case UndoJournal::StartBinding:
+    case UndoJournal::EndBinding: {
+        if (shape->getType() != DiagramShape::Connector) break;
+        auto* connector = static_cast<ConnectorShape*>(shape);
+        if (property == UndoJournal::RoutingStyle) {
+            connector->setRoutingStyle(ConnectorShape::RoutingStyle(value.toInt()));
+            break;
+        }
+        const QVariantList binding = value.toList();
+        const ShapeId id = binding.value(0).toULongLong();
+        const auto port = DiagramShape::Port(binding.value(1).toInt());
+        if (property == UndoJournal::StartBinding) {
+            connector->setStartBinding(id, port);
+        }
+        else {
+            connector->setEndBinding(id, port);
+        }
+        attachConnector(connector);
+        break;
+    }
+    }
+}
+
+void DiagramCanvas::refreshCanvas() {
+    // Property edits (text, font, line width) may change a shape's bounds
+    for (auto& shape : m_selectedShapes) {
+        invalidateShape(shape);
+    }
+    invalidateShape(m_selectedShape);
+}
\ No newline at end of file
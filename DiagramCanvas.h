@@ -9,23 +9,54 @@
 #include <QWidget>
 #include <QList>
 #include <QColor>
+#include <QTransform>
+#include <QFutureWatcher>
+#include <QSet>
+#include <QTimer>
+#include <atomic>
 #include <memory>
 #include "DiagramShape.h"
+#include "ShapeStore.h"
+#include "ConnectionIndex.h"
+#include "FlowIO.h"
+#include "ForceLayout.h"
+#include "LayeredLayout.h"
+#include "OrthogonalRouter.h"
+#include "TileCache.h"
+#include "UndoJournal.h"
+#include "AutosaveJournal.h"
+
+class ConnectorShape;
+class QSemaphore;
 
 class DiagramCanvas : public QWidget
 {
     Q_OBJECT
 public:
     DiagramCanvas(QWidget* parent = nullptr);
-    ~DiagramCanvas() = default;
+    ~DiagramCanvas();
     
     void addShape(std::shared_ptr<DiagramShape> shape);
+    // Adds the shapes on top, in list order, as one undo step; pinned
+    // holds the ids of those to pin
+    void addShapes(const QList<std::shared_ptr<DiagramShape>>& shapes, const QSet<ShapeId>& pinned = {});
     void clear();
     bool exportToPng(const QString& filename);
     bool exportToSvg(const QString& filename);
     
-    QList<std::shared_ptr<DiagramShape>>& allShapes() { return m_shapes; }
-    void setAllShapes(const QList<std::shared_ptr<DiagramShape>>& shapes);
+    QList<std::shared_ptr<DiagramShape>> allShapes() const { return m_store.toList(); }
+    QSet<ShapeId> pinnedShapes() const { return m_store.pinnedIds(); }
+    const ShapeStore& shapeStore() const { return m_store; }
+    // Raw pointers in paint order, for renderers and exporters
+    QVector<DiagramShape*> shapesInPaintOrder() const;
+    void setAllShapes(const QList<std::shared_ptr<DiagramShape>>& shapes, const QSet<ShapeId>& pinned = {});
+    // Replaces the document with a file's, read on the global pool. Shapes
+    // arrive in batches, those in view first, and the canvas can be used
+    // while the rest is loading. Ends with loadFinished().
+    void loadDocument(const QString& filename);
+    // Stops loading and leaves an empty document
+    void cancelLoading();
+    bool isLoading() const { return m_loadCancel != nullptr; }
     
     bool isModified() const { return m_modified; }
     void setModified(bool modified) { m_modified = modified; }
@@ -35,6 +66,33 @@ public:
     void sendToBack();
     void bringForward();
     void sendBackward();
+    // Layered layout of every shape bound to a connector, computed in the
+    // background. The incremental variant keeps shapes that took part in
+    // the last layout (or came with the document) where they are and only
+    // places the ones added since.
+    void layoutLayered(bool incremental = false);
+    // Force-directed layout of the same shapes, shown live as it
+    // converges; stopping keeps the positions reached so far. Pinned
+    // shapes stay put.
+    void startForceLayout();
+    void stopForceLayout();
+    bool isForceLayoutRunning() const { return m_forceWatcher.isRunning(); }
+
+    //UNDO
+    // Every edit is journalled as a delta; see UndoJournal
+    UndoJournal& undoJournal() { return m_journal; }
+    bool canUndo() const { return m_journal.canUndo(); }
+    bool canRedo() const { return m_journal.canRedo(); }
+
+    //AUTOSAVE
+    // Every edit also goes to an autosave journal; see AutosaveJournal.
+    // Start it with the path the document was opened from or saved to
+    // (empty while untitled), again after each save.
+    void startAutosave(const QString& documentPath);
+    void stopAutosave() { m_autosave.discard(); }
+    // Loads what a crashed session left: its document, then its edits.
+    // False if the document cannot be read.
+    bool recover(const AutosaveJournal::Recovery& recovery);
     
     //PAGE
     void chooseBackgroundColor();
@@ -46,8 +104,22 @@ public:
     // These getters/setters are needed for FlowIO serialization/deserialization
     QColor backgroundColor() const { return m_backgroundColor; }
     QSize canvasSize() const { return m_canvasSize; }
-    void setBackgroundColor(const QColor& color) { m_backgroundColor = color; update(); }
-    void setCanvasSize(const QSize& size) { m_canvasSize = size; resize(size); update(); }
+    void setBackgroundColor(const QColor& color) { m_backgroundColor = color; m_tileCache.clear(); update(); }
+    // The document space is unbounded; the canvas size is the page used for exports
+    void setCanvasSize(const QSize& size) { m_canvasSize = size; update(); }
+
+    //VIEW
+    qreal zoom() const { return m_zoom; }
+    void setZoom(qreal zoom);
+    void setZoom(qreal zoom, const QPointF& anchor);
+    QPointF mapToDocument(const QPointF& viewPos) const;
+    QRectF mapToDocument(const QRectF& viewRect) const;
+    QPointF mapFromDocument(const QPointF& docPos) const;
+    QRectF mapFromDocument(const QRectF& docRect) const;
+
+    // Rendered-tile cache; exposes hit/miss counters and the memory limit for tuning
+    TileCache& tileCache() { return m_tileCache; }
+    const TileCache& tileCache() const { return m_tileCache; }
     
     
     //CLIPERBOARD
@@ -58,9 +130,27 @@ public slots:
     void duplicateSelected();
     void setActiveShapeTool(int type);
     void refreshCanvas();
+    void zoomIn();
+    void zoomOut();
+    void resetZoom();
+    void zoomToFit();
+    void undo();
+    void redo();
+    // Edits made outside the canvas (the property panel); property is an
+    // UndoJournal::Property
+    void recordPropertyChange(std::shared_ptr<DiagramShape> shape, int property,
+                              const QVariant& before, const QVariant& after);
 signals:
     void shapeSelected(std::shared_ptr<DiagramShape> shape);
     void selectionChanged(bool hasSelection);
+    void zoomChanged(qreal zoom);
+    void forceLayoutFinished();
+    void undoStateChanged(bool canUndo, bool canRedo);
+    void loadProgress(int loaded, int total);
+    // Not emitted for cancelled loads; a failed one leaves an empty document
+    void loadFinished(bool ok);
+    // Queued from the journal's writer thread
+    void autosaveFailed(const QString& message);
     
     
 protected:
@@ -71,18 +161,116 @@ protected:
     void mouseDoubleClickEvent(QMouseEvent* event) override;
     void keyPressEvent(QKeyEvent* event) override;
     void contextMenuEvent(QContextMenuEvent* event) override;
+    void wheelEvent(QWheelEvent* event) override;
     
 private:
     std::shared_ptr<DiagramShape> findShapeAt(const QPointF& pos);
     void createNewShape(DiagramShape::Type type, const QPointF& pos);
     void updateSelectionState();
+    void reindexShape(const std::shared_ptr<DiagramShape>& shape);
+    void invalidateShape(const std::shared_ptr<DiagramShape>& shape);
+    void invalidateArea(const QRect& area);
+    void invalidateAll();
+    QImage renderTile(const QPoint& tile) const;
+    void beginDragLayer();
+    void endDragLayer();
+    void clearSelectionFlags();
+    // The selected shapes still in the document, bottom first
+    QVector<DiagramShape*> selectionInPaintOrder() const;
+    // The shapes as a small .flow document, for the clipboard
+    QByteArray encodeShapes(const QVector<DiagramShape*>& shapes) const;
+    // Adds copies 20 pixels down and right and selects them
+    void pasteShapes(const QList<std::shared_ptr<DiagramShape>>& shapes, const QSet<ShapeId>& pinned = {});
+    QRect dirtyRect(const QRectF& rect) const;
+    QRect connectPreviewRect() const;
+    QRect marqueePreviewRect() const;
+    void selectInMarquee(const QRectF& rect, bool intersecting);
+    QVector<DiagramShape*> shapesIn(const QRectF& docArea) const;
+    QTransform viewTransform() const;
+    void scrollViewBy(const QPoint& delta);
+    void rebuildConnections();
+    void attachConnector(ConnectorShape* connector);
+    void anchorConnector(ConnectorShape* connector);
+    QRectF reanchorConnectors(const QVector<DiagramShape*>& shapes);
+    void setSelectedRoutingStyle(int style);
+    void scheduleRoutes(const QVector<DiagramShape*>& shapes, const QRectF& area = QRectF());
+    void startRouting();
+    void applyRoutes();
+    OrthogonalRouter::Request routeRequest(const ConnectorShape* connector) const;
+    void applyLayout();
+    void abandonForceLayout();
+    void finishForceLayout();
+    void applyForceFrame(const QVector<QPointF>& positions);
+    // Connectors bound at both ends to (non-connector) shapes: the edges
+    // the layouts work on
+    QVector<ConnectorShape*> layoutEdges() const;
+    void setSelectedPinned(bool pinned);
+    void arrangeSelection(bool (ShapeStore::*arrange)(const QVector<DiagramShape*>&));
+    void abandonLoading();
+    void finishLoading();
+    void addLoadedShapes(const FlowIO::Batch& batch);
+    void record(UndoJournal::Entry entry);
+    void replay(const UndoJournal::Entry& entry, bool undo);
+    void compactAutosave();
+    // Hands a shape being drawn to the autosave journal, now at its final
+    // size
+    void releaseCreation();
+    // Puts a shape back into the document, above the shape with id below
+    void restoreShape(const UndoJournal::Insertion& insertion);
+    // Takes a shape out of the document (and the selection); the caller
+    // keeps it alive
+    void dropShape(DiagramShape* shape);
+    void setShapeProperty(DiagramShape* shape, UndoJournal::Property property, const QVariant& value);
     
-    QList<std::shared_ptr<DiagramShape>> m_shapes;
+    ShapeStore m_store;
     std::shared_ptr<DiagramShape> m_selectedShape;
     QList<std::shared_ptr<DiagramShape>> m_selectedShapes; //MULTI CHOOSE
+    ConnectionIndex m_connections;
+
+    // Orthogonal routes are computed on the global pool. Connectors whose
+    // route is out of date collect in m_routesPending until the timer
+    // sends them off as one batch; a newer batch cancels the running one.
+    QSet<ShapeId> m_routesPending;
+    QSet<ShapeId> m_routesInFlight;
+    QTimer m_routeTimer;
+    QFutureWatcher<QVector<OrthogonalRouter::Result>> m_routeWatcher;
+    std::shared_ptr<std::atomic<bool>> m_routeCancel;
+
+    QFutureWatcher<LayeredLayout::Result> m_layoutWatcher;
+    std::shared_ptr<std::atomic<bool>> m_layoutCancel;
+    // Ids are handed out in increasing order, so everything up to the
+    // highest id laid out so far counts as placed
+    ShapeId m_layoutWatermark = 0;
+    QFutureWatcher<QVector<QPointF>> m_forceWatcher;
+    std::shared_ptr<std::atomic<bool>> m_forceCancel;
+    QVector<ShapeId> m_forceNodes; // request order of the running force layout
+    UndoJournal m_journal;
+    AutosaveJournal m_autosave;
+    // The insertion of the shape being drawn, kept from the autosave
+    // journal until the drag has sized it
+    UndoJournal::Entry m_heldCreation;
+    bool m_holdingCreation = false;
+    QFutureWatcher<bool> m_loadWatcher;
+    std::shared_ptr<std::atomic<bool>> m_loadCancel;
+    std::shared_ptr<QSemaphore> m_loadSlots; // batches the worker may queue
+    int m_loadTotal = 0;
+    TileCache m_tileCache;
+
+    // While a selection is dragged, everything else is composited from this
+    // backbuffer and only the dragged shapes are painted per frame
+    QImage m_dragBackdrop;
+    QVector<DiagramShape*> m_dragShapes;
+    QRectF m_dragBounds;
     
     QColor m_backgroundColor;
     QSize m_canvasSize;
+
+    // View pixel = document point * m_zoom - m_scroll. The scroll offset is
+    // kept in whole pixels so cached tiles stay pixel-aligned while panning.
+    qreal m_zoom;
+    QPoint m_scroll;
+    bool m_isPanning;
+    QPoint m_panLastPos;
     bool m_modified;
     QPointF m_lastMousePos;
     bool m_isDragging;
@@ -93,4 +281,6 @@ private:
     bool m_isConnecting;
     std::shared_ptr<DiagramShape> m_startConnectShape;
     QPointF m_connectStartPoint;
+    bool m_isMarqueeSelecting;
+    QPointF m_marqueeOrigin;
 };
\ No newline at end of file
@@ -8,19 +8,62 @@
 #include "DiagramShape.h"
 #include "ConnectorShape.h"
 #include "TextShape.h"
-#include <QPainterPath>
+#include "ShapeStore.h"
 #include <QPolygonF>
 #include <QFont>
 #include <QFontMetrics>
+#include <QtMath>
+#include <limits>
+
+namespace {
+
+// Shapes smaller than this on screen are drawn as a filled box
+const qreal kPlaceholderPixels = 4.0;
+// Below this scale handles and arrowheads would just be noise
+const qreal kDecorationDetail = 0.5;
+// Text whose line height is under this many pixels is skipped
+const qreal kReadableTextPixels = 5.0;
+
+} // namespace
 
 DiagramShape::DiagramShape(Type t)
-    : type(t)
-    , isSelected(false)
-    , shapeColor(Qt::white)
+    : shapeColor(Qt::white)
     , lineColor(Qt::black)
     , lineWidth(1)
-    , m_text("")
+    , type(t)
+    , isSelected(false)
+{
+}
+
+DiagramShape::DiagramShape(const DiagramShape& other)
+    : position(other.position)
+    , shapeColor(other.shapeColor)
+    , lineColor(other.lineColor)
+    , id(other.id)
+    , lineWidth(other.lineWidth)
+    , type(other.type)
+    , isSelected(other.isSelected)
+{
+    if (other.m_label) {
+        m_label.reset(new Label);
+        m_label->text = other.m_label->text;
+    }
+}
+
+void DiagramShape::setText(const QString& text)
+{
+    if (!m_label) {
+        if (text.isEmpty()) return;
+        m_label.reset(new Label);
+    }
+    m_label->text = text;
+    m_label->layout.invalidate();
+}
+
+const QString& DiagramShape::labelText() const
 {
+    static const QString empty;
+    return m_label ? m_label->text : empty;
 }
 
 void DiagramShape::save(QDataStream &out) const
@@ -31,7 +74,7 @@ void DiagramShape::save(QDataStream &out) const
     out << lineColor;
     out << lineWidth;
     out << isSelected;
-    out << m_text;
+    out << labelText();
 }
 
 void DiagramShape::load(QDataStream &in)
@@ -44,72 +87,141 @@ void DiagramShape::load(QDataStream &in)
     in >> lineColor;
     in >> lineWidth;
     in >> isSelected;
-    in >> m_text;
+    QString text;
+    in >> text;
+    DiagramShape::setText(text);
 }
 
-void DiagramShape::paintSelectionHandles(QPainter* painter, const QRectF& rect) const
+void DiagramShape::compileSelectionHandles(RenderList& list, const QRectF& rect) const
 {
-    painter->setPen(QPen(Qt::blue, 1, Qt::DashLine));
-    painter->setBrush(Qt::NoBrush);
-    painter->drawRect(rect);
-    const int handleSize = 8;
-    painter->setPen(QPen(Qt::blue, 1));
-    painter->setBrush(Qt::white);
-    
-    QVector<QPointF> handlePositions = {
-        rect.topLeft(),
-        QPointF(rect.center().x(), rect.top()),
-        rect.topRight(),
-        QPointF(rect.right(), rect.center().y()),
-        rect.bottomRight(),
-        QPointF(rect.center().x(), rect.bottom()),
-        rect.bottomLeft(),
-        QPointF(rect.left(), rect.center().y())
-    };
-    
-    for (const QPointF& point : handlePositions) {
-        QRectF handleRect(
-            point.x() - handleSize/2, 
-            point.y() - handleSize/2,
-            handleSize, 
-            handleSize
-        );
-        painter->drawRect(handleRect);
+    list.setPen(QPen(Qt::blue, 1, Qt::DashLine));
+    list.setBrush(Qt::NoBrush);
+    list.addRect(rect);
+    if (!showDecorations(list)) {
+        return;
+    }
+
+    const qreal handleSize = 8;
+    const qreal half = handleSize / 2;
+    list.setPen(QPen(Qt::blue, 1));
+    list.setBrush(Qt::white);
+
+    // Corners and edge midpoints: a 3x3 grid over the rect minus its centre
+    const qreal xs[3] = { rect.left(), rect.center().x(), rect.right() };
+    const qreal ys[3] = { rect.top(), rect.center().y(), rect.bottom() };
+    for (int row = 0; row < 3; ++row) {
+        for (int col = 0; col < 3; ++col) {
+            if (row == 1 && col == 1) continue;
+            list.addRect(QRectF(xs[col] - half, ys[row] - half, handleSize, handleSize));
+        }
     }
 }
 
-void DiagramShape::paintText(QPainter* painter, const QRectF& rect) const
+void DiagramShape::compileText(RenderList& list, const QRectF& rect) const
 {
-    if (m_text.isEmpty()) {
+    if (labelText().isEmpty()) {
         return;
     }
     
-    painter->save();
-    painter->setPen(QPen(Qt::black));
-    
-    QFont font = painter->font();
+    QFont font;
     font.setPointSize(10);
-    painter->setFont(font);
-    
-    painter->drawText(rect, Qt::AlignCenter | Qt::TextWordWrap, m_text);
-    painter->restore();
+    if (!isTextReadable(list, font)) {
+        return;
+    }
+
+    list.setPen(QPen(Qt::black));
+    list.addText(textLayout(), rect, labelText(), font, Qt::AlignCenter | Qt::TextWordWrap);
+}
+
+bool DiagramShape::showDecorations(const RenderList& list)
+{
+    return list.levelOfDetail() >= kDecorationDetail;
+}
+
+bool DiagramShape::isTextReadable(const RenderList& list, const QFont& font)
+{
+    qreal pixelHeight = font.pixelSize() > 0 ? font.pixelSize() : font.pointSizeF() * 96.0 / 72.0;
+    return pixelHeight * list.levelOfDetail() >= kReadableTextPixels;
+}
+
+bool DiagramShape::compilePlaceholder(RenderList& list, const QRectF& rect) const
+{
+    if (qMax(rect.width(), rect.height()) * list.levelOfDetail() >= kPlaceholderPixels) {
+        return false;
+    }
+    // At this size the outline covers most of the pixels, so its colour is
+    // the closest match to what the full rendering would look like
+    list.setPen(Qt::NoPen);
+    list.setBrush(lineColor);
+    list.addRect(rect);
+    return true;
+}
+
+QPointF DiagramShape::portPosition(Port port) const
+{
+    const QRectF rect = boundingRect();
+    switch (port) {
+    case TopPort:
+        return QPointF(rect.center().x(), rect.top());
+    case RightPort:
+        return QPointF(rect.right(), rect.center().y());
+    case BottomPort:
+        return QPointF(rect.center().x(), rect.bottom());
+    case LeftPort:
+        return QPointF(rect.left(), rect.center().y());
+    default:
+        return rect.center();
+    }
+}
+
+QPointF DiagramShape::outlinePoint(const QPointF& target) const
+{
+    // The ray leaves the box through whichever side it reaches first
+    const QRectF rect = boundingRect();
+    const QPointF centre = rect.center();
+    const QPointF d = target - centre;
+    qreal t = std::numeric_limits<qreal>::max();
+    if (d.x() != 0) t = qMin(t, rect.width() / 2 / qAbs(d.x()));
+    if (d.y() != 0) t = qMin(t, rect.height() / 2 / qAbs(d.y()));
+    if (t == std::numeric_limits<qreal>::max()) return centre;
+    return centre + d * t;
 }
 
 std::shared_ptr<DiagramShape> DiagramShape::createShape(Type type)
 {
     switch (type) {
         case Rectangle:
-            return std::make_shared<RectangleShape>();
+            return ShapeStore::allocate<RectangleShape>();
+        case Ellipse:
+            return ShapeStore::allocate<EllipseShape>();
+        case Diamond:
+            return ShapeStore::allocate<DiamondShape>();
+        case Triangle:
+            return ShapeStore::allocate<TriangleShape>();
+        case Connector:
+            return ShapeStore::allocate<ConnectorShape>();
+        case Text:
+            return ShapeStore::allocate<TextShape>();
+        default:
+            return nullptr;
+    }
+}
+
+std::shared_ptr<DiagramShape> DiagramShape::clone() const
+{
+    switch (type) {
+        case Rectangle:
+            return ShapeStore::allocate<RectangleShape>(static_cast<const RectangleShape&>(*this));
         case Ellipse:
-            return std::make_shared<EllipseShape>();
+            return ShapeStore::allocate<EllipseShape>(static_cast<const EllipseShape&>(*this));
         case Diamond:
-            return std::make_shared<DiamondShape>();
+            return ShapeStore::allocate<DiamondShape>(static_cast<const DiamondShape&>(*this));
         case Triangle:
-            return std::make_shared<TriangleShape>();
+            return ShapeStore::allocate<TriangleShape>(static_cast<const TriangleShape&>(*this));
         case Connector:
-            return std::make_shared<ConnectorShape>();
+            return ShapeStore::allocate<ConnectorShape>(static_cast<const ConnectorShape&>(*this));
         case Text:
-            return std::make_shared<TextShape>();
+            return ShapeStore::allocate<TextShape>(static_cast<const TextShape&>(*this));
         default:
             return nullptr;
     }
@@ -122,22 +234,22 @@ RectangleShape::RectangleShape()
 {
 }
 
-void RectangleShape::paint(QPainter *painter)
+void RectangleShape::compile(RenderList& list) const
 {
-    painter->save();
-    painter->setPen(QPen(lineColor, lineWidth));
-    painter->setBrush(shapeColor);
-    
     QRectF rect(position, size);
-    painter->drawRect(rect);
+    if (compilePlaceholder(list, rect)) {
+        return;
+    }
+
+    list.setPen(QPen(lineColor, lineWidth));
+    list.setBrush(shapeColor);
+    list.addRect(rect);
     
-    paintText(painter, rect);
+    compileText(list, rect);
     
-    if (isSelected) {
-        paintSelectionHandles(painter, rect);
+    if (showSelection(list)) {
+        compileSelectionHandles(list, rect);
     }
-    
-    painter->restore();
 }
 
 bool RectangleShape::contains(const QPointF &point) const
@@ -184,29 +296,50 @@ EllipseShape::EllipseShape()
 {
 }
 
-void EllipseShape::paint(QPainter *painter)
+void EllipseShape::compile(RenderList& list) const
 {
-    painter->save();
-    painter->setPen(QPen(lineColor, lineWidth));
-    painter->setBrush(shapeColor);
-    
     QRectF rect(position, size);
-    painter->drawEllipse(rect);
+    if (compilePlaceholder(list, rect)) {
+        return;
+    }
+
+    list.setPen(QPen(lineColor, lineWidth));
+    list.setBrush(shapeColor);
+    list.addEllipse(rect);
     
-    paintText(painter, rect);
+    compileText(list, rect);
     
-    if (isSelected) {
-        paintSelectionHandles(painter, rect);
+    if (showSelection(list)) {
+        compileSelectionHandles(list, rect);
     }
-    
-    painter->restore();
 }
 
 bool EllipseShape::contains(const QPointF &point) const
 {
-    QPainterPath path;
-    path.addEllipse(QRectF(position, size));
-    return path.contains(point);
+    // Ellipse equation: (dx/rx)^2 + (dy/ry)^2 <= 1
+    const qreal rx = size.width() / 2;
+    const qreal ry = size.height() / 2;
+    if (rx <= 0 || ry <= 0) {
+        return false;
+    }
+    const qreal dx = (point.x() - position.x() - rx) / rx;
+    const qreal dy = (point.y() - position.y() - ry) / ry;
+    return dx * dx + dy * dy <= 1.0;
+}
+
+QPointF EllipseShape::outlinePoint(const QPointF& target) const
+{
+    // Solve ((t*dx)/rx)^2 + ((t*dy)/ry)^2 = 1 for t
+    const QPointF centre = boundingRect().center();
+    const QPointF d = target - centre;
+    const qreal rx = size.width() / 2;
+    const qreal ry = size.height() / 2;
+    if (rx <= 0 || ry <= 0 || d.isNull()) {
+        return centre;
+    }
+    const qreal ex = d.x() / rx;
+    const qreal ey = d.y() / ry;
+    return centre + d / qSqrt(ex * ex + ey * ey);
 }
 
 QRectF EllipseShape::boundingRect() const
@@ -246,42 +379,67 @@ DiamondShape::DiamondShape()
     : DiagramShape(Diamond)
     , size(QSizeF(120, 80))
 {
+    updateOutline();
 }
 
-void DiamondShape::paint(QPainter *painter)
+void DiamondShape::geometryChanged()
 {
-    painter->save();
-    painter->setPen(QPen(lineColor, lineWidth));
-    painter->setBrush(shapeColor);
-    
+    updateOutline();
+}
+
+void DiamondShape::updateOutline()
+{
+    // Written in place so only the first call allocates
     QRectF rect(position, size);
-    QPolygonF diamond;
-    diamond << QPointF(rect.center().x(), rect.top())
-           << QPointF(rect.right(), rect.center().y())
-           << QPointF(rect.center().x(), rect.bottom())
-           << QPointF(rect.left(), rect.center().y());
-    
-    painter->drawPolygon(diamond);
+    outline.resize(4);
+    outline[0] = QPointF(rect.center().x(), rect.top());
+    outline[1] = QPointF(rect.right(), rect.center().y());
+    outline[2] = QPointF(rect.center().x(), rect.bottom());
+    outline[3] = QPointF(rect.left(), rect.center().y());
+}
+
+void DiamondShape::compile(RenderList& list) const
+{
+    QRectF rect(position, size);
+    if (compilePlaceholder(list, rect)) {
+        return;
+    }
+
+    list.setPen(QPen(lineColor, lineWidth));
+    list.setBrush(shapeColor);
+    list.addPolygon(outline);
     
-    paintText(painter, rect);
+    compileText(list, rect);
     
-    if (isSelected) {
-        paintSelectionHandles(painter, rect);
+    if (showSelection(list)) {
+        compileSelectionHandles(list, rect);
     }
-    
-    painter->restore();
 }
 
 bool DiamondShape::contains(const QPointF &point) const
 {
-    QRectF rect(position, size);
-    QPolygonF diamond;
-    diamond << QPointF(rect.center().x(), rect.top())
-           << QPointF(rect.right(), rect.center().y())
-           << QPointF(rect.center().x(), rect.bottom())
-           << QPointF(rect.left(), rect.center().y());
-    
-    return diamond.containsPoint(point, Qt::OddEvenFill);
+    // Inside all four edges: |dx|/rx + |dy|/ry <= 1
+    const qreal rx = size.width() / 2;
+    const qreal ry = size.height() / 2;
+    if (rx <= 0 || ry <= 0) {
+        return false;
+    }
+    const qreal dx = qAbs(point.x() - position.x() - rx);
+    const qreal dy = qAbs(point.y() - position.y() - ry);
+    return dx * ry + dy * rx <= rx * ry;
+}
+
+QPointF DiamondShape::outlinePoint(const QPointF& target) const
+{
+    // Solve |t*dx|/rx + |t*dy|/ry = 1 for t
+    const QPointF centre = boundingRect().center();
+    const QPointF d = target - centre;
+    const qreal rx = size.width() / 2;
+    const qreal ry = size.height() / 2;
+    if (rx <= 0 || ry <= 0 || d.isNull()) {
+        return centre;
+    }
+    return centre + d / (qAbs(d.x()) / rx + qAbs(d.y()) / ry);
 }
 
 QRectF DiamondShape::boundingRect() const
@@ -292,11 +450,13 @@ QRectF DiamondShape::boundingRect() const
 void DiamondShape::moveBy(const QPointF& delta)
 {
     position += delta;
+    outline.translate(delta);
 }
 
 void DiamondShape::setSize(const QSizeF& newSize)
 {
     size = newSize;
+    updateOutline();
 }
 
 QSizeF DiamondShape::getSize() const
@@ -314,6 +474,7 @@ void DiamondShape::load(QDataStream &in)
 {
     DiagramShape::load(in);
     in >> size;
+    updateOutline();
 }
 
 // TriangleShape 实现
@@ -321,40 +482,98 @@ TriangleShape::TriangleShape()
     : DiagramShape(Triangle)
     , size(QSizeF(120, 80))
 {
+    updateOutline();
 }
 
-void TriangleShape::paint(QPainter *painter)
+void TriangleShape::geometryChanged()
 {
-    painter->save();
-    painter->setPen(QPen(lineColor, lineWidth));
-    painter->setBrush(shapeColor);
-    
+    updateOutline();
+}
+
+void TriangleShape::updateOutline()
+{
+    // Written in place so only the first call allocates
     QRectF rect(position, size);
-    QPolygonF triangle;
-    triangle << QPointF(rect.center().x(), rect.top())
-            << QPointF(rect.right(), rect.bottom())
-            << QPointF(rect.left(), rect.bottom());
-    
-    painter->drawPolygon(triangle);
+    outline.resize(3);
+    outline[0] = QPointF(rect.center().x(), rect.top());
+    outline[1] = QPointF(rect.right(), rect.bottom());
+    outline[2] = QPointF(rect.left(), rect.bottom());
+}
+
+void TriangleShape::compile(RenderList& list) const
+{
+    QRectF rect(position, size);
+    if (compilePlaceholder(list, rect)) {
+        return;
+    }
+
+    list.setPen(QPen(lineColor, lineWidth));
+    list.setBrush(shapeColor);
+    list.addPolygon(outline);
     
-    paintText(painter, rect);
+    compileText(list, rect);
     
-    if (isSelected) {
-        paintSelectionHandles(painter, rect);
+    if (showSelection(list)) {
+        compileSelectionHandles(list, rect);
     }
-    
-    painter->restore();
 }
 
 bool TriangleShape::contains(const QPointF &point) const
 {
-    QRectF rect(position, size);
-    QPolygonF triangle;
-    triangle << QPointF(rect.center().x(), rect.top())
-            << QPointF(rect.right(), rect.bottom())
-            << QPointF(rect.left(), rect.bottom());
-    
-    return triangle.containsPoint(point, Qt::OddEvenFill);
+    // Apex at the top centre, base along the bottom edge. A point is inside
+    // when it is above the base and on the inner side of both slanted
+    // edges, i.e. its distance from the centre line is at most the half
+    // width of the triangle at that height.
+    const qreal w = size.width();
+    const qreal h = size.height();
+    if (w <= 0 || h <= 0) {
+        return false;
+    }
+    const qreal dy = point.y() - position.y();
+    if (dy < 0 || dy > h) {
+        return false;
+    }
+    const qreal dx = qAbs(point.x() - position.x() - w / 2);
+    return dx * 2 * h <= dy * w;
+}
+
+QPointF TriangleShape::portPosition(Port port) const
+{
+    // The side ports sit on the middle of the slanted edges
+    const qreal w = size.width();
+    const qreal h = size.height();
+    switch (port) {
+    case RightPort:
+        return position + QPointF(w * 3 / 4, h / 2);
+    case LeftPort:
+        return position + QPointF(w / 4, h / 2);
+    default:
+        return DiagramShape::portPosition(port);
+    }
+}
+
+QPointF TriangleShape::outlinePoint(const QPointF& target) const
+{
+    // From the centre of the box the ray leaves either through the base
+    // (y = h/2 below the centre) or through a slanted edge, where the half
+    // width w/2 * (y - top) / h equals |x - cx|:
+    //   t*|dx| = w/2 * (1/2 + t*dy/h)
+    const QPointF centre = boundingRect().center();
+    const QPointF d = target - centre;
+    const qreal w = size.width();
+    const qreal h = size.height();
+    if (w <= 0 || h <= 0 || d.isNull()) {
+        return centre;
+    }
+    qreal t = std::numeric_limits<qreal>::max();
+    if (d.y() > 0) {
+        t = h / 2 / d.y();
+    }
+    const qreal slope = qAbs(d.x()) - w * d.y() / (2 * h);
+    if (slope > 0) {
+        t = qMin(t, w / 4 / slope);
+    }
+    return centre + d * t;
 }
 
 QRectF TriangleShape::boundingRect() const
@@ -365,11 +584,13 @@ QRectF TriangleShape::boundingRect() const
 void TriangleShape::moveBy(const QPointF& delta)
 {
     position += delta;
+    outline.translate(delta);
 }
 
 void TriangleShape::setSize(const QSizeF& newSize)
 {
     size = newSize;
+    updateOutline();
 }
 
 QSizeF TriangleShape::getSize() const
@@ -387,4 +608,5 @@ void TriangleShape::load(QDataStream &in)
 {
     DiagramShape::load(in);
     in >> size;
+    updateOutline();
 }
\ No newline at end of file
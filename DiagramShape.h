@@ -2,15 +2,23 @@
 
 #include <QPainter>
 #include <QRectF>
+#include <QPolygonF>
 #include <QColor>
 #include <QFont>
 #include <QDataStream>
 #include <memory>
 #include <QString>
+#include "TextLayoutCache.h"
+#include "RenderList.h"
+
+// Stable identity of a shape within a document, assigned by ShapeStore;
+// 0 means not assigned yet
+using ShapeId = quint64;
 
 class DiagramShape {
 public:
-    enum Type {
+    // Stored as one byte, here and in ShapeStore's type column
+    enum Type : quint8 {
         None,
         Rectangle,
         Ellipse,
@@ -20,22 +28,41 @@ public:
         Text
     };
 
+    // Where a connector end attaches; AutoPort aims at the other end
+    enum Port {
+        AutoPort,
+        TopPort,
+        RightPort,
+        BottomPort,
+        LeftPort
+    };
+
     DiagramShape(Type type);
     virtual ~DiagramShape() = default;
 
-    virtual void paint(QPainter* painter) = 0;
+    // Describes the shape as primitives in a render list, which the canvas
+    // and the exporters replay in batches
+    virtual void compile(RenderList& list) const = 0;
     virtual bool contains(const QPointF& point) const = 0;
     virtual QRectF boundingRect() const = 0;
+    // Used by marquee selection; the bounding rect is exact for boxy shapes
+    virtual bool intersects(const QRectF& rect) const { return boundingRect().intersects(rect); }
+    // Attachment point of a named port; the side midpoints of the bounds
+    // unless the outline is elsewhere
+    virtual QPointF portPosition(Port port) const;
+    // Where the ray from the centre towards target crosses the outline,
+    // solved exactly per shape; the bounding box by default
+    virtual QPointF outlinePoint(const QPointF& target) const;
     virtual void moveBy(const QPointF& delta) = 0;
     virtual void setSize(const QSizeF& size) = 0;
     virtual QSizeF getSize() const = 0;
-    virtual QString getText() const { return m_text; }
-    virtual void setText(const QString& text) { m_text = text; }
+    virtual QString getText() const { return labelText(); }
+    virtual void setText(const QString& text);
 
     virtual void save(QDataStream& out) const;
     virtual void load(QDataStream& in);
 
-    void setPos(const QPointF& pos) { position = pos; }
+    void setPos(const QPointF& pos) { position = pos; geometryChanged(); }
     QPointF getPos() const { return position; }
 
     void setSelected(bool selected) { isSelected = selected; }
@@ -52,19 +79,58 @@ public:
 
     Type getType() const { return type; }
 
+    ShapeId getId() const { return id; }
+    void setId(ShapeId newId) { id = newId; }
+
     static std::shared_ptr<DiagramShape> createShape(Type type);
+    // A copy another thread can read while this one is edited, e.g. to
+    // encode it. Members are implicitly shared, so this is cheap; the
+    // label's layout is not copied.
+    std::shared_ptr<DiagramShape> clone() const;
 
 protected:
+    DiagramShape(const DiagramShape& other);
+    DiagramShape& operator=(const DiagramShape&) = delete;
+
+    // Label text and its shaped layout, reused across repaints until text,
+    // font or width change. Kept out of line, so shapes without a label
+    // pay one pointer for it.
+    struct Label {
+        QString text;
+        TextLayoutCache layout;
+    };
+
     QPointF position;
     QColor shapeColor;
     QColor lineColor;
+    ShapeId id = 0;
+    std::unique_ptr<Label> m_label;
     int lineWidth = 1;
-    bool isSelected = false;
     Type type;
-    QString m_text;
+    bool isSelected = false;
 
-    void paintSelectionHandles(QPainter* painter, const QRectF& rect) const;
-    void paintText(QPainter* painter, const QRectF& rect) const;
+    // Empty when the shape has no label
+    const QString& labelText() const;
+    // Only called for shapes with a label
+    TextLayoutCache* textLayout() const { return &m_label->layout; }
+    void invalidateTextLayout() { if (m_label) m_label->layout.invalidate(); }
+
+    // Called after position changes through setPos so subclasses can
+    // refresh cached geometry
+    virtual void geometryChanged() {}
+
+    // Selected, and the list is one that shows the selection
+    bool showSelection(const RenderList& list) const { return isSelected && list.drawSelection(); }
+    void compileSelectionHandles(RenderList& list, const QRectF& rect) const;
+    void compileText(RenderList& list, const QRectF& rect) const;
+
+    // Handles, arrowheads and other decorations are dropped when zoomed out
+    static bool showDecorations(const RenderList& list);
+    // Text smaller than a few pixels on screen is not worth shaping
+    static bool isTextReadable(const RenderList& list, const QFont& font);
+    // Adds a shape that covers only a few pixels as a plain box; returns
+    // false when the shape is large enough to be drawn normally
+    bool compilePlaceholder(RenderList& list, const QRectF& rect) const;
 };
 
 // 下面的四个形状你可以照这个格式再定义 EllipseShape / DiamondShape / TriangleShape
@@ -72,7 +138,7 @@ protected:
 class RectangleShape : public DiagramShape {
 public:
     RectangleShape();
-    void paint(QPainter* painter) override;
+    void compile(RenderList& list) const override;
     bool contains(const QPointF& point) const override;
     QRectF boundingRect() const override;
     void moveBy(const QPointF& delta) override;
@@ -88,8 +154,9 @@ private:
 class EllipseShape : public DiagramShape {
 public:
     EllipseShape();
-    void paint(QPainter* painter) override;
+    void compile(RenderList& list) const override;
     bool contains(const QPointF& point) const override;
+    QPointF outlinePoint(const QPointF& target) const override;
     QRectF boundingRect() const override;
     void moveBy(const QPointF& delta) override;
     void setSize(const QSizeF& newSize) override;
@@ -104,8 +171,9 @@ private:
 class DiamondShape : public DiagramShape {
 public:
     DiamondShape();
-    void paint(QPainter* painter) override;
+    void compile(RenderList& list) const override;
     bool contains(const QPointF& point) const override;
+    QPointF outlinePoint(const QPointF& target) const override;
     QRectF boundingRect() const override;
     void moveBy(const QPointF& delta) override;
     void setSize(const QSizeF& newSize) override;
@@ -113,15 +181,23 @@ public:
     void save(QDataStream& out) const override;
     void load(QDataStream& in) override;
 
+protected:
+    void geometryChanged() override;
+
 private:
     QSizeF size;
+    QPolygonF outline; // cached diamond corners, rebuilt when position or size change
+
+    void updateOutline();
 };
 
 class TriangleShape : public DiagramShape {
 public:
     TriangleShape();
-    void paint(QPainter* painter) override;
+    void compile(RenderList& list) const override;
     bool contains(const QPointF& point) const override;
+    QPointF portPosition(Port port) const override;
+    QPointF outlinePoint(const QPointF& target) const override;
     QRectF boundingRect() const override;
     void moveBy(const QPointF& delta) override;
     void setSize(const QSizeF& newSize) override;
@@ -129,6 +205,12 @@ public:
     void save(QDataStream& out) const override;
     void load(QDataStream& in) override;
 
+protected:
+    void geometryChanged() override;
+
 private:
     QSizeF size;
+    QPolygonF outline; // cached triangle corners, rebuilt when position or size change
+
+    void updateOutline();
 };
@@ -0,0 +1,548 @@
+/**
+ * @file FlowFormat.cpp
+ * @brief Implementation of the version 2 .flow encoding
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "FlowFormat.h"
+#include "FlowIO.h"
+#include "ConnectorShape.h"
+#include "TextShape.h"
+#include <QtConcurrentMap>
+#include <QtEndian>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+const char kMagic[8] = { 'F', 'L', 'O', 'W', 'D', 'O', 'C', '\0' };
+const int kHeaderSize = 16;
+const int kSectionEntrySize = 24;
+
+const quint32 kDocumentTag = 0x444f434d; // "DOCM"
+const quint32 kStringsTag = 0x53545253;  // "STRS"
+const quint32 kShapesTag = 0x53485053;   // "SHPS"
+const quint32 kPointsTag = 0x504e5453;   // "PNTS"
+
+const quint32 kNoString = 0xffffffff;
+
+// Section flags
+const quint32 kZlibBlocks = 0x1;
+// Compressed sections are cut into blocks of this much raw data, which
+// are deflated and inflated independently on the pool
+const int kBlockSize = 256 * 1024;
+
+// Shape record. Connectors keep their start point in x/y and their end
+// point in w/h.
+namespace ShapeRecord {
+const int kId = 0;          // u64
+const int kType = 8;        // u8
+const int kFlags = 9;       // u8, see below
+const int kArrow = 10;      // u8
+const int kPorts = 11;      // u8, start port | end port << 4
+const int kLineWidth = 12;  // i32
+const int kFill = 16;       // u32 ARGB
+const int kLine = 20;       // u32 ARGB
+const int kTextColor = 24;  // u32 ARGB
+const int kText = 28;       // u32 string index
+const int kFont = 32;       // u32 string index
+const int kFirstPoint = 36; // u32 index into PNTS
+const int kPointCount = 40; // u32
+const int kX = 48;          // f64
+const int kY = 56;
+const int kW = 64;
+const int kH = 72;
+const int kStartShape = 80; // u64
+const int kEndShape = 88;   // u64
+const int kSize = 96;
+
+const quint8 kPinned = 0x01;
+const quint8 kOrthogonal = 0x02;
+} // namespace ShapeRecord
+
+// Records are decoded in chunks of this many per pool task
+const int kChunkSize = 1024;
+
+template <typename T>
+void store(char* at, T value)
+{
+    qToLittleEndian<T>(value, at);
+}
+
+void storeReal(char* at, qreal value)
+{
+    quint64 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    store<quint64>(at, bits);
+}
+
+template <typename T>
+T fetch(const uchar* at)
+{
+    return qFromLittleEndian<T>(at);
+}
+
+qreal fetchReal(const uchar* at)
+{
+    const quint64 bits = fetch<quint64>(at);
+    qreal value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Builds the string table while records are written
+class StringTable
+{
+public:
+    quint32 add(const QString& string)
+    {
+        if (string.isEmpty()) return kNoString;
+        auto it = m_index.constFind(string);
+        if (it != m_index.constEnd()) return it.value();
+        const quint32 index = quint32(m_offsets.size());
+        m_offsets.append(quint32(m_data.size()));
+        m_data += string.toUtf8();
+        m_index.insert(string, index);
+        return index;
+    }
+
+    QByteArray encode() const
+    {
+        QByteArray bytes(4 * (m_offsets.size() + 2), '\0');
+        store<quint32>(bytes.data(), quint32(m_offsets.size()));
+        for (int i = 0; i < m_offsets.size(); ++i) {
+            store<quint32>(bytes.data() + 4 * (i + 1), m_offsets[i]);
+        }
+        store<quint32>(bytes.data() + 4 * (m_offsets.size() + 1), quint32(m_data.size()));
+        return bytes + m_data;
+    }
+
+private:
+    QHash<QString, quint32> m_index;
+    QVector<quint32> m_offsets;
+    QByteArray m_data;
+};
+
+// Layout of a compressed section: u32 block count, u32 reserved, u64 raw
+// size, then u32 stored size and u32 raw size per block, then the blocks
+// as qCompress() wrote them
+QByteArray deflateBlocks(const QByteArray& raw)
+{
+    const int count = int((raw.size() + kBlockSize - 1) / kBlockSize);
+    QVector<QByteArray> blocks(count);
+    QByteArray* out = blocks.data();
+    QVector<int> indexes(count);
+    std::iota(indexes.begin(), indexes.end(), 0);
+    QtConcurrent::blockingMap(indexes.constBegin(), indexes.constEnd(), [&](int i) {
+        const int begin = i * kBlockSize;
+        out[i] = qCompress(reinterpret_cast<const uchar*>(raw.constData()) + begin,
+                           qMin(kBlockSize, int(raw.size()) - begin));
+    });
+
+    QByteArray bytes(16 + 8 * count, '\0');
+    store<quint32>(bytes.data(), quint32(count));
+    store<quint64>(bytes.data() + 8, quint64(raw.size()));
+    for (int i = 0; i < count; ++i) {
+        store<quint32>(bytes.data() + 16 + 8 * i, quint32(blocks[i].size()));
+        store<quint32>(bytes.data() + 20 + 8 * i, quint32(qMin(kBlockSize, int(raw.size()) - i * kBlockSize)));
+    }
+    for (const QByteArray& block : blocks) {
+        bytes += block;
+    }
+    return bytes;
+}
+
+bool inflateBlocks(const uchar* data, quint64 size, QByteArray& raw)
+{
+    if (size < 16) return false;
+    const quint32 count = fetch<quint32>(data);
+    const quint64 rawSize = fetch<quint64>(data + 8);
+    if (count > (size - 16) / 8 || rawSize > quint64(std::numeric_limits<int>::max())) return false;
+
+    // Where every block starts in the section and in the raw data
+    QVector<quint64> from(int(count));
+    QVector<quint64> to(int(count));
+    QVector<int> storedSizes(int(count));
+    QVector<int> rawSizes(int(count));
+    quint64 in = 16 + 8 * quint64(count);
+    quint64 out = 0;
+    for (int i = 0; i < int(count); ++i) {
+        const quint32 stored = fetch<quint32>(data + 16 + 8 * i);
+        const quint32 length = fetch<quint32>(data + 20 + 8 * i);
+        if (stored > size - in || length > rawSize - out) return false;
+        from[i] = in;
+        to[i] = out;
+        storedSizes[i] = int(stored);
+        rawSizes[i] = int(length);
+        in += stored;
+        out += length;
+    }
+    if (out != rawSize) return false;
+
+    raw = QByteArray(int(rawSize), Qt::Uninitialized);
+    char* target = raw.data();
+    QVector<int> indexes(int(count));
+    std::iota(indexes.begin(), indexes.end(), 0);
+    std::atomic<bool> damaged(false);
+    QtConcurrent::blockingMap(indexes.constBegin(), indexes.constEnd(), [&](int i) {
+        const QByteArray block = qUncompress(data + from[i], storedSizes[i]);
+        if (block.size() != rawSizes[i]) {
+            damaged = true;
+            return;
+        }
+        std::memcpy(target + to[i], block.constData(), size_t(block.size()));
+    });
+    return !damaged;
+}
+
+} // namespace
+
+bool FlowFormat::isVersion2(const QByteArray& head)
+{
+    return head.size() >= int(sizeof(kMagic)) && std::memcmp(head.constData(), kMagic, sizeof(kMagic)) == 0;
+}
+
+QByteArray FlowFormat::encode(const FlowDocument& document, bool compress)
+{
+    using namespace ShapeRecord;
+
+    const auto& shapes = document.shapes;
+    StringTable strings;
+    QByteArray records(8 + qsizetype(shapes.size()) * kSize, '\0');
+    store<quint32>(records.data(), quint32(shapes.size()));
+    store<quint32>(records.data() + 4, quint32(kSize));
+    QByteArray points;
+
+    char* record = records.data() + 8;
+    for (const auto& shape : shapes) {
+        store<quint64>(record + kId, shape->getId());
+        store<quint8>(record + kType, quint8(shape->getType()));
+        quint8 flags = document.pinned.contains(shape->getId()) ? kPinned : 0;
+        store<qint32>(record + kLineWidth, shape->getLineWidth());
+        store<quint32>(record + kFill, shape->getColor().rgba());
+        store<quint32>(record + kLine, shape->getLineColor().rgba());
+        store<quint32>(record + kText, strings.add(shape->getText()));
+        store<quint32>(record + kFont, kNoString);
+
+        if (shape->getType() == DiagramShape::Connector) {
+            const auto* connector = static_cast<const ConnectorShape*>(shape.get());
+            if (connector->getRoutingStyle() == ConnectorShape::Orthogonal) {
+                flags |= kOrthogonal;
+            }
+            store<quint8>(record + kArrow, quint8(connector->getArrowStyle()));
+            store<quint8>(record + kPorts, quint8(connector->getStartPort() | connector->getEndPort() << 4));
+            const QVector<QPointF> bends = connector->getControlPoints();
+            store<quint32>(record + kFirstPoint, quint32(points.size() / 16));
+            store<quint32>(record + kPointCount, quint32(bends.size()));
+            for (const QPointF& point : bends) {
+                char pair[16];
+                storeReal(pair, point.x());
+                storeReal(pair + 8, point.y());
+                points.append(pair, sizeof(pair));
+            }
+            storeReal(record + kX, connector->getStartPoint().x());
+            storeReal(record + kY, connector->getStartPoint().y());
+            storeReal(record + kW, connector->getEndPoint().x());
+            storeReal(record + kH, connector->getEndPoint().y());
+            store<quint64>(record + kStartShape, connector->getStartShape());
+            store<quint64>(record + kEndShape, connector->getEndShape());
+        }
+        else {
+            const QRectF bounds(shape->getPos(), shape->getSize());
+            storeReal(record + kX, bounds.x());
+            storeReal(record + kY, bounds.y());
+            storeReal(record + kW, bounds.width());
+            storeReal(record + kH, bounds.height());
+            if (shape->getType() == DiagramShape::Text) {
+                const auto* text = static_cast<const TextShape*>(shape.get());
+                store<quint32>(record + kTextColor, text->getTextColor().rgba());
+                store<quint32>(record + kFont, strings.add(text->getFont().toString()));
+            }
+        }
+        store<quint8>(record + kFlags, flags);
+        record += kSize;
+    }
+
+    QByteArray documentSection(16, '\0');
+    store<quint64>(documentSection.data(), document.backgroundColor.rgba64());
+    store<qint32>(documentSection.data() + 8, document.canvasSize.width());
+    store<qint32>(documentSection.data() + 12, document.canvasSize.height());
+
+    struct Section {
+        quint32 tag;
+        quint32 flags;
+        QByteArray data;
+    };
+    QVector<Section> sections = {
+        { kDocumentTag, 0, documentSection },
+        { kStringsTag, 0, strings.encode() },
+        { kShapesTag, 0, records },
+        { kPointsTag, 0, points }
+    };
+    if (compress) {
+        for (Section& section : sections) {
+            // Kept as it is when deflating does not pay, e.g. tiny sections
+            QByteArray packed = deflateBlocks(section.data);
+            if (packed.size() < section.data.size()) {
+                section.data = packed;
+                section.flags = kZlibBlocks;
+            }
+        }
+    }
+
+    QByteArray header(kHeaderSize + sections.size() * kSectionEntrySize, '\0');
+    std::memcpy(header.data(), kMagic, sizeof(kMagic));
+    store<quint16>(header.data() + 8, kVersion);
+    store<quint16>(header.data() + 10, quint16(sections.size()));
+    quint64 offset = header.size();
+    for (int i = 0; i < sections.size(); ++i) {
+        char* entry = header.data() + kHeaderSize + i * kSectionEntrySize;
+        store<quint32>(entry, sections[i].tag);
+        store<quint32>(entry + 4, sections[i].flags);
+        store<quint64>(entry + 8, offset);
+        store<quint64>(entry + 16, quint64(sections[i].data.size()));
+        offset += sections[i].data.size();
+    }
+
+    QByteArray bytes;
+    bytes.reserve(qsizetype(offset));
+    bytes += header;
+    for (const Section& section : sections) {
+        bytes += section.data;
+    }
+    return bytes;
+}
+
+bool FlowFormat::Reader::open(const QByteArray& data)
+{
+    m_data = data;
+    if (m_data.size() < kHeaderSize || !isVersion2(m_data)) return false;
+    const auto* bytes = reinterpret_cast<const uchar*>(m_data.constData());
+    // A later major version may lay things out differently altogether
+    if (fetch<quint16>(bytes + 8) != kVersion) return false;
+    const int sectionCount = fetch<quint16>(bytes + 10);
+    if (m_data.size() < kHeaderSize + sectionCount * kSectionEntrySize) return false;
+    m_sections.clear();
+    m_inflated.clear();
+    for (int i = 0; i < sectionCount; ++i) {
+        const uchar* entry = bytes + kHeaderSize + i * kSectionEntrySize;
+        const quint32 flags = fetch<quint32>(entry + 4);
+        const quint64 offset = fetch<quint64>(entry + 8);
+        const quint64 size = fetch<quint64>(entry + 16);
+        if (offset > quint64(m_data.size()) || size > quint64(m_data.size()) - offset) return false;
+
+        Section section = { fetch<quint32>(entry), bytes + offset, size };
+        if (flags == kZlibBlocks) {
+            QByteArray raw;
+            if (!inflateBlocks(section.data, section.size, raw)) return false;
+            section.data = reinterpret_cast<const uchar*>(raw.constData());
+            section.size = quint64(raw.size());
+            m_inflated.append(raw);
+        }
+        else if (flags != 0) {
+            // Encoded in a way this version does not know
+            return false;
+        }
+        m_sections.append(section);
+    }
+
+    quint64 size = 0;
+    const uchar* document = section(kDocumentTag, &size);
+    if (!document || size < 16) return false;
+    m_backgroundColor = QColor(QRgba64::fromRgba64(fetch<quint64>(document)));
+    m_canvasSize = QSize(fetch<qint32>(document + 8), fetch<qint32>(document + 12));
+
+    const uchar* strings = section(kStringsTag, &size);
+    if (!strings || !readStrings(strings, size)) return false;
+
+    m_records = section(kShapesTag, &size);
+    if (!m_records || size < 8) return false;
+    const quint32 count = fetch<quint32>(m_records);
+    m_recordSize = int(fetch<quint32>(m_records + 4));
+    m_records += 8;
+    if (m_recordSize < ShapeRecord::kSize || count > (size - 8) / quint64(m_recordSize)) return false;
+    m_shapeCount = int(count);
+
+    m_points = section(kPointsTag, &size);
+    m_pointCount = m_points ? size / 16 : 0;
+
+    // Only a handful of distinct fonts, however many text shapes use them
+    m_fonts.clear();
+    for (int i = 0; i < m_shapeCount; ++i) {
+        const uchar* record = m_records + qsizetype(i) * m_recordSize;
+        if (record[ShapeRecord::kType] != DiagramShape::Text) continue;
+        const quint32 font = fetch<quint32>(record + ShapeRecord::kFont);
+        if (font < quint32(m_strings.size()) && !m_fonts.contains(font)) {
+            QFont decoded;
+            decoded.fromString(m_strings[font]);
+            m_fonts.insert(font, decoded);
+        }
+    }
+    return true;
+}
+
+const uchar* FlowFormat::Reader::section(quint32 tag, quint64* size) const
+{
+    for (const Section& section : m_sections) {
+        if (section.tag == tag) {
+            *size = section.size;
+            return section.data;
+        }
+    }
+    return nullptr;
+}
+
+bool FlowFormat::Reader::readStrings(const uchar* data, quint64 size)
+{
+    if (size < 4) return false;
+    const quint32 count = fetch<quint32>(data);
+    if (quint64(count) + 2 > size / 4) return false;
+    const uchar* offsets = data + 4;
+    const char* text = reinterpret_cast<const char*>(offsets + 4 * (count + 1));
+    const quint64 textSize = size - 4 * (quint64(count) + 2);
+
+    m_strings.clear();
+    m_strings.reserve(int(count));
+    for (quint32 i = 0; i < count; ++i) {
+        const quint32 begin = fetch<quint32>(offsets + 4 * i);
+        const quint32 end = fetch<quint32>(offsets + 4 * (i + 1));
+        if (begin > end || end > textSize) return false;
+        m_strings.append(QString::fromUtf8(text + begin, int(end - begin)));
+    }
+    return true;
+}
+
+std::shared_ptr<DiagramShape> FlowFormat::Reader::shape(int index) const
+{
+    using namespace ShapeRecord;
+
+    if (index < 0 || index >= m_shapeCount) return nullptr;
+    const uchar* record = m_records + qsizetype(index) * m_recordSize;
+    const int type = record[kType];
+    if (type <= DiagramShape::None || type > DiagramShape::Text) return nullptr;
+    auto shape = DiagramShape::createShape(DiagramShape::Type(type));
+    if (!shape) return nullptr;
+
+    auto string = [this](quint32 at) {
+        return at < quint32(m_strings.size()) ? m_strings[int(at)] : QString();
+    };
+    const quint8 flags = record[kFlags];
+    shape->setId(fetch<quint64>(record + kId));
+    shape->setLineWidth(fetch<qint32>(record + kLineWidth));
+    shape->setColor(QColor::fromRgba(fetch<quint32>(record + kFill)));
+    shape->setLineColor(QColor::fromRgba(fetch<quint32>(record + kLine)));
+    shape->setText(string(fetch<quint32>(record + kText)));
+
+    const QPointF first(fetchReal(record + kX), fetchReal(record + kY));
+    const QPointF second(fetchReal(record + kW), fetchReal(record + kH));
+    if (type == DiagramShape::Connector) {
+        auto* connector = static_cast<ConnectorShape*>(shape.get());
+        const quint32 firstPoint = fetch<quint32>(record + kFirstPoint);
+        const quint32 pointCount = fetch<quint32>(record + kPointCount);
+        if (firstPoint > m_pointCount || pointCount > m_pointCount - firstPoint) return nullptr;
+        QVector<QPointF> bends(int(pointCount));
+        for (quint32 i = 0; i < pointCount; ++i) {
+            const uchar* pair = m_points + 16 * (quint64(firstPoint) + i);
+            bends[int(i)] = QPointF(fetchReal(pair), fetchReal(pair + 8));
+        }
+        connector->setRoute(first, bends, second);
+        connector->setArrowStyle(ConnectorShape::ArrowStyle(record[kArrow] & 0x3));
+        auto portOf = [](int port) {
+            return port <= DiagramShape::LeftPort ? DiagramShape::Port(port) : DiagramShape::AutoPort;
+        };
+        connector->setStartBinding(fetch<quint64>(record + kStartShape), portOf(record[kPorts] & 0x0f));
+        connector->setEndBinding(fetch<quint64>(record + kEndShape), portOf(record[kPorts] >> 4));
+        if (flags & kOrthogonal) {
+            connector->setRoutingStyle(ConnectorShape::Orthogonal);
+        }
+    }
+    else {
+        shape->setPos(first);
+        if (type == DiagramShape::Text) {
+            auto* text = static_cast<TextShape*>(shape.get());
+            // Before the size, which setFont() may recompute
+            text->setFont(m_fonts.value(fetch<quint32>(record + kFont), text->getFont()));
+            text->setTextColor(QColor::fromRgba(fetch<quint32>(record + kTextColor)));
+        }
+        shape->setSize(QSizeF(second.x(), second.y()));
+    }
+    return shape;
+}
+
+QRectF FlowFormat::Reader::bounds(int index) const
+{
+    using namespace ShapeRecord;
+
+    if (index < 0 || index >= m_shapeCount) return QRectF();
+    const uchar* record = m_records + qsizetype(index) * m_recordSize;
+    const QPointF first(fetchReal(record + kX), fetchReal(record + kY));
+    const QPointF second(fetchReal(record + kW), fetchReal(record + kH));
+    if (record[kType] == DiagramShape::Connector) {
+        return QRectF(first, second).normalized();
+    }
+    return QRectF(first, QSizeF(second.x(), second.y()));
+}
+
+bool FlowFormat::Reader::isPinned(int index) const
+{
+    using namespace ShapeRecord;
+
+    if (index < 0 || index >= m_shapeCount) return false;
+    return m_records[qsizetype(index) * m_recordSize + kFlags] & kPinned;
+}
+
+ShapeId FlowFormat::Reader::highestId() const
+{
+    ShapeId highest = 0;
+    for (int i = 0; i < m_shapeCount; ++i) {
+        highest = qMax(highest, fetch<quint64>(m_records + qsizetype(i) * m_recordSize + ShapeRecord::kId));
+    }
+    return highest;
+}
+
+bool FlowFormat::Reader::decode(const QVector<int>& indexes, QVector<std::shared_ptr<DiagramShape>>& shapes) const
+{
+    shapes.resize(indexes.size());
+    // Each task fills its own slice of shapes, so the vector is detached
+    // once here and never touched structurally by the workers
+    std::shared_ptr<DiagramShape>* out = shapes.data();
+    QVector<int> chunks;
+    for (int start = 0; start < indexes.size(); start += kChunkSize) {
+        chunks.append(start);
+    }
+    std::atomic<bool> damaged(false);
+    const int end = indexes.size();
+    QtConcurrent::blockingMap(chunks.constBegin(), chunks.constEnd(), [&](int start) {
+        for (int i = start; i < qMin(start + kChunkSize, end); ++i) {
+            out[i] = shape(indexes[i]);
+            if (!out[i]) {
+                damaged = true;
+            }
+        }
+    });
+    return !damaged;
+}
+
+bool FlowFormat::decode(const QByteArray& data, FlowDocument& document)
+{
+    Reader reader;
+    if (!reader.open(data)) return false;
+    QVector<int> indexes(reader.shapeCount());
+    std::iota(indexes.begin(), indexes.end(), 0);
+    QVector<std::shared_ptr<DiagramShape>> shapes;
+    if (!reader.decode(indexes, shapes)) return false;
+
+    document.backgroundColor = reader.backgroundColor();
+    document.canvasSize = reader.canvasSize();
+    document.shapes = QList<std::shared_ptr<DiagramShape>>(shapes.constBegin(), shapes.constEnd());
+    document.pinned.clear();
+    for (int i = 0; i < reader.shapeCount(); ++i) {
+        if (reader.isPinned(i)) {
+            document.pinned.insert(shapes[i]->getId());
+        }
+    }
+    return true;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file FlowFormat.h
+ * @brief Chunked, indexed binary encoding of .flow documents (version 2)
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QByteArray>
+#include <QColor>
+#include <QFont>
+#include <QHash>
+#include <QRectF>
+#include <QSize>
+#include <QString>
+#include <QVector>
+#include <memory>
+#include "DiagramShape.h"
+
+struct FlowDocument;
+
+// Version 2 of the .flow format. Version 1 is a QDataStream sequence that
+// can only be parsed front to back; version 2 is laid out so any shape can
+// be found without reading the ones before it:
+//
+//   header         magic "FLOWDOC\0", u16 version, u16 section count,
+//                  u32 reserved
+//   section table  per section: u32 tag, u32 flags, u64 offset, u64 size
+//   "DOCM"         background colour (rgba64), canvas width and height
+//   "STRS"         string table: u32 count, count + 1 u32 offsets into the
+//                  UTF-8 data that follows; labels and font names are
+//                  stored once however many shapes use them
+//   "SHPS"         u32 count, u32 record size, then one fixed-size record
+//                  per shape in paint order (see ShapeRecord in the .cpp)
+//   "PNTS"         connector control points as pairs of f64, referred to
+//                  by offset and count from the records
+//
+// A section may be stored compressed (flag 0x1): its data is then cut
+// into 256 KiB blocks deflated independently with qCompress(), which
+// writers and readers process in parallel on the global pool. Offsets
+// inside a section always refer to the inflated data.
+//
+// Everything is little-endian. Records carry the shape ids, and bindings
+// refer to those directly. Readers skip sections they do not know and
+// use the record size from the file as the stride, so both can grow
+// without breaking older readers.
+class FlowFormat
+{
+public:
+    static const quint16 kVersion = 2;
+
+    // True if the data starts with the version 2 magic (needs 8 bytes)
+    static bool isVersion2(const QByteArray& head);
+    static QByteArray encode(const FlowDocument& document, bool compress = true);
+
+    // Random access to an encoded document. The data is not copied and
+    // must outlive the reader.
+    class Reader
+    {
+    public:
+        bool open(const QByteArray& data);
+
+        QColor backgroundColor() const { return m_backgroundColor; }
+        QSize canvasSize() const { return m_canvasSize; }
+        int shapeCount() const { return m_shapeCount; }
+
+        // Decodes the record at index; null if it is damaged. Safe to call
+        // from several threads at once.
+        std::shared_ptr<DiagramShape> shape(int index) const;
+        // Decodes the records at indexes into shapes (resized to match),
+        // in parallel on the global thread pool. Returns false if any
+        // record is damaged.
+        bool decode(const QVector<int>& indexes, QVector<std::shared_ptr<DiagramShape>>& shapes) const;
+
+        // Read straight from the records without decoding the shapes. A
+        // connector's bounds span its ends only.
+        QRectF bounds(int index) const;
+        // The pin is a document property kept by the canvas' store, so it
+        // is read from the record rather than set on the shape
+        bool isPinned(int index) const;
+        ShapeId highestId() const;
+
+    private:
+        struct Section {
+            quint32 tag;
+            const uchar* data;
+            quint64 size;
+        };
+
+        const uchar* section(quint32 tag, quint64* size) const;
+        bool readStrings(const uchar* data, quint64 size);
+
+        QByteArray m_data;
+        QVector<Section> m_sections;
+        // Compressed sections, inflated; m_sections points into these
+        QVector<QByteArray> m_inflated;
+        QColor m_backgroundColor;
+        QSize m_canvasSize;
+        QVector<QString> m_strings;
+        // Decoded up front, so workers only copy them
+        QHash<quint32, QFont> m_fonts;
+        const uchar* m_records = nullptr;
+        int m_shapeCount = 0;
+        int m_recordSize = 0;
+        const uchar* m_points = nullptr;
+        quint64 m_pointCount = 0;
+    };
+
+    // Loads the whole document, decoding the shapes in parallel
+    static bool decode(const QByteArray& data, FlowDocument& document);
+};
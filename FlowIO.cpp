@@ -6,54 +6,102 @@
  */
 
 #include "FlowIO.h"
+#include "FlowFormat.h"
 #include "DiagramCanvas.h"
 #include "DiagramShape.h"
+#include "ConnectorShape.h"
 #include <QFile>
+#include <QSaveFile>
 #include <QDataStream>
 #include <QColor>
 #include <QSize>
+#include <numeric>
 
-bool FlowIO::save(const QString& filename, DiagramCanvas* canvas)
-{
-    QFile file(filename);
-    if (!file.open(QIODevice::WriteOnly)) {
-        return false;
-    }
+namespace {
 
-    QDataStream stream(&file);
-    stream.setVersion(QDataStream::Qt_5_12);
+// Version 1 only. Optional section after the shapes: which shapes
+// connector ends are attached to. Readers that predate it stop after the
+// shapes.
+const quint32 kBindingsTag = 0x42494e44; // "BIND"
+// Optional section listing the connectors routed orthogonally
+const quint32 kRoutingTag = 0x524f5554; // "ROUT"
+// Optional section listing the pinned shapes
+const quint32 kPinsTag = 0x50494e53; // "PINS"
 
-    // Write file header
-    stream << QString("FLOWCHART");
-    stream << 1; // version
+// Shapes per batch handed to loadInBatches() callers. The first batch of
+// a file is smaller, so something shows up at once.
+const int kBatchSize = 4096;
+const int kFirstBatchSize = 512;
 
-    // Write canvas properties
-    QColor backgroundColor = canvas->backgroundColor();  // assumes getter exists
-    QSize canvasSize = canvas->canvasSize();             // assumes getter exists
+qreal paintKey(int index, int count)
+{
+    return qreal(index) / count - 1;
+}
 
-    stream << backgroundColor;
-    stream << canvasSize;
+} // namespace
 
-    // Write number of shapes
-    auto& shapes = canvas->allShapes();
-    stream << shapes.size();
+bool FlowIO::save(const QString& filename, DiagramCanvas* canvas, bool compress)
+{
+    FlowDocument document;
+    document.backgroundColor = canvas->backgroundColor();
+    document.canvasSize = canvas->canvasSize();
+    document.shapes = canvas->allShapes();
+    document.pinned = canvas->pinnedShapes();
+    return save(filename, document, compress);
+}
 
-    // Write each shape
-    for (const auto& shape : shapes) {
-        shape->save(stream);
+bool FlowIO::load(const QString& filename, DiagramCanvas* canvas)
+{
+    FlowDocument document;
+    if (!load(filename, document)) {
+        return false;
     }
 
-    file.close();
+    canvas->setBackgroundColor(document.backgroundColor);
+    canvas->setCanvasSize(document.canvasSize);
+    canvas->setAllShapes(document.shapes, document.pinned);
     return true;
 }
 
-bool FlowIO::load(const QString& filename, DiagramCanvas* canvas)
+bool FlowIO::save(const QString& filename, const FlowDocument& document, bool compress)
+{
+    // Written beside the file and renamed over it once complete, so a
+    // failed or interrupted save leaves the previous version intact
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    // Always the current version; version 1 is only read
+    const QByteArray bytes = FlowFormat::encode(document, compress);
+    if (file.write(bytes) != bytes.size()) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+bool FlowIO::load(const QString& filename, FlowDocument& document)
 {
     QFile file(filename);
     if (!file.open(QIODevice::ReadOnly)) {
         return false;
     }
 
+    if (FlowFormat::isVersion2(file.peek(8))) {
+        // Decoded straight from the mapped file where possible
+        QByteArray data;
+        if (uchar* mapped = file.map(0, file.size())) {
+            data = QByteArray::fromRawData(reinterpret_cast<const char*>(mapped), int(file.size()));
+        }
+        else {
+            data = file.readAll();
+        }
+        const bool decoded = FlowFormat::decode(data, document);
+        file.close();
+        return decoded;
+    }
+
     QDataStream stream(&file);
     stream.setVersion(QDataStream::Qt_5_12);
 
@@ -70,35 +118,210 @@ bool FlowIO::load(const QString& filename, DiagramCanvas* canvas)
     stream >> version;
 
     // Read canvas properties
-    QColor backgroundColor;
-    QSize canvasSize;
-
-    stream >> backgroundColor;
-    stream >> canvasSize;
+    stream >> document.backgroundColor;
+    stream >> document.canvasSize;
 
-    // Set canvas background and size (assumes public setter methods)
-    canvas->setBackgroundColor(backgroundColor);
-    canvas->setCanvasSize(canvasSize);
-
-    // Clear current canvas
-    canvas->clear();
-
-    // Read number of shapes
-    int shapeCount;
+    // Read number of shapes. Qt 6 builds wrote the count as a 64-bit
+    // qsizetype, whose high half reads as 0 here; the low half follows
+    // unless an empty Qt 5 document went straight on to a section tag.
+    // Connectors' point counts in those documents are 64-bit as well.
+    qint32 shapeCount;
     stream >> shapeCount;
+    bool wideCounts = false;
+    if (shapeCount == 0 && !stream.atEnd()) {
+        const qint64 next = file.pos();
+        quint32 low;
+        stream >> low;
+        if (low == kBindingsTag || low == kRoutingTag || low == kPinsTag) {
+            file.seek(next);
+        }
+        else {
+            shapeCount = qint32(low);
+            wideCounts = true;
+        }
+    }
 
     // Read each shape
+    document.shapes.clear();
+    document.pinned.clear();
     for (int i = 0; i < shapeCount; ++i) {
+        // The type leads the shape's own record, so peek at it and rewind
+        // before the shape loads itself (same as pasting)
+        const qint64 start = file.pos();
         int type;
         stream >> type;
 
         auto shape = DiagramShape::createShape((DiagramShape::Type)type);
-        if (shape) {
+        if (!shape) {
+            file.close();
+            return false;
+        }
+        file.seek(start);
+        if (wideCounts && shape->getType() == DiagramShape::Connector) {
+            static_cast<ConnectorShape*>(shape.get())->load(stream, true);
+        }
+        else {
             shape->load(stream);
-            canvas->addShape(shape);
+        }
+        // Ids are local to the document; the canvas' store keeps them
+        shape->setId(ShapeId(i + 1));
+        document.shapes.append(shape);
+    }
+
+    // Optional sections, skipped by older readers
+    while (!stream.atEnd() && stream.status() == QDataStream::Ok) {
+        quint32 tag;
+        stream >> tag;
+        if (tag == kBindingsTag) {
+            qint32 count;
+            stream >> count;
+            for (qint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+                qint32 connectorIndex, startIndex, startPort, endIndex, endPort;
+                stream >> connectorIndex >> startIndex >> startPort >> endIndex >> endPort;
+                if (connectorIndex < 0 || connectorIndex >= document.shapes.size()
+                    || document.shapes[connectorIndex]->getType() != DiagramShape::Connector) {
+                    continue;
+                }
+                auto* connector = static_cast<ConnectorShape*>(document.shapes[connectorIndex].get());
+                auto idOf = [&document](qint32 index) {
+                    return index >= 0 && index < document.shapes.size() ? document.shapes[index]->getId() : ShapeId(0);
+                };
+                auto portOf = [](qint32 port) {
+                    return port >= DiagramShape::AutoPort && port <= DiagramShape::LeftPort
+                        ? DiagramShape::Port(port) : DiagramShape::AutoPort;
+                };
+                connector->setStartBinding(idOf(startIndex), portOf(startPort));
+                connector->setEndBinding(idOf(endIndex), portOf(endPort));
+            }
+        }
+        else if (tag == kRoutingTag) {
+            qint32 count;
+            stream >> count;
+            for (qint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+                qint32 index;
+                stream >> index;
+                if (index >= 0 && index < document.shapes.size()
+                    && document.shapes[index]->getType() == DiagramShape::Connector) {
+                    static_cast<ConnectorShape*>(document.shapes[index].get())->setRoutingStyle(ConnectorShape::Orthogonal);
+                }
+            }
+        }
+        else if (tag == kPinsTag) {
+            qint32 count;
+            stream >> count;
+            for (qint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+                qint32 index;
+                stream >> index;
+                if (index >= 0 && index < document.shapes.size()) {
+                    document.pinned.insert(document.shapes[index]->getId());
+                }
+            }
+        }
+        else {
+            // Written by a newer version; the rest cannot be interpreted
+            break;
         }
     }
 
     file.close();
-    return true;
-}
\ No newline at end of file
+    return stream.status() == QDataStream::Ok;
+}
+
+bool FlowIO::loadInBatches(const QString& filename, const QRectF& priorityArea,
+                           const OpenedCallback& onOpened, const BatchCallback& onBatch,
+                           const std::atomic<bool>* cancelled)
+{
+    auto isCancelled = [cancelled]() { return cancelled && cancelled->load(); };
+    using Decoder = std::function<bool(const QVector<int>& indexes, QVector<std::shared_ptr<DiagramShape>>& shapes)>;
+    using PinnedTest = std::function<bool(int index)>;
+
+    // Hands the shapes over in the given order of file indexes
+    auto deliver = [&](const QVector<int>& order, const Decoder& decode, const PinnedTest& isPinned) {
+        const int count = order.size();
+        int done = 0;
+        while (done < count) {
+            if (isCancelled()) return false;
+            const int size = qMin(done == 0 ? kFirstBatchSize : kBatchSize, count - done);
+            const QVector<int> slice = order.mid(done, size);
+            QVector<std::shared_ptr<DiagramShape>> shapes;
+            if (!decode(slice, shapes)) return false;
+
+            Batch batch;
+            batch.shapes = QList<std::shared_ptr<DiagramShape>>(shapes.constBegin(), shapes.constEnd());
+            batch.keys.reserve(size);
+            batch.pinned.reserve(size);
+            for (int index : slice) {
+                batch.keys.append(paintKey(index, count));
+                batch.pinned.append(isPinned(index));
+            }
+            done += size;
+            batch.loaded = done;
+            onBatch(batch);
+        }
+        return !isCancelled();
+    };
+
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    if (!FlowFormat::isVersion2(file.peek(8))) {
+        file.close();
+        FlowDocument document;
+        if (!load(filename, document) || isCancelled()) return false;
+        QList<std::shared_ptr<DiagramShape>> shapes;
+        shapes.swap(document.shapes);
+        ShapeId highest = 0;
+        for (const auto& shape : shapes) {
+            highest = qMax(highest, shape->getId());
+        }
+        onOpened(document, int(shapes.size()), highest);
+
+        QVector<int> order(shapes.size());
+        std::iota(order.begin(), order.end(), 0);
+        return deliver(order, [&shapes](const QVector<int>& indexes, QVector<std::shared_ptr<DiagramShape>>& out) {
+            for (int index : indexes) {
+                out.append(shapes[index]);
+            }
+            return true;
+        }, [&shapes, &document](int index) {
+            return document.pinned.contains(shapes[index]->getId());
+        });
+    }
+
+    QByteArray data;
+    if (uchar* mapped = file.map(0, file.size())) {
+        data = QByteArray::fromRawData(reinterpret_cast<const char*>(mapped), int(file.size()));
+    }
+    else {
+        data = file.readAll();
+    }
+    FlowFormat::Reader reader;
+    if (!reader.open(data)) return false;
+
+    FlowDocument document;
+    document.backgroundColor = reader.backgroundColor();
+    document.canvasSize = reader.canvasSize();
+    onOpened(document, reader.shapeCount(), reader.highestId());
+
+    // What is in view first, then the rest in file order. Only the fixed
+    // records are read for this, no shape is decoded.
+    QVector<int> order;
+    QVector<int> later;
+    order.reserve(reader.shapeCount());
+    for (int i = 0; i < reader.shapeCount(); ++i) {
+        if (reader.bounds(i).intersects(priorityArea)) {
+            order.append(i);
+        }
+        else {
+            later.append(i);
+        }
+    }
+    order += later;
+    return deliver(order, [&reader](const QVector<int>& indexes, QVector<std::shared_ptr<DiagramShape>>& shapes) {
+        return reader.decode(indexes, shapes);
+    }, [&reader](int index) {
+        return reader.isPinned(index);
+    });
+}
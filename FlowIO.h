@@ -7,12 +7,63 @@
 
 #pragma once
 #include <QString>
+#include <QColor>
+#include <QSize>
+#include <QList>
+#include <QRectF>
+#include <QSet>
+#include <QVector>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include "DiagramShape.h"
 
 class DiagramCanvas;
 
+// A diagram as stored in a .flow file, independent of any widget. Used by
+// the canvas overloads below and by the headless batch exporter.
+struct FlowDocument
+{
+    QColor backgroundColor = Qt::white;
+    QSize canvasSize = QSize(1200, 800);
+    QList<std::shared_ptr<DiagramShape>> shapes; // in paint order
+    QSet<ShapeId> pinned; // ids of the shapes a force layout leaves alone
+};
+
+// Saving always writes the indexed version 2 format (see FlowFormat);
+// loading accepts both that and the sequential version 1 stream.
 class FlowIO
 {
 public:
-    static bool save(const QString& filename, DiagramCanvas* canvas);
+    // compress stores the sections as independently deflated blocks
+    static bool save(const QString& filename, DiagramCanvas* canvas, bool compress = true);
     static bool load(const QString& filename, DiagramCanvas* canvas);
-};
\ No newline at end of file
+
+    static bool save(const QString& filename, const FlowDocument& document, bool compress = true);
+    static bool load(const QString& filename, FlowDocument& document);
+
+    // Shapes handed over by loadInBatches(). They arrive out of paint
+    // order, so each comes with its paint-order key, in [-1, 0) - below
+    // anything the user adds while the rest is still loading.
+    struct Batch {
+        QList<std::shared_ptr<DiagramShape>> shapes;
+        QVector<qreal> keys;
+        QVector<bool> pinned;
+        int loaded = 0; // shapes delivered so far, this batch included
+    };
+    // Called once before the first batch: the document without shapes,
+    // how many there will be and the highest id among them
+    using OpenedCallback = std::function<void(const FlowDocument& document, int shapeCount, ShapeId highestId)>;
+    using BatchCallback = std::function<void(const Batch& batch)>;
+
+    // Loads a document piecewise, for the GUI to show while the rest is
+    // read. Runs on any thread and calls back on that thread. Version 2
+    // files deliver the shapes within priorityArea first, decoded straight
+    // from the file; version 1 files can only be parsed front to back and
+    // bind connectors at the very end, so they are read whole and then
+    // handed over in the same batches. Returns false if the file could
+    // not be read or loading was cancelled.
+    static bool loadInBatches(const QString& filename, const QRectF& priorityArea,
+                              const OpenedCallback& onOpened, const BatchCallback& onBatch,
+                              const std::atomic<bool>* cancelled = nullptr);
+};
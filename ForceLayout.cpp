@@ -0,0 +1,267 @@
+/**
+ * @file ForceLayout.cpp
+ * @brief Implementation of the force-directed layout
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "ForceLayout.h"
+#include <QtConcurrentMap>
+#include <QtMath>
+#include <algorithm>
+
+namespace {
+
+// Cells smaller than this fraction of their distance count as one body
+const qreal kTheta = 0.8;
+// Pull towards the centre, per unit of distance
+const qreal kGravity = 0.02;
+const qreal kCooling = 0.98;
+// Done once no node moves more than this fraction of the ideal length
+const qreal kConvergence = 0.005;
+// Bodies closer than this (after subtracting their sizes) repel as if
+// they were this far apart
+const qreal kMinGap = 1.0;
+// Coincident bodies stop splitting cells here and share a leaf
+const int kMaxDepth = 32;
+const int kFrameInterval = 5;
+const int kChunkSize = 256;
+
+struct Cell {
+    qreal cx = 0;    // centre and half the side of the square
+    qreal cy = 0;
+    qreal half = 0;
+    qreal mass = 0;  // bodies inside
+    qreal comX = 0;  // their centre of mass
+    qreal comY = 0;
+    int child = -1;  // first of the four children, -1 for a leaf
+    int body = -1;   // the body in a leaf
+};
+
+class QuadTree
+{
+public:
+    void build(const QVector<QPointF>& points)
+    {
+        m_cells.clear();
+        qreal minX = points[0].x(), maxX = minX;
+        qreal minY = points[0].y(), maxY = minY;
+        for (const QPointF& p : points) {
+            minX = qMin(minX, p.x());
+            maxX = qMax(maxX, p.x());
+            minY = qMin(minY, p.y());
+            maxY = qMax(maxY, p.y());
+        }
+        Cell root;
+        root.cx = (minX + maxX) / 2;
+        root.cy = (minY + maxY) / 2;
+        root.half = qMax(maxX - minX, maxY - minY) / 2 + 1;
+        m_cells.append(root);
+        for (int i = 0; i < points.size(); ++i) {
+            insert(i, points);
+        }
+    }
+
+    // Repulsion on body i from all others
+    QPointF repulsion(int i, const QVector<QPointF>& points, const QVector<qreal>& radius, qreal k2) const
+    {
+        const QPointF p = points[i];
+        QPointF force;
+        int stack[4 * kMaxDepth + 8];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const Cell& cell = m_cells[stack[--top]];
+            if (cell.mass == 0) continue;
+            const qreal dx = p.x() - cell.comX;
+            const qreal dy = p.y() - cell.comY;
+            const qreal distance = qSqrt(dx * dx + dy * dy);
+
+            if (cell.child < 0) {
+                const qreal mass = cell.body == i ? cell.mass - 1 : cell.mass;
+                if (mass <= 0) continue;
+                // Near bodies repel by the gap between their outlines
+                const qreal gap = qMax(distance - radius[i] - radius[cell.body], kMinGap);
+                QPointF direction;
+                if (distance > 1e-6) {
+                    direction = QPointF(dx, dy) / distance;
+                }
+                else {
+                    // Coincident: any direction will do, as long as the
+                    // two bodies pick different ones
+                    const qreal angle = i * 2.399963;
+                    direction = QPointF(qCos(angle), qSin(angle));
+                }
+                force += direction * (k2 * mass / gap);
+                continue;
+            }
+
+            const bool inside = qAbs(p.x() - cell.cx) <= cell.half && qAbs(p.y() - cell.cy) <= cell.half;
+            if (!inside && 2 * cell.half < kTheta * distance) {
+                force += QPointF(dx, dy) / distance * (k2 * cell.mass / distance);
+                continue;
+            }
+            for (int q = 0; q < 4; ++q) {
+                stack[top++] = cell.child + q;
+            }
+        }
+        return force;
+    }
+
+private:
+    static int quadrant(const Cell& cell, const QPointF& p)
+    {
+        return (p.x() >= cell.cx ? 1 : 0) | (p.y() >= cell.cy ? 2 : 0);
+    }
+
+    void insert(int i, const QVector<QPointF>& points)
+    {
+        const QPointF p = points[i];
+        int c = 0;
+        for (int depth = 0;; ++depth) {
+            // Every cell on the way down takes the body into its centre
+            // of mass. m_cells may grow below, so no references are kept.
+            Cell& cell = m_cells[c];
+            cell.comX = (cell.comX * cell.mass + p.x()) / (cell.mass + 1);
+            cell.comY = (cell.comY * cell.mass + p.y()) / (cell.mass + 1);
+            cell.mass += 1;
+
+            if (cell.child < 0) {
+                if (cell.mass == 1) {
+                    cell.body = i;
+                    return;
+                }
+                if (depth >= kMaxDepth) return;
+
+                // Split, moving the resident body down a level
+                const int resident = cell.body;
+                const int first = m_cells.size();
+                const qreal half = cell.half / 2;
+                const qreal cx = cell.cx;
+                const qreal cy = cell.cy;
+                cell.body = -1;
+                cell.child = first;
+                for (int q = 0; q < 4; ++q) {
+                    Cell child;
+                    child.cx = cx + ((q & 1) ? half : -half);
+                    child.cy = cy + ((q & 2) ? half : -half);
+                    child.half = half;
+                    m_cells.append(child);
+                }
+                Cell& moved = m_cells[first + quadrant(m_cells[c], points[resident])];
+                moved.mass = 1;
+                moved.comX = points[resident].x();
+                moved.comY = points[resident].y();
+                moved.body = resident;
+            }
+            c = m_cells[c].child + quadrant(m_cells[c], p);
+        }
+    }
+
+    QVector<Cell> m_cells;
+};
+
+} // namespace
+
+QVector<QPointF> ForceLayout::layout(const Request& request, const FrameCallback& onFrame,
+                                     std::atomic<bool>* framePending, const std::atomic<bool>* cancelled)
+{
+    const int n = request.nodes.size();
+    if (n == 0) return QVector<QPointF>();
+
+    // Positions are centres while iterating
+    QVector<QPointF> points(n);
+    QVector<qreal> radius(n);
+    QPointF centroid;
+    qreal meanSize = 0;
+    for (int i = 0; i < n; ++i) {
+        const QRectF& bounds = request.nodes[i].bounds;
+        points[i] = bounds.center();
+        radius[i] = (bounds.width() + bounds.height()) / 4;
+        centroid += points[i];
+        meanSize += 2 * radius[i];
+    }
+    centroid /= n;
+    meanSize /= n;
+    const qreal k = request.idealLength > 0 ? request.idealLength : meanSize * 1.5 + 40;
+    const qreal k2 = k * k;
+
+    // Neighbour lists for the attraction, both directions
+    QVector<int> offsets(n + 1, 0);
+    for (const Edge& edge : request.edges) {
+        if (edge.from < 0 || edge.to < 0 || edge.from >= n || edge.to >= n || edge.from == edge.to) continue;
+        ++offsets[edge.from + 1];
+        ++offsets[edge.to + 1];
+    }
+    for (int i = 0; i < n; ++i) {
+        offsets[i + 1] += offsets[i];
+    }
+    QVector<int> neighbours(offsets[n]);
+    QVector<int> next = offsets;
+    for (const Edge& edge : request.edges) {
+        if (edge.from < 0 || edge.to < 0 || edge.from >= n || edge.to >= n || edge.from == edge.to) continue;
+        neighbours[next[edge.from]++] = edge.to;
+        neighbours[next[edge.to]++] = edge.from;
+    }
+
+    auto topLefts = [&]() {
+        QVector<QPointF> positions(n);
+        for (int i = 0; i < n; ++i) {
+            const QSizeF size = request.nodes[i].bounds.size();
+            positions[i] = points[i] - QPointF(size.width() / 2, size.height() / 2);
+        }
+        return positions;
+    };
+
+    QVector<int> chunks;
+    for (int start = 0; start < n; start += kChunkSize) {
+        chunks.append(start);
+    }
+    QVector<QPointF> displacement(n);
+    QuadTree tree;
+    qreal temperature = k * (1 + qSqrt(n) / 4);
+
+    for (int iteration = 0; iteration < request.iterations; ++iteration) {
+        if (cancelled && cancelled->load()) break;
+
+        // The tree is read-only while the workers run, and each worker
+        // writes only its own slice of displacement
+        tree.build(points);
+        QtConcurrent::blockingMap(chunks.constBegin(), chunks.constEnd(), [&](int start) {
+            const int end = qMin(start + kChunkSize, n);
+            for (int i = start; i < end; ++i) {
+                if (request.nodes[i].pinned) {
+                    displacement[i] = QPointF();
+                    continue;
+                }
+                QPointF force = tree.repulsion(i, points, radius, k2);
+                for (int e = offsets[i]; e < offsets[i + 1]; ++e) {
+                    // d^2 / k along the edge
+                    const QPointF d = points[neighbours[e]] - points[i];
+                    force += d * (qSqrt(d.x() * d.x() + d.y() * d.y()) / k);
+                }
+                force += (centroid - points[i]) * kGravity;
+                displacement[i] = force;
+            }
+        });
+
+        qreal largestMove = 0;
+        for (int i = 0; i < n; ++i) {
+            QPointF move = displacement[i];
+            const qreal length = qSqrt(move.x() * move.x() + move.y() * move.y());
+            if (length > temperature) {
+                move *= temperature / length;
+            }
+            points[i] += move;
+            largestMove = qMax(largestMove, qMin(length, temperature));
+        }
+        temperature *= kCooling;
+
+        if (onFrame && (iteration + 1) % kFrameInterval == 0
+            && !(framePending && framePending->exchange(true))) {
+            onFrame(topLefts());
+        }
+        if (largestMove < k * kConvergence) break;
+    }
+    return topLefts();
+}
@@ -0,0 +1,52 @@
+/**
+ * @file ForceLayout.h
+ * @brief Force-directed layout with Barnes-Hut repulsion
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QPointF>
+#include <QRectF>
+#include <QVector>
+#include <atomic>
+#include <functional>
+#include "DiagramShape.h"
+
+// Spring-electrical layout for diagrams that are networks rather than
+// hierarchies, with Barnes-Hut repulsion. Pinned nodes exert forces but
+// never move.
+class ForceLayout
+{
+public:
+    struct Node {
+        ShapeId id = 0;
+        QRectF bounds;
+        bool pinned = false;
+    };
+
+    struct Edge {
+        int from = 0; // indexes into Request::nodes
+        int to = 0;
+    };
+
+    struct Request {
+        QVector<Node> nodes;
+        QVector<Edge> edges;
+        int iterations = 300;
+        // Preferred edge length; 0 derives it from the node sizes
+        qreal idealLength = 0;
+    };
+
+    // Receives the current top-left of every node, in request order. Called
+    // on the worker thread every few iterations while *framePending is
+    // false; the worker sets it before each call and the receiver clears it
+    // once the frame is shown, so a busy GUI never falls behind.
+    using FrameCallback = std::function<void(const QVector<QPointF>& positions)>;
+
+    // Returns the final top-left of every node. Cancelling stops the
+    // iterations and returns the positions reached so far.
+    static QVector<QPointF> layout(const Request& request, const FrameCallback& onFrame = FrameCallback(),
+                                   std::atomic<bool>* framePending = nullptr,
+                                   const std::atomic<bool>* cancelled = nullptr);
+};
@@ -0,0 +1,682 @@
+/**
+ * @file LayeredLayout.cpp
+ * @brief Implementation of the hierarchical layout engine
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "LayeredLayout.h"
+#include <QPair>
+#include <QtMath>
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+// Barycenter sweeps, each one down or up; the search stops early after
+// kMaxStaleSweeps sweeps that did not remove a crossing
+const int kMaxSweeps = 24;
+const int kMaxStaleSweeps = 4;
+const int kCoordinatePasses = 8;
+// Dummy vertices pull harder, which keeps long edges straight
+const qreal kDummyWeight = 2.0;
+const int kUnset = std::numeric_limits<int>::min();
+
+using Pairs = QVector<QPair<int, int>>;
+
+// Compressed adjacency lists: the neighbours of v are
+// targets[offsets[v]] .. targets[offsets[v + 1] - 1]
+struct Adjacency {
+    QVector<int> offsets;
+    QVector<int> targets;
+
+    void build(int count, const Pairs& pairs)
+    {
+        offsets.fill(0, count + 1);
+        for (const auto& pair : pairs) {
+            ++offsets[pair.first + 1];
+        }
+        for (int v = 0; v < count; ++v) {
+            offsets[v + 1] += offsets[v];
+        }
+        targets.resize(pairs.size());
+        QVector<int> next = offsets;
+        for (const auto& pair : pairs) {
+            targets[next[pair.first]++] = pair.second;
+        }
+    }
+
+    int degree(int v) const { return offsets[v + 1] - offsets[v]; }
+    const int* begin(int v) const { return targets.constData() + offsets[v]; }
+    const int* end(int v) const { return targets.constData() + offsets[v + 1]; }
+};
+
+bool isCancelled(const std::atomic<bool>* cancelled)
+{
+    return cancelled && cancelled->load();
+}
+
+// Returns the nodes in an order every edge respects once the flagged
+// edges are reversed. DFS roots go top to bottom, so edges drawn
+// downwards tend to keep their direction.
+QVector<int> removeCycles(const LayeredLayout::Request& request, const QVector<bool>& valid,
+                          QVector<bool>& reversed)
+{
+    const int n = request.nodes.size();
+    Pairs outgoing;
+    for (int e = 0; e < request.edges.size(); ++e) {
+        if (valid[e]) {
+            outgoing.append(qMakePair(request.edges[e].from, e));
+        }
+    }
+    Adjacency out;
+    out.build(n, outgoing);
+
+    QVector<int> roots(n);
+    std::iota(roots.begin(), roots.end(), 0);
+    std::sort(roots.begin(), roots.end(), [&](int a, int b) {
+        const QPointF pa = request.nodes[a].bounds.center();
+        const QPointF pb = request.nodes[b].bounds.center();
+        return pa.y() != pb.y() ? pa.y() < pb.y() : pa.x() < pb.x();
+    });
+
+    // 0 unvisited, 1 on the DFS stack, 2 finished
+    QVector<quint8> state(n, 0);
+    QVector<int> postorder;
+    postorder.reserve(n);
+    Pairs stack; // node, next slot in its adjacency list
+    for (int root : roots) {
+        if (state[root] != 0) continue;
+        state[root] = 1;
+        stack.append(qMakePair(root, out.offsets[root]));
+        while (!stack.isEmpty()) {
+            const int v = stack.last().first;
+            if (stack.last().second < out.offsets[v + 1]) {
+                const int e = out.targets[stack.last().second++];
+                const int w = request.edges[e].to;
+                if (state[w] == 1) {
+                    reversed[e] = true;
+                }
+                else if (state[w] == 0) {
+                    state[w] = 1;
+                    stack.append(qMakePair(w, out.offsets[w]));
+                }
+            }
+            else {
+                state[v] = 2;
+                postorder.append(v);
+                stack.removeLast();
+            }
+        }
+    }
+    std::reverse(postorder.begin(), postorder.end());
+    return postorder;
+}
+
+// Crossings between a layer and the one below it: with the edges sorted by
+// upper end, every pair whose lower ends are out of order crosses
+qint64 countCrossings(const QVector<int>& upper, int lowerSize, const Adjacency& below,
+                      const QVector<int>& pos, QVector<int>& ends, QVector<int>& tree)
+{
+    ends.clear();
+    for (int v : upper) {
+        const int first = ends.size();
+        for (const int* w = below.begin(v); w != below.end(v); ++w) {
+            ends.append(pos[*w]);
+        }
+        std::sort(ends.begin() + first, ends.end());
+    }
+
+    tree.fill(0, lowerSize + 1);
+    qint64 count = 0;
+    for (int i = 0; i < ends.size(); ++i) {
+        const int p = ends[i] + 1;
+        int notGreater = 0;
+        for (int k = p; k > 0; k -= k & -k) {
+            notGreater += tree[k];
+        }
+        count += i - notGreater;
+        for (int k = p; k <= lowerSize; k += k & -k) {
+            ++tree[k];
+        }
+    }
+    return count;
+}
+
+// Weighted least-squares fit of x to desired under x[i+1] >= x[i] + sep[i]
+// (pool adjacent violators on the shifted problem)
+void placeRow(const QVector<qreal>& desired, const QVector<qreal>& weight, const QVector<qreal>& sep,
+              QVector<qreal>& x)
+{
+    struct Block {
+        qreal weightedSum;
+        qreal weight;
+        int count;
+        qreal mean() const { return weightedSum / weight; }
+    };
+
+    const int k = desired.size();
+    QVector<qreal> offset(k, 0);
+    for (int i = 1; i < k; ++i) {
+        offset[i] = offset[i - 1] + sep[i - 1];
+    }
+
+    QVector<Block> blocks;
+    blocks.reserve(k);
+    for (int i = 0; i < k; ++i) {
+        blocks.append({ weight[i] * (desired[i] - offset[i]), weight[i], 1 });
+        while (blocks.size() >= 2 && blocks[blocks.size() - 2].mean() > blocks.last().mean()) {
+            const Block last = blocks.takeLast();
+            blocks.last().weightedSum += last.weightedSum;
+            blocks.last().weight += last.weight;
+            blocks.last().count += last.count;
+        }
+    }
+
+    x.resize(k);
+    int i = 0;
+    for (const Block& block : blocks) {
+        const qreal mean = block.mean();
+        for (int j = 0; j < block.count; ++j, ++i) {
+            x[i] = mean + offset[i];
+        }
+    }
+}
+
+bool layoutFull(const LayeredLayout::Request& request, const QVector<bool>& valid, const QVector<bool>& reversed,
+                const QVector<int>& topo, const std::atomic<bool>* cancelled, LayeredLayout::Result& result)
+{
+    const int n = request.nodes.size();
+    const auto& nodes = request.nodes;
+    const auto& edges = request.edges;
+
+    Pairs down;
+    Pairs up;
+    for (int e = 0; e < edges.size(); ++e) {
+        if (!valid[e]) continue;
+        const int s = reversed[e] ? edges[e].to : edges[e].from;
+        const int t = reversed[e] ? edges[e].from : edges[e].to;
+        down.append(qMakePair(s, t));
+        up.append(qMakePair(t, s));
+    }
+    Adjacency successors;
+    Adjacency predecessors;
+    successors.build(n, down);
+    predecessors.build(n, up);
+
+    // Longest path from the sources, then every source moves down to just
+    // above its highest successor
+    QVector<int> layer(n, 0);
+    for (int v : topo) {
+        for (const int* w = successors.begin(v); w != successors.end(v); ++w) {
+            layer[*w] = qMax(layer[*w], layer[v] + 1);
+        }
+    }
+    for (int v = 0; v < n; ++v) {
+        if (predecessors.degree(v) != 0 || successors.degree(v) == 0) continue;
+        int highest = std::numeric_limits<int>::max();
+        for (const int* w = successors.begin(v); w != successors.end(v); ++w) {
+            highest = qMin(highest, layer[*w]);
+        }
+        layer[v] = highest - 1;
+    }
+    const int layerCount = n > 0 ? *std::max_element(layer.constBegin(), layer.constEnd()) + 1 : 0;
+
+    // Vertices are the nodes followed by one dummy per layer an edge
+    // passes through. The first guess at x comes from the drawing as it is.
+    QVector<int> vertexLayer = layer;
+    QVector<qreal> guess(n);
+    for (int v = 0; v < n; ++v) {
+        guess[v] = nodes[v].bounds.center().x();
+    }
+    QVector<QVector<int>> chains(edges.size());
+    Pairs proper;
+    for (int e = 0; e < edges.size(); ++e) {
+        if (!valid[e]) continue;
+        const int s = reversed[e] ? edges[e].to : edges[e].from;
+        const int t = reversed[e] ? edges[e].from : edges[e].to;
+        const int span = layer[t] - layer[s];
+        int previous = s;
+        for (int step = 1; step < span; ++step) {
+            const int dummy = vertexLayer.size();
+            vertexLayer.append(layer[s] + step);
+            guess.append(guess[s] + (guess[t] - guess[s]) * step / span);
+            chains[e].append(dummy);
+            proper.append(qMakePair(previous, dummy));
+            previous = dummy;
+        }
+        proper.append(qMakePair(previous, t));
+    }
+    const int vertexCount = vertexLayer.size();
+    Pairs properUp;
+    properUp.reserve(proper.size());
+    for (const auto& pair : proper) {
+        properUp.append(qMakePair(pair.second, pair.first));
+    }
+    Adjacency below;
+    Adjacency above;
+    below.build(vertexCount, proper);
+    above.build(vertexCount, properUp);
+
+    QVector<QVector<int>> layers(layerCount);
+    for (int v = 0; v < vertexCount; ++v) {
+        layers[vertexLayer[v]].append(v);
+    }
+    QVector<int> pos(vertexCount);
+    for (QVector<int>& row : layers) {
+        std::stable_sort(row.begin(), row.end(), [&](int a, int b) { return guess[a] < guess[b]; });
+        for (int i = 0; i < row.size(); ++i) {
+            pos[row[i]] = i;
+        }
+    }
+    if (isCancelled(cancelled)) return false;
+
+    // Crossing minimization
+    QVector<int> ends;
+    QVector<int> tree;
+    auto totalCrossings = [&]() {
+        qint64 total = 0;
+        for (int l = 0; l + 1 < layerCount; ++l) {
+            total += countCrossings(layers[l], layers[l + 1].size(), below, pos, ends, tree);
+        }
+        return total;
+    };
+    QVector<qreal> key(vertexCount);
+    auto reorder = [&](QVector<int>& row, const Adjacency& adjacent) {
+        for (int i = 0; i < row.size(); ++i) {
+            const int v = row[i];
+            const int degree = adjacent.degree(v);
+            if (degree == 0) {
+                key[v] = i;
+                continue;
+            }
+            qreal sum = 0;
+            for (const int* w = adjacent.begin(v); w != adjacent.end(v); ++w) {
+                sum += pos[*w];
+            }
+            key[v] = sum / degree;
+        }
+        std::stable_sort(row.begin(), row.end(), [&](int a, int b) { return key[a] < key[b]; });
+        for (int i = 0; i < row.size(); ++i) {
+            pos[row[i]] = i;
+        }
+    };
+
+    QVector<QVector<int>> best = layers;
+    qint64 bestCrossings = totalCrossings();
+    int stale = 0;
+    for (int sweep = 0; sweep < kMaxSweeps && bestCrossings > 0 && stale < kMaxStaleSweeps; ++sweep) {
+        if (sweep % 2 == 0) {
+            for (int l = 1; l < layerCount; ++l) {
+                reorder(layers[l], above);
+            }
+        }
+        else {
+            for (int l = layerCount - 2; l >= 0; --l) {
+                reorder(layers[l], below);
+            }
+        }
+        if (isCancelled(cancelled)) return false;
+        const qint64 crossings = totalCrossings();
+        if (crossings < bestCrossings) {
+            bestCrossings = crossings;
+            best = layers;
+            stale = 0;
+        }
+        else {
+            ++stale;
+        }
+    }
+    layers = best;
+    for (const QVector<int>& row : layers) {
+        for (int i = 0; i < row.size(); ++i) {
+            pos[row[i]] = i;
+        }
+    }
+
+    // Coordinate assignment, x being the centre of each vertex
+    QVector<qreal> width(vertexCount, 0);
+    QVector<qreal> weight(vertexCount, kDummyWeight);
+    for (int v = 0; v < n; ++v) {
+        width[v] = nodes[v].bounds.width();
+        weight[v] = 1;
+    }
+    auto separation = [&](int a, int b) {
+        const qreal gap = a < n && b < n ? request.nodeSpacing : request.nodeSpacing / 2;
+        return (width[a] + width[b]) / 2 + gap;
+    };
+
+    QVector<qreal> x(vertexCount, 0);
+    for (const QVector<int>& row : layers) {
+        qreal cursor = 0;
+        for (int i = 0; i < row.size(); ++i) {
+            if (i > 0) cursor += separation(row[i - 1], row[i]);
+            x[row[i]] = cursor;
+        }
+        for (int v : row) {
+            x[v] -= cursor / 2;
+        }
+    }
+
+    QVector<qreal> desired;
+    QVector<qreal> rowWeight;
+    QVector<qreal> sep;
+    QVector<qreal> placed;
+    auto placeLayer = [&](const QVector<int>& row, const Adjacency* first, const Adjacency* second) {
+        const int k = row.size();
+        desired.resize(k);
+        rowWeight.resize(k);
+        sep.resize(k);
+        for (int i = 0; i < k; ++i) {
+            const int v = row[i];
+            qreal sum = 0;
+            int count = 0;
+            for (const Adjacency* adjacent : { first, second }) {
+                if (!adjacent) continue;
+                for (const int* w = adjacent->begin(v); w != adjacent->end(v); ++w) {
+                    sum += x[*w];
+                    ++count;
+                }
+            }
+            desired[i] = count > 0 ? sum / count : x[v];
+            rowWeight[i] = weight[v];
+            if (i + 1 < k) sep[i] = separation(v, row[i + 1]);
+        }
+        placeRow(desired, rowWeight, sep, placed);
+        for (int i = 0; i < k; ++i) {
+            x[row[i]] = placed[i];
+        }
+    };
+    for (int pass = 0; pass < kCoordinatePasses; ++pass) {
+        if (pass % 2 == 0) {
+            for (int l = 1; l < layerCount; ++l) {
+                placeLayer(layers[l], &above, nullptr);
+            }
+        }
+        else {
+            for (int l = layerCount - 2; l >= 0; --l) {
+                placeLayer(layers[l], &below, nullptr);
+            }
+        }
+        if (isCancelled(cancelled)) return false;
+    }
+    // A last pass balances every vertex between both of its sides
+    for (int l = 0; l < layerCount; ++l) {
+        placeLayer(layers[l], &above, &below);
+    }
+
+    QVector<qreal> layerHeight(layerCount, 0);
+    for (int v = 0; v < n; ++v) {
+        layerHeight[layer[v]] = qMax(layerHeight[layer[v]], nodes[v].bounds.height());
+    }
+    QVector<qreal> layerTop(layerCount, 0);
+    for (int l = 1; l < layerCount; ++l) {
+        layerTop[l] = layerTop[l - 1] + layerHeight[l - 1] + request.layerSpacing;
+    }
+
+    // The drawing keeps the top-left corner it had before
+    QRectF before;
+    QRectF after;
+    result.positions.resize(n);
+    for (int v = 0; v < n; ++v) {
+        const QSizeF size = nodes[v].bounds.size();
+        const int l = layer[v];
+        result.positions[v] = QPointF(x[v] - size.width() / 2, layerTop[l] + (layerHeight[l] - size.height()) / 2);
+        before |= nodes[v].bounds;
+        after |= QRectF(result.positions[v], size);
+    }
+    const QPointF delta = before.topLeft() - after.topLeft();
+    for (QPointF& position : result.positions) {
+        position += delta;
+    }
+
+    for (int e = 0; e < edges.size(); ++e) {
+        if (!valid[e]) continue;
+        QVector<QPointF> points;
+        points.reserve(chains[e].size());
+        for (int dummy : chains[e]) {
+            const int l = vertexLayer[dummy];
+            points.append(QPointF(x[dummy], layerTop[l] + layerHeight[l] / 2) + delta);
+        }
+        if (reversed[e]) {
+            std::reverse(points.begin(), points.end());
+        }
+        result.connectors.append(edges[e].connector);
+        result.bends.append(points);
+    }
+    return true;
+}
+
+// Left edge nearest to left at which width fits between the occupied
+// intervals (sorted, disjoint)
+qreal fitGap(const QVector<QPair<qreal, qreal>>& occupied, qreal left, qreal width)
+{
+    const qreal inf = std::numeric_limits<qreal>::infinity();
+    const int count = occupied.size();
+    // Gap g lies between intervals g - 1 and g
+    auto lo = [&](int g) { return g == 0 ? -inf : occupied[g - 1].second; };
+    auto hi = [&](int g) { return g == count ? inf : occupied[g].first; };
+    const int k = int(std::upper_bound(occupied.constBegin(), occupied.constEnd(), left,
+                                       [](qreal value, const QPair<qreal, qreal>& interval) {
+                                           return value < interval.first;
+                                       }) - occupied.constBegin());
+
+    qreal best = left;
+    qreal bestDistance = inf;
+    for (int g = k; g <= count; ++g) {
+        if (hi(g) - lo(g) < width) continue;
+        const qreal candidate = qBound(lo(g), left, hi(g) - width);
+        best = candidate;
+        bestDistance = qAbs(candidate - left);
+        break;
+    }
+    for (int g = k - 1; g >= 0; --g) {
+        if (hi(g) - lo(g) < width) continue;
+        const qreal candidate = qBound(lo(g), left, hi(g) - width);
+        if (qAbs(candidate - left) < bestDistance) {
+            best = candidate;
+        }
+        break;
+    }
+    return best;
+}
+
+void occupy(QVector<QPair<qreal, qreal>>& occupied, qreal from, qreal to)
+{
+    auto it = std::lower_bound(occupied.begin(), occupied.end(), qMakePair(from, to));
+    int i = int(it - occupied.begin());
+    occupied.insert(i, qMakePair(from, to));
+    while (i > 0 && occupied[i - 1].second >= occupied[i].first) {
+        occupied[i - 1].second = qMax(occupied[i - 1].second, occupied[i].second);
+        occupied.removeAt(i);
+        --i;
+    }
+    while (i + 1 < occupied.size() && occupied[i].second >= occupied[i + 1].first) {
+        occupied[i].second = qMax(occupied[i].second, occupied[i + 1].second);
+        occupied.removeAt(i + 1);
+    }
+}
+
+void layoutIncremental(const LayeredLayout::Request& request, const QVector<bool>& valid,
+                       const QVector<bool>& reversed, const QVector<int>& topo, LayeredLayout::Result& result)
+{
+    const int n = request.nodes.size();
+    const auto& nodes = request.nodes;
+    const auto& edges = request.edges;
+
+    // Placed nodes whose centres fall within a row's vertical extent share
+    // a layer
+    QVector<int> sorted;
+    for (int v = 0; v < n; ++v) {
+        if (nodes[v].placed) sorted.append(v);
+    }
+    std::sort(sorted.begin(), sorted.end(), [&](int a, int b) {
+        return nodes[a].bounds.center().y() < nodes[b].bounds.center().y();
+    });
+    QVector<int> layer(n, kUnset);
+    QVector<qreal> rowTop;
+    QVector<qreal> rowBottom;
+    for (int v : sorted) {
+        const QRectF& bounds = nodes[v].bounds;
+        if (rowTop.isEmpty() || bounds.center().y() > rowBottom.last()) {
+            rowTop.append(bounds.top());
+            rowBottom.append(bounds.bottom());
+        }
+        else {
+            rowTop.last() = qMin(rowTop.last(), bounds.top());
+            rowBottom.last() = qMax(rowBottom.last(), bounds.bottom());
+        }
+        layer[v] = rowTop.size() - 1;
+    }
+
+    Pairs down;
+    Pairs up;
+    Pairs both;
+    for (int e = 0; e < edges.size(); ++e) {
+        if (!valid[e]) continue;
+        const int s = reversed[e] ? edges[e].to : edges[e].from;
+        const int t = reversed[e] ? edges[e].from : edges[e].to;
+        down.append(qMakePair(s, t));
+        up.append(qMakePair(t, s));
+        both.append(qMakePair(s, t));
+        both.append(qMakePair(t, s));
+    }
+    Adjacency successors;
+    Adjacency predecessors;
+    Adjacency neighbours;
+    successors.build(n, down);
+    predecessors.build(n, up);
+    neighbours.build(n, both);
+
+    // New nodes go below their lowest layered predecessor, or failing that
+    // above their highest layered successor. Nodes not connected to the
+    // placed part at all stay where they are.
+    for (int v : topo) {
+        if (nodes[v].placed) continue;
+        for (const int* p = predecessors.begin(v); p != predecessors.end(v); ++p) {
+            if (layer[*p] != kUnset) layer[v] = qMax(layer[v], layer[*p] + 1);
+        }
+    }
+    for (int i = topo.size() - 1; i >= 0; --i) {
+        const int v = topo[i];
+        if (nodes[v].placed || layer[v] != kUnset) continue;
+        for (const int* w = successors.begin(v); w != successors.end(v); ++w) {
+            if (layer[*w] == kUnset) continue;
+            layer[v] = layer[v] == kUnset ? layer[*w] - 1 : qMin(layer[v], layer[*w] - 1);
+        }
+    }
+
+    // Rows for layers above and below the placed ones
+    int minLayer = 0;
+    int maxLayer = rowTop.size() - 1;
+    for (int v = 0; v < n; ++v) {
+        if (layer[v] == kUnset) continue;
+        minLayer = qMin(minLayer, layer[v]);
+        maxLayer = qMax(maxLayer, layer[v]);
+    }
+    const int shift = -minLayer;
+    const int rowCount = maxLayer - minLayer + 1;
+    QVector<qreal> top(rowCount, 0);
+    QVector<qreal> bottom(rowCount, 0);
+    QVector<qreal> newHeight(rowCount, 0);
+    for (int v = 0; v < n; ++v) {
+        if (!nodes[v].placed && layer[v] != kUnset) {
+            newHeight[layer[v] + shift] = qMax(newHeight[layer[v] + shift], nodes[v].bounds.height());
+        }
+    }
+    for (int l = 0; l < rowTop.size(); ++l) {
+        top[l + shift] = rowTop[l];
+        bottom[l + shift] = rowBottom[l];
+    }
+    for (int r = rowTop.size() + shift; r < rowCount; ++r) {
+        top[r] = bottom[r - 1] + request.layerSpacing;
+        bottom[r] = top[r] + newHeight[r];
+    }
+    for (int r = shift - 1; r >= 0; --r) {
+        bottom[r] = top[r + 1] - request.layerSpacing;
+        top[r] = bottom[r] - newHeight[r];
+    }
+
+    // Each new node aims for the mean centre of its neighbours
+    QVector<qreal> centre(n);
+    for (int v = 0; v < n; ++v) {
+        centre[v] = nodes[v].bounds.center().x();
+    }
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; i < topo.size(); ++i) {
+            const int v = pass == 0 ? topo[i] : topo[topo.size() - 1 - i];
+            if (nodes[v].placed || layer[v] == kUnset) continue;
+            qreal sum = 0;
+            int count = 0;
+            for (const int* w = neighbours.begin(v); w != neighbours.end(v); ++w) {
+                if (layer[*w] == kUnset) continue;
+                sum += centre[*w];
+                ++count;
+            }
+            if (count > 0) centre[v] = sum / count;
+        }
+    }
+
+    // Then takes the nearest gap in its row that fits
+    QVector<QVector<QPair<qreal, qreal>>> occupied(rowCount);
+    QVector<QVector<int>> incoming(rowCount);
+    const qreal spacing = request.nodeSpacing;
+    for (int v = 0; v < n; ++v) {
+        if (layer[v] == kUnset) continue;
+        const int r = layer[v] + shift;
+        if (nodes[v].placed) {
+            occupy(occupied[r], nodes[v].bounds.left() - spacing, nodes[v].bounds.right() + spacing);
+        }
+        else {
+            incoming[r].append(v);
+        }
+    }
+
+    result.positions.resize(n);
+    for (int v = 0; v < n; ++v) {
+        result.positions[v] = nodes[v].bounds.topLeft();
+    }
+    for (int r = 0; r < rowCount; ++r) {
+        QVector<int>& row = incoming[r];
+        std::sort(row.begin(), row.end(), [&](int a, int b) { return centre[a] < centre[b]; });
+        for (int v : row) {
+            const QSizeF size = nodes[v].bounds.size();
+            const qreal left = fitGap(occupied[r], centre[v] - size.width() / 2, size.width());
+            occupy(occupied[r], left - spacing, left + size.width() + spacing);
+            result.positions[v] = QPointF(left, (top[r] + bottom[r] - size.height()) / 2);
+        }
+    }
+}
+
+} // namespace
+
+LayeredLayout::Result LayeredLayout::layout(const Request& request, const std::atomic<bool>* cancelled)
+{
+    const int n = request.nodes.size();
+    QVector<bool> valid(request.edges.size(), false);
+    for (int e = 0; e < request.edges.size(); ++e) {
+        const Edge& edge = request.edges[e];
+        valid[e] = edge.from >= 0 && edge.to >= 0 && edge.from < n && edge.to < n && edge.from != edge.to;
+    }
+
+    QVector<bool> reversed(request.edges.size(), false);
+    const QVector<int> topo = removeCycles(request, valid, reversed);
+    if (isCancelled(cancelled)) return Result();
+
+    Result result;
+    const bool anyPlaced = std::any_of(request.nodes.constBegin(), request.nodes.constEnd(),
+                                       [](const Node& node) { return node.placed; });
+    if (request.incremental && anyPlaced) {
+        layoutIncremental(request, valid, reversed, topo, result);
+    }
+    else if (!layoutFull(request, valid, reversed, topo, cancelled, result)) {
+        return Result();
+    }
+
+    result.nodes.reserve(n);
+    for (const Node& node : request.nodes) {
+        result.nodes.append(node.id);
+    }
+    return result;
+}
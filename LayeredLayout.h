@@ -0,0 +1,53 @@
+/**
+ * @file LayeredLayout.h
+ * @brief Hierarchical (Sugiyama-style) layout of the shape/connector graph
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QPointF>
+#include <QRectF>
+#include <QVector>
+#include <atomic>
+#include "DiagramShape.h"
+
+// Arranges shapes in top-down layers along their connectors (cycle
+// removal, layering, crossing reduction, coordinates). An incremental
+// layout keeps placed nodes where they are and fits the rest around them.
+class LayeredLayout
+{
+public:
+    struct Node {
+        ShapeId id = 0;
+        QRectF bounds;
+        bool placed = false; // kept where it is by an incremental layout
+    };
+
+    struct Edge {
+        ShapeId connector = 0;
+        int from = 0; // indexes into Request::nodes
+        int to = 0;
+    };
+
+    struct Request {
+        QVector<Node> nodes;
+        QVector<Edge> edges;
+        qreal layerSpacing = 60.0;
+        qreal nodeSpacing = 40.0;
+        bool incremental = false;
+    };
+
+    struct Result {
+        QVector<ShapeId> nodes;
+        QVector<QPointF> positions;          // new top-left of each node
+        // Full layouts only: the bends of each edge through its dummy
+        // vertices, in connector order (empty for edges between
+        // neighbouring layers)
+        QVector<ShapeId> connectors;
+        QVector<QVector<QPointF>> bends;
+    };
+
+    // Returns an empty result when cancelled
+    static Result layout(const Request& request, const std::atomic<bool>* cancelled = nullptr);
+};
@@ -10,6 +10,7 @@
 #include "ShapeToolBox.h"
 #include "PropertyPanel.h"
 #include "FlowIO.h"
+#include "AutosaveJournal.h"
 #include <QMenuBar>
 #include <QToolBar>
 #include <QDockWidget>
@@ -21,6 +22,17 @@
 #include <QClipboard>
 #include <QMimeData>
 #include <QApplication>
+#include <QLabel>
+#include <QProgressBar>
+#include <QProgressDialog>
+#include <QToolButton>
+#include <QInputDialog>
+#include <QPointer>
+#include <QTimer>
+#include <QFutureWatcher>
+#include <QtConcurrentRun>
+#include <atomic>
+#include "TiledImageExporter.h"
 
 MainWindow::MainWindow(QWidget* parent)
     : QMainWindow(parent)
@@ -43,6 +55,10 @@ MainWindow::MainWindow(QWidget* parent)
     createStatusBar();
     createShortcuts();
     setupConnections();
+
+    m_canvas->startAutosave(QString());
+    // Once the window is up, so the question has something to sit on
+    QTimer::singleShot(0, this, &MainWindow::recoverAutosave);
 }
 
 void MainWindow::createActions()
@@ -53,7 +69,14 @@ void MainWindow::createActions()
     m_saveAsAction = new QAction(tr("Save As..."), this);
     m_exportPngAction = new QAction(tr("Export as PNG..."), this);
     m_exportSvgAction = new QAction(tr("Export as SVG..."), this);
-
+    m_compressAction = new QAction(tr("Compress Saved Files"), this);
+    m_compressAction->setCheckable(true);
+    m_compressAction->setChecked(true);
+
+    m_undoAction = new QAction(tr("Undo"), this);
+    m_redoAction = new QAction(tr("Redo"), this);
+    m_undoAction->setEnabled(false);
+    m_redoAction->setEnabled(false);
     m_copyAction = new QAction(tr("Copy"), this);
     m_cutAction = new QAction(tr("Cut"), this);
     m_pasteAction = new QAction(tr("Paste"), this);
@@ -64,9 +87,18 @@ void MainWindow::createActions()
     m_sendToBackAction = new QAction(tr("Send to Back"), this);
     m_bringForwardAction = new QAction(tr("Bring Forward"), this);
     m_sendBackwardAction = new QAction(tr("Send Backward"), this);
+    m_layeredLayoutAction = new QAction(tr("Layered Layout"), this);
+    m_incrementalLayoutAction = new QAction(tr("Layout New Shapes"), this);
+    m_forceLayoutAction = new QAction(tr("Force-Directed Layout"), this);
+    m_forceLayoutAction->setCheckable(true);
 
     m_backgroundColorAction = new QAction(tr("Background Color..."), this);
     m_canvasSizeAction = new QAction(tr("Canvas Size..."), this);
+
+    m_zoomInAction = new QAction(tr("Zoom In"), this);
+    m_zoomOutAction = new QAction(tr("Zoom Out"), this);
+    m_resetZoomAction = new QAction(tr("Actual Size"), this);
+    m_zoomToFitAction = new QAction(tr("Fit to Window"), this);
 }
 
 void MainWindow::createMenus()
@@ -80,8 +112,13 @@ void MainWindow::createMenus()
     fileMenu->addSeparator();
     fileMenu->addAction(m_exportPngAction);
     fileMenu->addAction(m_exportSvgAction);
+    fileMenu->addSeparator();
+    fileMenu->addAction(m_compressAction);
 
     QMenu* editMenu = menuBar()->addMenu(tr("Edit"));
+    editMenu->addAction(m_undoAction);
+    editMenu->addAction(m_redoAction);
+    editMenu->addSeparator();
     editMenu->addAction(m_copyAction);
     editMenu->addAction(m_cutAction);
     editMenu->addAction(m_pasteAction);
@@ -94,10 +131,20 @@ void MainWindow::createMenus()
     arrangeMenu->addAction(m_sendToBackAction);
     arrangeMenu->addAction(m_bringForwardAction);
     arrangeMenu->addAction(m_sendBackwardAction);
+    arrangeMenu->addSeparator();
+    arrangeMenu->addAction(m_layeredLayoutAction);
+    arrangeMenu->addAction(m_incrementalLayoutAction);
+    arrangeMenu->addAction(m_forceLayoutAction);
 
     QMenu* pageMenu = menuBar()->addMenu(tr("Page"));
     pageMenu->addAction(m_backgroundColorAction);
     pageMenu->addAction(m_canvasSizeAction);
+
+    QMenu* viewMenu = menuBar()->addMenu(tr("View"));
+    viewMenu->addAction(m_zoomInAction);
+    viewMenu->addAction(m_zoomOutAction);
+    viewMenu->addAction(m_resetZoomAction);
+    viewMenu->addAction(m_zoomToFitAction);
 }
 
 void MainWindow::createToolBar()
@@ -129,6 +176,31 @@ void MainWindow::createDockWidgets()
 void MainWindow::createStatusBar()
 {
     statusBar()->showMessage(tr("Ready"));
+
+    m_zoomLabel = new QLabel(tr("Zoom: %1%").arg(100), this);
+    statusBar()->addPermanentWidget(m_zoomLabel);
+
+    m_loadProgress = new QProgressBar(this);
+    m_loadProgress->setMaximumWidth(200);
+    m_loadProgress->setRange(0, 0);
+    m_loadProgress->hide();
+    statusBar()->addPermanentWidget(m_loadProgress);
+    m_cancelLoadButton = new QToolButton(this);
+    m_cancelLoadButton->setText(tr("Cancel"));
+    m_cancelLoadButton->hide();
+    statusBar()->addPermanentWidget(m_cancelLoadButton);
+}
+
+void MainWindow::setLoadingUi(bool loading)
+{
+    m_loadProgress->setVisible(loading);
+    m_cancelLoadButton->setVisible(loading);
+    // A half-loaded document must not overwrite the file
+    m_saveAction->setEnabled(!loading);
+    m_saveAsAction->setEnabled(!loading);
+    if (loading) {
+        m_loadProgress->setRange(0, 0);
+    }
 }
 
 void MainWindow::createShortcuts()
@@ -138,11 +210,18 @@ void MainWindow::createShortcuts()
     m_saveAction->setShortcut(QKeySequence::Save);
     m_saveAsAction->setShortcut(QKeySequence("Ctrl+Shift+S"));
 
+    m_undoAction->setShortcut(QKeySequence::Undo);
+    m_redoAction->setShortcut(QKeySequence::Redo);
     m_copyAction->setShortcut(QKeySequence::Copy);
     m_cutAction->setShortcut(QKeySequence::Cut);
     m_pasteAction->setShortcut(QKeySequence::Paste);
     m_duplicateAction->setShortcut(QKeySequence("Ctrl+D"));
     m_deleteAction->setShortcut(QKeySequence::Delete);
+
+    m_zoomInAction->setShortcut(QKeySequence::ZoomIn);
+    m_zoomOutAction->setShortcut(QKeySequence::ZoomOut);
+    m_resetZoomAction->setShortcut(QKeySequence("Ctrl+0"));
+    m_zoomToFitAction->setShortcut(QKeySequence("Ctrl+Shift+F"));
 }
 
 void MainWindow::setupConnections()
@@ -154,6 +233,12 @@ void MainWindow::setupConnections()
     connect(m_exportPngAction, &QAction::triggered, this, &MainWindow::onExportToPng);
     connect(m_exportSvgAction, &QAction::triggered, this, &MainWindow::onExportToSvg);
 
+    connect(m_undoAction, &QAction::triggered, m_canvas, &DiagramCanvas::undo);
+    connect(m_redoAction, &QAction::triggered, m_canvas, &DiagramCanvas::redo);
+    connect(m_canvas, &DiagramCanvas::undoStateChanged, this, [this](bool canUndo, bool canRedo) {
+        m_undoAction->setEnabled(canUndo);
+        m_redoAction->setEnabled(canRedo);
+    });
     connect(m_copyAction, &QAction::triggered, this, &MainWindow::onCopySelected);
     connect(m_cutAction, &QAction::triggered, this, &MainWindow::onCutSelected);
     connect(m_pasteAction, &QAction::triggered, this, &MainWindow::onPasteFromClipboard);
@@ -164,12 +249,64 @@ void MainWindow::setupConnections()
     connect(m_sendToBackAction, &QAction::triggered, m_canvas, &DiagramCanvas::sendToBack);
     connect(m_bringForwardAction, &QAction::triggered, m_canvas, &DiagramCanvas::bringForward);
     connect(m_sendBackwardAction, &QAction::triggered, m_canvas, &DiagramCanvas::sendBackward);
+    connect(m_layeredLayoutAction, &QAction::triggered, m_canvas, [this](bool) { m_canvas->layoutLayered(false); });
+    connect(m_incrementalLayoutAction, &QAction::triggered, m_canvas, [this](bool) { m_canvas->layoutLayered(true); });
+    // Checked while it runs; unchecking stops it where it is
+    connect(m_forceLayoutAction, &QAction::triggered, m_canvas, [this](bool checked) {
+        if (checked) {
+            m_canvas->startForceLayout();
+        }
+        else {
+            m_canvas->stopForceLayout();
+        }
+    });
+    connect(m_canvas, &DiagramCanvas::forceLayoutFinished, this, [this]() {
+        m_forceLayoutAction->setChecked(false);
+    });
 
     connect(m_backgroundColorAction, &QAction::triggered, m_canvas, &DiagramCanvas::chooseBackgroundColor);
     connect(m_canvasSizeAction, &QAction::triggered, m_canvas, [this](bool) { m_canvas->setCanvasSize(); });
 
+    connect(m_zoomInAction, &QAction::triggered, m_canvas, &DiagramCanvas::zoomIn);
+    connect(m_zoomOutAction, &QAction::triggered, m_canvas, &DiagramCanvas::zoomOut);
+    connect(m_resetZoomAction, &QAction::triggered, m_canvas, &DiagramCanvas::resetZoom);
+    connect(m_zoomToFitAction, &QAction::triggered, m_canvas, &DiagramCanvas::zoomToFit);
+    connect(m_canvas, &DiagramCanvas::zoomChanged, this, [this](qreal zoom) {
+        m_zoomLabel->setText(tr("Zoom: %1%").arg(qRound(zoom * 100)));
+        });
+
     connect(m_canvas, &DiagramCanvas::shapeSelected, m_propertyPanel, &PropertyPanel::setShape);
     connect(m_propertyPanel, &PropertyPanel::shapeChanged, m_canvas, &DiagramCanvas::refreshCanvas);
+    connect(m_propertyPanel, &PropertyPanel::propertyChanged, m_canvas, &DiagramCanvas::recordPropertyChange);
+
+    connect(m_canvas, &DiagramCanvas::loadProgress, this, [this](int loaded, int total) {
+        m_loadProgress->setRange(0, total);
+        m_loadProgress->setValue(loaded);
+    });
+    connect(m_canvas, &DiagramCanvas::loadFinished, this, [this](bool ok) {
+        setLoadingUi(false);
+        if (ok) {
+            m_currentFilePath = m_loadingFilePath;
+            setWindowTitle(tr("Diagram Editor - %1").arg(QFileInfo(m_loadingFilePath).fileName()));
+            statusBar()->showMessage(tr("Loaded: %1").arg(m_loadingFilePath), 5000);
+        }
+        else {
+            setWindowTitle(tr("Diagram Editor - Untitled"));
+            QMessageBox::warning(this, tr("Failed to Open"), tr("Cannot open file: %1").arg(m_loadingFilePath));
+        }
+        m_canvas->startAutosave(m_currentFilePath);
+    });
+    connect(m_cancelLoadButton, &QToolButton::clicked, this, [this]() {
+        m_canvas->cancelLoading();
+        setLoadingUi(false);
+        setWindowTitle(tr("Diagram Editor - Untitled"));
+        m_canvas->startAutosave(QString());
+        statusBar()->showMessage(tr("Loading cancelled"), 5000);
+    });
+    // Left up until the next message: edits are not being journalled
+    connect(m_canvas, &DiagramCanvas::autosaveFailed, this, [this](const QString& message) {
+        statusBar()->showMessage(tr("Autosave failed: %1").arg(message));
+    });
     
 
 
@@ -199,9 +336,11 @@ void MainWindow::onCreateNewFile()
         if (reply == QMessageBox::Cancel) return;
     }
     m_canvas->clear();
+    setLoadingUi(false);
     m_currentFilePath.clear();
     setWindowTitle(tr("Diagram Editor - Untitled"));
     m_canvas->setModified(false);
+    m_canvas->startAutosave(QString());
 }
 
 void MainWindow::onOpenFile()
@@ -219,15 +358,15 @@ void MainWindow::onOpenFile()
     QString fileName = QFileDialog::getOpenFileName(this, tr("Open Diagram"), "", tr("Diagram Files (*.flow)"));
     if (fileName.isEmpty()) return;
 
-    if (FlowIO::load(fileName, m_canvas)) {
-        m_currentFilePath = fileName;
-        setWindowTitle(tr("Diagram Editor - %1").arg(QFileInfo(fileName).fileName()));
-        m_canvas->setModified(false);
-        statusBar()->showMessage(tr("Loaded: %1").arg(fileName), 5000);
-    }
-    else {
-        QMessageBox::warning(this, tr("Failed to Open"), tr("Cannot open file: %1").arg(fileName));
-    }
+    // Read in the background; the part in view shows up first and the
+    // canvas can be used while the rest arrives
+    m_loadingFilePath = fileName;
+    m_currentFilePath.clear();
+    setWindowTitle(tr("Diagram Editor - Loading %1").arg(QFileInfo(fileName).fileName()));
+    setLoadingUi(true);
+    // Journalling starts again once the file is in
+    m_canvas->stopAutosave();
+    m_canvas->loadDocument(fileName);
 }
 
 void MainWindow::onSaveFile()
@@ -237,8 +376,9 @@ void MainWindow::onSaveFile()
         return;
     }
 
-    if (FlowIO::save(m_currentFilePath, m_canvas)) {
+    if (FlowIO::save(m_currentFilePath, m_canvas, m_compressAction->isChecked())) {
         m_canvas->setModified(false);
+        m_canvas->startAutosave(m_currentFilePath);
         statusBar()->showMessage(tr("Saved: %1").arg(m_currentFilePath), 5000);
     }
     else {
@@ -255,10 +395,11 @@ void MainWindow::onSaveAsFile()
         fileName += ".flow";
     }
 
-    if (FlowIO::save(fileName, m_canvas)) {
+    if (FlowIO::save(fileName, m_canvas, m_compressAction->isChecked())) {
         m_currentFilePath = fileName;
         setWindowTitle(tr("Diagram Editor - %1").arg(QFileInfo(fileName).fileName()));
         m_canvas->setModified(false);
+        m_canvas->startAutosave(fileName);
         statusBar()->showMessage(tr("Saved: %1").arg(fileName), 5000);
     }
     else {
@@ -266,18 +407,116 @@ void MainWindow::onSaveAsFile()
     }
 }
 
+void MainWindow::recoverAutosave()
+{
+    for (const QString& journal : AutosaveJournal::orphanedJournals()) {
+        AutosaveJournal::Recovery recovery;
+        if (!AutosaveJournal::read(journal, recovery) || recovery.isEmpty()) {
+            AutosaveJournal::remove(journal);
+            continue;
+        }
+
+        const QString name = recovery.documentPath.isEmpty() ? tr("Untitled")
+                                                             : QFileInfo(recovery.documentPath).fileName();
+        QMessageBox::StandardButton reply = QMessageBox::question(
+            this, tr("Recover Diagram"),
+            tr("Diagram Editor did not shut down properly. Recover the unsaved changes to %1?").arg(name),
+            QMessageBox::Yes | QMessageBox::No
+        );
+        if (reply == QMessageBox::Yes) {
+            if (!m_canvas->recover(recovery)) {
+                QMessageBox::warning(this, tr("Failed to Recover"), tr("Cannot open file: %1").arg(recovery.documentPath));
+                AutosaveJournal::remove(journal);
+                continue;
+            }
+            AutosaveJournal::remove(journal);
+            m_currentFilePath = recovery.documentPath;
+            setWindowTitle(tr("Diagram Editor - %1").arg(name));
+            statusBar()->showMessage(tr("Recovered: %1").arg(name), 5000);
+            // The recovered edits are unsaved, so the new journal starts
+            // from a snapshot
+            m_canvas->startAutosave(m_currentFilePath);
+            // The canvas holds one document; any other journals are
+            // offered on the next start
+            return;
+        }
+        AutosaveJournal::remove(journal);
+    }
+}
+
 void MainWindow::onExportToPng()
 {
     QString fileName = QFileDialog::getSaveFileName(this, tr("Export PNG"), "", tr("PNG Image (*.png)"));
     if (fileName.isEmpty()) return;
     if (!fileName.endsWith(".png", Qt::CaseInsensitive)) fileName += ".png";
 
-    if (m_canvas->exportToPng(fileName)) {
-        statusBar()->showMessage(tr("Exported PNG: %1").arg(fileName), 5000);
+    // Area to export: the page, the content's extent or the selection
+    QVector<DiagramShape*> shapes = m_canvas->shapesInPaintOrder();
+    QVector<DiagramShape*> selected;
+    for (DiagramShape* shape : shapes) {
+        if (shape->getSelected()) selected.append(shape);
     }
-    else {
-        QMessageBox::warning(this, tr("Export Failed"), tr("Cannot export to PNG: %1").arg(fileName));
+    QStringList areas;
+    areas << tr("Whole page") << tr("Content extent");
+    if (!selected.isEmpty()) areas << tr("Selection");
+    bool ok;
+    int area = areas.indexOf(QInputDialog::getItem(this, tr("Export PNG"), tr("Area:"), areas, 0, false, &ok));
+    if (!ok) return;
+    // Document units are 96 DPI pixels
+    int dpi = QInputDialog::getInt(this, tr("Export PNG"), tr("Resolution (DPI):"), 96, 24, 2400, 1, &ok);
+    if (!ok) return;
+
+    QRectF sourceRect(QPointF(0, 0), QSizeF(m_canvas->canvasSize()));
+    if (area == 1) {
+        sourceRect = TiledImageExporter::contentBounds(shapes);
     }
+    else if (area == 2) {
+        shapes = selected;
+        sourceRect = TiledImageExporter::contentBounds(shapes);
+    }
+    if (sourceRect.isEmpty()) {
+        QMessageBox::information(this, tr("Export PNG"), tr("There is nothing to export."));
+        return;
+    }
+
+    // Shapes are copied here on the GUI thread; compiling, rendering and
+    // encoding run on the thread pool so the window keeps repainting (and
+    // can even be edited) meanwhile
+    auto exporter = std::make_shared<TiledImageExporter>(shapes, sourceRect,
+        m_canvas->backgroundColor(), dpi / 96.0);
+    auto cancelled = std::make_shared<std::atomic<bool>>(false);
+
+    QPointer<QProgressDialog> progress = new QProgressDialog(tr("Exporting PNG..."), tr("Cancel"),
+                                                             0, exporter->tileCount(), this);
+    progress->setAttribute(Qt::WA_DeleteOnClose);
+    progress->setMinimumDuration(500);
+    connect(progress, &QProgressDialog::canceled, this, [cancelled]() { *cancelled = true; });
+
+    auto* watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [this, watcher, progress, cancelled, fileName]() {
+        if (progress) progress->close();
+        if (*cancelled) {
+            statusBar()->showMessage(tr("PNG export cancelled"), 5000);
+        }
+        else if (watcher->result()) {
+            statusBar()->showMessage(tr("Exported PNG: %1").arg(fileName), 5000);
+        }
+        else {
+            QMessageBox::warning(this, tr("Export Failed"), tr("Cannot export to PNG: %1").arg(fileName));
+        }
+        watcher->deleteLater();
+    });
+
+    // Progress arrives on worker threads and is forwarded to the dialog
+    // through the event loop
+    auto onProgress = [this, progress](int done, int) {
+        QMetaObject::invokeMethod(this, [progress, done]() {
+            if (progress) progress->setValue(done);
+        }, Qt::QueuedConnection);
+    };
+    watcher->setFuture(QtConcurrent::run([exporter, cancelled, fileName, dpi, onProgress]() {
+        return exporter->exportToPng(fileName, dpi, onProgress, cancelled.get());
+    }));
 }
 
 void MainWindow::onExportToSvg()
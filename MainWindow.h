@@ -13,6 +13,9 @@ class DiagramCanvas;
 class ShapeToolBox;
 class PropertyPanel;
 class QAction;
+class QLabel;
+class QProgressBar;
+class QToolButton;
 
 class MainWindow : public QMainWindow
 {
@@ -43,6 +46,9 @@ private:
     void createActions();
     void createShortcuts();
     void setupConnections();
+    void setLoadingUi(bool loading);
+    // Offers to restore what a crashed session left in its autosave journal
+    void recoverAutosave();
     
     DiagramCanvas* m_canvas;
     ShapeToolBox* m_toolBox;
@@ -55,8 +61,11 @@ private:
     QAction* m_saveAsAction;
     QAction* m_exportPngAction;
     QAction* m_exportSvgAction;
+    QAction* m_compressAction;
     
     //EDITOR
+    QAction* m_undoAction;
+    QAction* m_redoAction;
     QAction* m_copyAction;
     QAction* m_cutAction;
     QAction* m_pasteAction;
@@ -68,10 +77,25 @@ private:
     QAction* m_sendToBackAction;
     QAction* m_bringForwardAction;
     QAction* m_sendBackwardAction;
+    QAction* m_layeredLayoutAction;
+    QAction* m_incrementalLayoutAction;
+    QAction* m_forceLayoutAction;
     
     //PAGE
     QAction* m_backgroundColorAction;
     QAction* m_canvasSizeAction;
     
+    //VIEW
+    QAction* m_zoomInAction;
+    QAction* m_zoomOutAction;
+    QAction* m_resetZoomAction;
+    QAction* m_zoomToFitAction;
+    QLabel* m_zoomLabel;
+
+    // Shown in the status bar while a document loads in the background
+    QProgressBar* m_loadProgress;
+    QToolButton* m_cancelLoadButton;
+    QString m_loadingFilePath;
+    
     QString m_currentFilePath;
 };
\ No newline at end of file
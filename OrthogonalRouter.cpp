@@ -0,0 +1,314 @@
+/**
+ * @file OrthogonalRouter.cpp
+ * @brief Implementation of the orthogonal connector router
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "OrthogonalRouter.h"
+#include <QHash>
+#include <QtMath>
+#include <algorithm>
+#include <limits>
+#include <queue>
+
+const qreal OrthogonalRouter::kMargin = 12.0;
+
+namespace {
+
+// A bend costs as much as this much extra length, a crossing this much
+const qreal kBendPenalty = 30.0;
+const qreal kCrossingPenalty = 60.0;
+// Above this many grid nodes the search is not worth it; the obstacle map
+// takes a byte per grid cell
+const qint64 kMaxNodes = 400000;
+const int kCancelCheckInterval = 1024;
+
+void sortUnique(QVector<qreal>& values)
+{
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+}
+
+// Drops repeated points and points in the middle of a straight run
+QVector<QPointF> simplify(const QVector<QPointF>& points)
+{
+    QVector<QPointF> result;
+    for (const QPointF& p : points) {
+        if (!result.isEmpty() && result.last() == p) continue;
+        if (result.size() >= 2) {
+            const QPointF& a = result[result.size() - 2];
+            const QPointF& b = result.last();
+            if ((a.x() == b.x() && b.x() == p.x()) || (a.y() == b.y() && b.y() == p.y())) {
+                result.last() = p;
+                continue;
+            }
+        }
+        result.append(p);
+    }
+    return result;
+}
+
+OrthogonalRouter::Result makeResult(const OrthogonalRouter::Request& request, const QVector<QPointF>& path)
+{
+    OrthogonalRouter::Result result;
+    result.connector = request.connector;
+    result.start = request.start;
+    result.end = request.end;
+    const QVector<QPointF> points = simplify(path);
+    result.controlPoints = points.mid(1, points.size() - 2);
+    return result;
+}
+
+// Stubs out of both shapes joined by a Z through the middle
+OrthogonalRouter::Result elbow(const OrthogonalRouter::Request& request, const QPointF& s, const QPointF& e)
+{
+    bool horizontal;
+    if (!request.startDirection.isNull()) {
+        horizontal = request.startDirection.y() == 0;
+    }
+    else if (!request.endDirection.isNull()) {
+        horizontal = request.endDirection.y() == 0;
+    }
+    else {
+        horizontal = qAbs(e.x() - s.x()) >= qAbs(e.y() - s.y());
+    }
+
+    QVector<QPointF> path;
+    path << request.start << s;
+    if (horizontal) {
+        const qreal mx = (s.x() + e.x()) / 2;
+        path << QPointF(mx, s.y()) << QPointF(mx, e.y());
+    }
+    else {
+        const qreal my = (s.y() + e.y()) / 2;
+        path << QPointF(s.x(), my) << QPointF(e.x(), my);
+    }
+    path << e << request.end;
+    return makeResult(request, path);
+}
+
+// Where other connectors cross each of the lines at values (y = value
+// for horizontal lines, x = value for vertical ones), sorted per line.
+// Segments ending on a line do not cross it.
+QVector<QVector<qreal>> lineCrossings(const QVector<QLineF>& others, const QVector<qreal>& values, bool horizontal)
+{
+    QVector<QVector<qreal>> crossings(values.size());
+    for (const QLineF& line : others) {
+        const qreal a = horizontal ? line.y1() : line.x1();
+        const qreal b = horizontal ? line.y2() : line.x2();
+        if (a == b) continue;
+        const qreal lo = qMin(a, b);
+        const qreal hi = qMax(a, b);
+        for (int k = int(std::upper_bound(values.begin(), values.end(), lo) - values.begin());
+             k < values.size() && values[k] < hi; ++k) {
+            const qreal t = (values[k] - a) / (b - a);
+            crossings[k].append(horizontal ? line.x1() + t * line.dx() : line.y1() + t * line.dy());
+        }
+    }
+    for (QVector<qreal>& positions : crossings) {
+        std::sort(positions.begin(), positions.end());
+    }
+    return crossings;
+}
+
+// Number of sorted positions strictly between lo and hi
+int countBetween(const QVector<qreal>& positions, qreal lo, qreal hi)
+{
+    return int(std::lower_bound(positions.begin(), positions.end(), hi)
+               - std::upper_bound(positions.begin(), positions.end(), lo));
+}
+
+} // namespace
+
+QPointF OrthogonalRouter::attachPoint(const DiagramShape* shape, DiagramShape::Port port,
+                                      const QPointF& target, QPointF& direction)
+{
+    const QRectF rect = shape->boundingRect();
+    if (port == DiagramShape::AutoPort) {
+        // The side facing the target, judged relative to the shape's aspect
+        const QPointF d = target - rect.center();
+        if (qAbs(d.x()) * rect.height() >= qAbs(d.y()) * rect.width()) {
+            port = d.x() >= 0 ? DiagramShape::RightPort : DiagramShape::LeftPort;
+        }
+        else {
+            port = d.y() >= 0 ? DiagramShape::BottomPort : DiagramShape::TopPort;
+        }
+    }
+    switch (port) {
+    case DiagramShape::TopPort: direction = QPointF(0, -1); break;
+    case DiagramShape::RightPort: direction = QPointF(1, 0); break;
+    case DiagramShape::BottomPort: direction = QPointF(0, 1); break;
+    default: direction = QPointF(-1, 0); break;
+    }
+    return shape->portPosition(port);
+}
+
+OrthogonalRouter::Result OrthogonalRouter::route(const Request& request, const std::atomic<bool>* cancelled)
+{
+    // Routes start and end with a stub straight out of the shape, which
+    // puts the search endpoints on the grown obstacle outlines
+    const QPointF s = request.start + request.startDirection * kMargin;
+    const QPointF e = request.end + request.endDirection * kMargin;
+
+    QVector<QRectF> grown;
+    grown.reserve(request.obstacles.size());
+    QRectF window = QRectF(s, e).normalized();
+    for (const QRectF& rect : request.obstacles) {
+        grown.append(rect.adjusted(-kMargin, -kMargin, kMargin, kMargin));
+        window |= grown.last();
+    }
+    window.adjust(-kMargin, -kMargin, kMargin, kMargin);
+
+    QVector<qreal> xs;
+    QVector<qreal> ys;
+    xs << s.x() << e.x() << window.left() << window.right();
+    ys << s.y() << e.y() << window.top() << window.bottom();
+    for (const QRectF& rect : grown) {
+        xs << rect.left() << rect.right();
+        ys << rect.top() << rect.bottom();
+    }
+    sortUnique(xs);
+    sortUnique(ys);
+    const int nx = xs.size();
+    const int ny = ys.size();
+    if (qint64(nx) * ny > kMaxNodes) {
+        return elbow(request, s, e);
+    }
+
+    // Cell (i, j) spans xs[i]..xs[i+1] by ys[j]..ys[j+1]. Every grown
+    // obstacle edge is a grid line, so each cell is either inside an
+    // obstacle or outside all of them.
+    const int cx = nx - 1;
+    const int cy = ny - 1;
+    QVector<bool> blocked(cx * cy, false);
+    for (const QRectF& rect : grown) {
+        const int i0 = int(std::lower_bound(xs.begin(), xs.end(), rect.left()) - xs.begin());
+        const int i1 = int(std::lower_bound(xs.begin(), xs.end(), rect.right()) - xs.begin());
+        const int j0 = int(std::lower_bound(ys.begin(), ys.end(), rect.top()) - ys.begin());
+        const int j1 = int(std::lower_bound(ys.begin(), ys.end(), rect.bottom()) - ys.begin());
+        for (int j = j0; j < j1; ++j) {
+            for (int i = i0; i < i1; ++i) {
+                blocked[j * cx + i] = true;
+            }
+        }
+    }
+    auto cellBlocked = [&](int i, int j) {
+        return i >= 0 && j >= 0 && i < cx && j < cy && blocked[j * cx + i];
+    };
+
+    // Edges only run along grid lines, so each line gets the crossings of
+    // the other connectors once, instead of every edge testing them all
+    const QVector<QVector<qreal>> rowCrossings = lineCrossings(request.otherSegments, ys, true);
+    const QVector<QVector<qreal>> columnCrossings = lineCrossings(request.otherSegments, xs, false);
+
+    const int startNode = int(std::lower_bound(ys.begin(), ys.end(), s.y()) - ys.begin()) * nx
+        + int(std::lower_bound(xs.begin(), xs.end(), s.x()) - xs.begin());
+    const int goalNode = int(std::lower_bound(ys.begin(), ys.end(), e.y()) - ys.begin()) * nx
+        + int(std::lower_bound(xs.begin(), xs.end(), e.x()) - xs.begin());
+
+    // States are node * 2 + orientation (0 horizontal, 1 vertical). Only
+    // the states the search reaches are stored, usually a small part of
+    // the grid.
+    struct Visit {
+        qreal cost;
+        int parent;
+    };
+    QHash<int, Visit> visits;
+    const qreal inf = std::numeric_limits<qreal>::max();
+    auto cost = [&](int state) {
+        const auto it = visits.constFind(state);
+        return it == visits.constEnd() ? inf : it->cost;
+    };
+
+    auto point = [&](int node) { return QPointF(xs[node % nx], ys[node / nx]); };
+    auto heuristic = [&](int node) {
+        const QPointF p = point(node);
+        return qAbs(p.x() - e.x()) + qAbs(p.y() - e.y());
+    };
+    auto orientationOf = [](const QPointF& direction) { return direction.y() != 0 ? 1 : 0; };
+
+    using Entry = std::pair<qreal, int>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+    if (request.startDirection.isNull()) {
+        for (int o = 0; o < 2; ++o) {
+            visits.insert(startNode * 2 + o, { 0, -1 });
+            open.push(Entry(heuristic(startNode), startNode * 2 + o));
+        }
+    }
+    else {
+        const int state = startNode * 2 + orientationOf(request.startDirection);
+        visits.insert(state, { 0, -1 });
+        open.push(Entry(heuristic(startNode), state));
+    }
+
+    int found = -1;
+    int pops = 0;
+    while (!open.empty()) {
+        const Entry top = open.top();
+        open.pop();
+        const int state = top.second;
+        const int node = state / 2;
+        const int orientation = state % 2;
+        const qreal reached = cost(state);
+        if (top.first > reached + heuristic(node)) continue; // stale entry
+        if (node == goalNode) {
+            found = state;
+            break;
+        }
+        if (++pops % kCancelCheckInterval == 0 && cancelled && cancelled->load()) {
+            return elbow(request, s, e);
+        }
+
+        const int i = node % nx;
+        const int j = node / nx;
+        // Left, right, up, down; an edge is blocked when the obstacle
+        // covers both sides of it
+        const int di[4] = { -1, 1, 0, 0 };
+        const int dj[4] = { 0, 0, -1, 1 };
+        for (int k = 0; k < 4; ++k) {
+            const int ni = i + di[k];
+            const int nj = j + dj[k];
+            if (ni < 0 || nj < 0 || ni >= nx || nj >= ny) continue;
+            const bool horizontal = k < 2;
+            const bool edgeBlocked = horizontal
+                ? cellBlocked(qMin(i, ni), j - 1) && cellBlocked(qMin(i, ni), j)
+                : cellBlocked(i - 1, qMin(j, nj)) && cellBlocked(i, qMin(j, nj));
+            if (edgeBlocked) continue;
+
+            const int next = nj * nx + ni;
+            const int nextOrientation = horizontal ? 0 : 1;
+            const QPointF a = point(node);
+            const QPointF b = point(next);
+            qreal step = qAbs(b.x() - a.x()) + qAbs(b.y() - a.y());
+            if (nextOrientation != orientation) step += kBendPenalty;
+            step += kCrossingPenalty * (horizontal
+                ? countBetween(rowCrossings[j], qMin(a.x(), b.x()), qMax(a.x(), b.x()))
+                : countBetween(columnCrossings[i], qMin(a.y(), b.y()), qMax(a.y(), b.y())));
+            // Arriving along the wrong axis means one more bend into the stub
+            if (next == goalNode && !request.endDirection.isNull()
+                && nextOrientation != orientationOf(request.endDirection)) {
+                step += kBendPenalty;
+            }
+
+            const int nextState = next * 2 + nextOrientation;
+            if (reached + step < cost(nextState)) {
+                visits.insert(nextState, { reached + step, state });
+                open.push(Entry(reached + step + heuristic(next), nextState));
+            }
+        }
+    }
+
+    if (found < 0) {
+        return elbow(request, s, e);
+    }
+
+    QVector<QPointF> path;
+    path << request.end << e;
+    for (int state = found; state >= 0; state = visits.value(state).parent) {
+        path << point(state / 2);
+    }
+    path << s << request.start;
+    std::reverse(path.begin(), path.end());
+    return makeResult(request, path);
+}
@@ -0,0 +1,52 @@
+/**
+ * @file OrthogonalRouter.h
+ * @brief Obstacle-avoiding orthogonal routing for connectors
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QLineF>
+#include <QPointF>
+#include <QRectF>
+#include <QVector>
+#include <atomic>
+#include "DiagramShape.h"
+
+// Finds Manhattan routes around shapes: A* over the grid of obstacle
+// edges, costing length plus a penalty per bend and per crossing.
+// Requests are value snapshots taken on the GUI thread, so route() can
+// run on any thread.
+class OrthogonalRouter
+{
+public:
+    struct Request {
+        ShapeId connector = 0;
+        QPointF start;
+        QPointF startDirection; // unit vector out of the start shape, null for a free end
+        QPointF end;
+        QPointF endDirection;
+        QVector<QRectF> obstacles;      // shape bounds near the route
+        QVector<QLineF> otherSegments;  // other connectors near the route
+    };
+
+    struct Result {
+        ShapeId connector = 0;
+        QPointF start;
+        QVector<QPointF> controlPoints;
+        QPointF end;
+    };
+
+    // Clearance kept between routes and shapes
+    static const qreal kMargin;
+
+    // Where an orthogonal end attaches to its shape: the named port, or
+    // for AutoPort the side facing target. direction is set to the unit
+    // vector pointing out of that side.
+    static QPointF attachPoint(const DiagramShape* shape, DiagramShape::Port port,
+                               const QPointF& target, QPointF& direction);
+
+    // Never fails: when the search finds nothing (or is cancelled) the
+    // result is a simple elbow between the ends
+    static Result route(const Request& request, const std::atomic<bool>* cancelled = nullptr);
+};
@@ -0,0 +1,256 @@
+/**
+ * @file PngStreamWriter.cpp
+ * @brief Implementation of the incremental PNG encoder
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "PngStreamWriter.h"
+#include "DeflateEncoder.h"
+#include <QIODevice>
+#include <QVector>
+#include <QtEndian>
+#include <QtMath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+// Compressed bytes per IDAT chunk
+const int kIdatSize = 256 * 1024;
+
+QByteArray bigEndian32(quint32 value)
+{
+    QByteArray bytes(4, Qt::Uninitialized);
+    qToBigEndian(value, reinterpret_cast<uchar*>(bytes.data()));
+    return bytes;
+}
+
+// CRC-32 as PNG chunks use it (ISO 3309), table driven
+quint32 crc32(const char* data, int size)
+{
+    static const QVector<quint32> table = []() {
+        QVector<quint32> entries(256);
+        for (quint32 n = 0; n < 256; ++n) {
+            quint32 c = n;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[int(n)] = c;
+        }
+        return entries;
+    }();
+
+    quint32 crc = 0xffffffffu;
+    for (int i = 0; i < size; ++i) {
+        crc = table[int((crc ^ quint8(data[i])) & 0xff)] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffffu;
+}
+
+enum FilterType {
+    FilterNone,
+    FilterSub,
+    FilterUp,
+    FilterAverage,
+    FilterPaeth
+};
+
+int paeth(int left, int up, int upLeft)
+{
+    const int estimate = left + up - upLeft;
+    const int toLeft = qAbs(estimate - left);
+    const int toUp = qAbs(estimate - up);
+    const int toUpLeft = qAbs(estimate - upLeft);
+    if (toLeft <= toUp && toLeft <= toUpLeft) return left;
+    return toUp <= toUpLeft ? up : upLeft;
+}
+
+// Filters a row of size bytes with bpp bytes per pixel into out and
+// returns the sum of the results taken as signed bytes, the usual guess at
+// how well the row will compress. Gives up once the sum reaches limit.
+quint64 filterRow(FilterType type, const uchar* row, const uchar* above, int size, int bpp,
+                  uchar* out, quint64 limit)
+{
+    quint64 sum = 0;
+    for (int i = 0; i < size && sum < limit; ++i) {
+        const int left = i >= bpp ? row[i - bpp] : 0;
+        int predicted = 0;
+        switch (type) {
+        case FilterNone:
+            break;
+        case FilterSub:
+            predicted = left;
+            break;
+        case FilterUp:
+            predicted = above[i];
+            break;
+        case FilterAverage:
+            predicted = (left + above[i]) / 2;
+            break;
+        case FilterPaeth:
+            predicted = paeth(left, above[i], i >= bpp ? above[i - bpp] : 0);
+            break;
+        }
+        out[i] = uchar(row[i] - predicted);
+        sum += quint64(qAbs(int(qint8(out[i]))));
+    }
+    return sum;
+}
+
+} // namespace
+
+PngStreamWriter::PngStreamWriter()
+    : m_device(nullptr)
+    , m_hasAlpha(false)
+    , m_dpi(0)
+    , m_rowsWritten(0)
+{
+}
+
+PngStreamWriter::~PngStreamWriter() = default;
+
+bool PngStreamWriter::begin(QIODevice* device, const QSize& size, bool hasAlpha)
+{
+    if (!device || !device->isWritable()) {
+        return fail(QStringLiteral("Device is not writable"));
+    }
+    if (size.isEmpty()) {
+        return fail(QStringLiteral("Image is empty"));
+    }
+
+    m_device = device;
+    m_size = size;
+    m_hasAlpha = hasAlpha;
+    m_rowsWritten = 0;
+
+    static const char signature[8] = { '\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n' };
+    if (m_device->write(signature, sizeof(signature)) != qint64(sizeof(signature))) {
+        return fail(m_device->errorString());
+    }
+
+    QByteArray header;
+    header += bigEndian32(quint32(size.width()));
+    header += bigEndian32(quint32(size.height()));
+    header += char(8);                   // bits per channel
+    header += char(hasAlpha ? 6 : 2);    // RGBA or RGB
+    header += char(0);                   // deflate
+    header += char(0);                   // adaptive filtering
+    header += char(0);                   // not interlaced
+    if (!writeChunk("IHDR", header)) {
+        return false;
+    }
+
+    if (m_dpi > 0) {
+        const quint32 perMeter = quint32(qRound(m_dpi / 0.0254));
+        QByteArray phys = bigEndian32(perMeter) + bigEndian32(perMeter);
+        phys += char(1); // unit: metre
+        if (!writeChunk("pHYs", phys)) {
+            return false;
+        }
+    }
+
+    m_deflate.reset(new DeflateEncoder);
+
+    // Filter type byte followed by the filtered pixels of one row; the
+    // row above the first one counts as zeros
+    const int rowBytes = size.width() * (hasAlpha ? 4 : 3);
+    m_row.resize(1 + rowBytes);
+    m_candidate.resize(1 + rowBytes);
+    m_previous.fill(0, rowBytes);
+    return true;
+}
+
+bool PngStreamWriter::writeRows(const QImage& band)
+{
+    if (!m_deflate) {
+        return fail(QStringLiteral("Writer is not open"));
+    }
+    if (band.width() != m_size.width() || m_rowsWritten + band.height() > m_size.height()) {
+        return fail(QStringLiteral("Band does not fit the image"));
+    }
+
+    // Un-premultiplies and packs the channels in PNG byte order
+    const QImage rows = band.convertToFormat(m_hasAlpha ? QImage::Format_RGBA8888 : QImage::Format_RGB888);
+    const int rowBytes = m_previous.size();
+    const int bpp = m_hasAlpha ? 4 : 3;
+    const uchar* above = reinterpret_cast<const uchar*>(m_previous.constData());
+    for (int y = 0; y < rows.height(); ++y) {
+        // Every filter is tried and the one with the smallest output kept:
+        // Sub suits flat fills, Up and Paeth edges and gradients
+        const uchar* row = rows.constScanLine(y);
+        quint64 best = filterRow(FilterNone, row, above, rowBytes, bpp,
+                                 reinterpret_cast<uchar*>(m_row.data()) + 1, std::numeric_limits<quint64>::max());
+        m_row[0] = char(FilterNone);
+        for (int type = FilterSub; type <= FilterPaeth; ++type) {
+            const quint64 sum = filterRow(FilterType(type), row, above, rowBytes, bpp,
+                                          reinterpret_cast<uchar*>(m_candidate.data()) + 1, best);
+            if (sum < best) {
+                best = sum;
+                m_candidate[0] = char(type);
+                m_row.swap(m_candidate);
+            }
+        }
+        m_deflate->write(reinterpret_cast<const uchar*>(m_row.constData()), m_row.size());
+        above = row;
+        if (!flushIdat(false)) {
+            return false;
+        }
+    }
+    // The next band is filtered against the last row of this one
+    if (rows.height() > 0) {
+        std::memcpy(m_previous.data(), above, rowBytes);
+    }
+    m_rowsWritten += rows.height();
+    return true;
+}
+
+bool PngStreamWriter::finish()
+{
+    if (!m_deflate) {
+        return fail(QStringLiteral("Writer is not open"));
+    }
+    if (m_rowsWritten != m_size.height()) {
+        return fail(QStringLiteral("Only %1 of %2 rows were written").arg(m_rowsWritten).arg(m_size.height()));
+    }
+    m_deflate->finish();
+    if (!flushIdat(true)) {
+        return false;
+    }
+    m_deflate.reset();
+    return writeChunk("IEND", QByteArray());
+}
+
+bool PngStreamWriter::writeChunk(const char* type, const QByteArray& data)
+{
+    QByteArray chunk = bigEndian32(quint32(data.size()));
+    chunk.append(type, 4);
+    chunk += data;
+    // The CRC covers the type and the data, not the length
+    chunk += bigEndian32(crc32(chunk.constData() + 4, chunk.size() - 4));
+    if (m_device->write(chunk) != chunk.size()) {
+        return fail(m_device->errorString());
+    }
+    return true;
+}
+
+bool PngStreamWriter::flushIdat(bool final)
+{
+    QByteArray& out = m_deflate->output();
+    int written = 0;
+    while (out.size() - written >= kIdatSize || (final && out.size() > written)) {
+        const int size = qMin(kIdatSize, out.size() - written);
+        if (!writeChunk("IDAT", QByteArray::fromRawData(out.constData() + written, size))) {
+            return false;
+        }
+        written += size;
+    }
+    out.remove(0, written);
+    return true;
+}
+
+bool PngStreamWriter::fail(const QString& message)
+{
+    m_error = message;
+    return false;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file PngStreamWriter.h
+ * @brief Incremental PNG encoder fed one band of rows at a time
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QImage>
+#include <QSize>
+#include <QString>
+#include <QByteArray>
+#include <memory>
+
+class QIODevice;
+class DeflateEncoder;
+
+// Writes a PNG whose rows arrive in bands from top to bottom, so the whole
+// image never has to exist in memory. QImageWriter needs the complete
+// image, which is not an option for poster-size exports.
+//
+// Each row is stored with whichever PNG filter makes it look the most
+// compressible, deflated as it arrives (see DeflateEncoder) and flushed to
+// the device in IDAT chunks of a fixed size; memory use is one band plus
+// the compression window.
+class PngStreamWriter
+{
+public:
+    PngStreamWriter();
+    ~PngStreamWriter();
+    PngStreamWriter(const PngStreamWriter&) = delete;
+    PngStreamWriter& operator=(const PngStreamWriter&) = delete;
+
+    // Written as a pHYs chunk when > 0; call before begin()
+    void setDotsPerInch(qreal dpi) { m_dpi = dpi; }
+
+    // Writes the signature and header. Without alpha the image is stored
+    // as RGB, which makes the file a quarter smaller.
+    bool begin(QIODevice* device, const QSize& size, bool hasAlpha);
+    // Appends the rows of band below the ones already written; the band
+    // must be as wide as the image
+    bool writeRows(const QImage& band);
+    // Flushes the compressed stream and writes the trailer; fails if fewer
+    // rows than the image height were written
+    bool finish();
+
+    int rowsWritten() const { return m_rowsWritten; }
+    QString errorString() const { return m_error; }
+
+private:
+    bool writeChunk(const char* type, const QByteArray& data);
+    // Writes the compressed bytes so far as IDAT chunks of kIdatSize; all
+    // of them when final
+    bool flushIdat(bool final);
+    bool fail(const QString& message);
+
+    QIODevice* m_device;
+    QSize m_size;
+    bool m_hasAlpha;
+    qreal m_dpi;
+    int m_rowsWritten;
+    std::unique_ptr<DeflateEncoder> m_deflate; // null unless open
+    // The filtered row being written, the filter being tried, and the row
+    // above unfiltered
+    QByteArray m_row;
+    QByteArray m_candidate;
+    QByteArray m_previous;
+    QString m_error;
+};
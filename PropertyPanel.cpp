@@ -6,6 +6,7 @@
  */
 
 #include "PropertyPanel.h"
+#include "UndoJournal.h"
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QFormLayout>
@@ -151,6 +152,8 @@ void PropertyPanel::onFillColorClicked()
 
     QColor color = QColorDialog::getColor(m_shape->getColor(), this, tr("Select fill color"));
     if (color.isValid()) {
+        emit propertyChanged(m_shape, UndoJournal::FillColor, QVariant::fromValue(m_shape->getColor()),
+                             QVariant::fromValue(color));
         m_shape->setColor(color);
         QString styleSheet = QString("background-color: %1;").arg(color.name());
         m_fillColorBtn->setStyleSheet(styleSheet);
@@ -165,6 +168,8 @@ void PropertyPanel::onLineColorClicked()
 
     QColor color = QColorDialog::getColor(m_shape->getLineColor(), this, tr("Select line color"));
     if (color.isValid()) {
+        emit propertyChanged(m_shape, UndoJournal::LineColor, QVariant::fromValue(m_shape->getLineColor()),
+                             QVariant::fromValue(color));
         m_shape->setLineColor(color);
         QString styleSheet = QString("background-color: %1;").arg(color.name());
         m_lineColorBtn->setStyleSheet(styleSheet);
@@ -177,6 +182,7 @@ void PropertyPanel::onLineWidthChanged(int width)
 {
     if (!m_shape) return;
 
+    emit propertyChanged(m_shape, UndoJournal::LineWidth, m_shape->getLineWidth(), width);
     m_shape->setLineWidth(width);
     emit shapeChanged();
 }
@@ -186,6 +192,7 @@ void PropertyPanel::onTextChanged()
 {
     if (!m_shape) return;
 
+    emit propertyChanged(m_shape, UndoJournal::Text, m_shape->getText(), m_textEdit->text());
     m_shape->setText(m_textEdit->text());
     emit shapeChanged();
 }
@@ -25,6 +25,10 @@ public:
     
 signals:
     void shapeChanged();
+    // Every edit with the value it replaced, for the undo journal;
+    // property is an UndoJournal::Property
+    void propertyChanged(std::shared_ptr<DiagramShape> shape, int property,
+                         const QVariant& before, const QVariant& after);
     
 private slots:
     void onFillColorClicked();
@@ -0,0 +1,202 @@
+/**
+ * @file RenderList.cpp
+ * @brief Implementation of the batched render list
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "RenderList.h"
+#include "DiagramShape.h"
+#include "TextLayoutCache.h"
+#include <QPainter>
+#include <QtMath>
+
+namespace {
+
+// How many batches back a primitive may look for one to join. Bounds the
+// compile cost per primitive while still catching the usual pattern of
+// shape, label, shape, label...
+const int kBatchSearchDepth = 32;
+
+} // namespace
+
+RenderList::RenderList(qreal lod)
+    : m_lod(lod > 0 ? lod : 1.0)
+    , m_detachedText(false)
+    , m_drawSelection(true)
+    , m_pen(Qt::black)
+    , m_brush(Qt::NoBrush)
+    , m_primitiveCount(0)
+{
+}
+
+qreal RenderList::levelOfDetail(const QPainter* painter)
+{
+    // Same measure QGraphicsView uses: the scale of a unit square
+    const QTransform& t = painter->worldTransform();
+    return qSqrt(qAbs(t.determinant()));
+}
+
+void RenderList::clear()
+{
+    m_batches.clear();
+    m_primitiveCount = 0;
+    m_pen = QPen(Qt::black);
+    m_brush = QBrush(Qt::NoBrush);
+}
+
+void RenderList::addRect(const QRectF& rect)
+{
+    batchFor(Rects, strokeBounds(rect)).rects.append(rect);
+}
+
+void RenderList::addEllipse(const QRectF& rect)
+{
+    batchFor(Ellipses, strokeBounds(rect)).rects.append(rect);
+}
+
+void RenderList::addPolygon(const QPolygonF& polygon)
+{
+    batchFor(Polygons, strokeBounds(polygon.boundingRect())).polygons.append(polygon);
+}
+
+void RenderList::addLine(const QLineF& line)
+{
+    const QRectF rect = QRectF(line.p1(), line.p2()).normalized();
+    batchFor(Lines, strokeBounds(rect)).lines.append(line);
+}
+
+void RenderList::addPolyline(const QPolygonF& polyline)
+{
+    batchFor(Polylines, strokeBounds(polyline.boundingRect())).polygons.append(polyline);
+}
+
+void RenderList::addText(TextLayoutCache* layout, const QRectF& rect, const QString& text,
+                         const QFont& font, int flags)
+{
+    if (!layout || text.isEmpty()) return;
+    // TextLayoutCache clips anything that does not fit, so the rect bounds it
+    const qreal fringe = 1.0 / m_lod;
+    batchFor(Texts, rect.adjusted(-fringe, -fringe, fringe, fringe))
+        .texts.append(TextItem{ m_detachedText ? nullptr : layout, rect, text, font, flags });
+}
+
+void RenderList::addShapes(const QVector<DiagramShape*>& shapes)
+{
+    for (const DiagramShape* shape : shapes) {
+        shape->compile(*this);
+    }
+}
+
+void RenderList::paintShapes(QPainter* painter, const QVector<DiagramShape*>& shapes)
+{
+    RenderList list(levelOfDetail(painter));
+    list.addShapes(shapes);
+    list.replay(painter);
+}
+
+void RenderList::replay(QPainter* painter) const
+{
+    if (m_batches.isEmpty()) return;
+
+    painter->save();
+    const Batch* previous = nullptr;
+    for (const Batch& batch : m_batches) {
+        if (!previous || previous->pen != batch.pen) {
+            painter->setPen(batch.pen);
+        }
+        if (!previous || previous->brush != batch.brush) {
+            painter->setBrush(batch.brush);
+        }
+        previous = &batch;
+
+        switch (batch.kind) {
+        case Rects:
+            painter->drawRects(batch.rects);
+            break;
+        case Ellipses:
+            for (const QRectF& rect : batch.rects) {
+                painter->drawEllipse(rect);
+            }
+            break;
+        case Polygons:
+            for (const QPolygonF& polygon : batch.polygons) {
+                painter->drawPolygon(polygon);
+            }
+            break;
+        case Lines:
+            painter->drawLines(batch.lines);
+            break;
+        case Polylines:
+            for (const QPolygonF& polyline : batch.polygons) {
+                painter->drawPolyline(polyline);
+            }
+            break;
+        case Texts:
+            // Fonts are baked into each layout, so only the pen matters here
+            for (const TextItem& item : batch.texts) {
+                if (item.layout) {
+                    item.layout->draw(painter, item.rect, item.text, item.font, item.flags);
+                }
+                else {
+                    painter->setFont(item.font);
+                    painter->drawText(item.rect, item.flags, item.text);
+                }
+            }
+            break;
+        }
+    }
+    painter->restore();
+}
+
+RenderList::Batch& RenderList::batchFor(Kind kind, const QRectF& bounds)
+{
+    ++m_primitiveCount;
+
+    // Lines and text are never filled, so the brush must not split them
+    const bool usesBrush = kind == Rects || kind == Ellipses || kind == Polygons;
+    const QBrush brush = usesBrush ? m_brush : QBrush(Qt::NoBrush);
+
+    // drawRects fills every rect before stroking any, so a filled and
+    // outlined rect has to stay out of batches it overlaps
+    const bool fillsBeforeStroke = kind == Rects && brush.style() != Qt::NoBrush
+        && m_pen.style() != Qt::NoPen;
+
+    const int stop = qMax(0, m_batches.size() - kBatchSearchDepth);
+    for (int i = m_batches.size() - 1; i >= stop; --i) {
+        Batch& batch = m_batches[i];
+        const bool overlaps = batch.bounds.intersects(bounds);
+        if (batch.kind == kind && batch.pen == m_pen && batch.brush == brush) {
+            if (overlaps && fillsBeforeStroke) {
+                break;
+            }
+            batch.bounds |= bounds;
+            return batch;
+        }
+        if (overlaps) {
+            // Must stay above this batch, so it cannot move in front of it
+            break;
+        }
+    }
+
+    Batch batch;
+    batch.kind = kind;
+    batch.pen = m_pen;
+    batch.brush = brush;
+    batch.bounds = bounds;
+    m_batches.append(batch);
+    return m_batches.last();
+}
+
+QRectF RenderList::strokeBounds(const QRectF& rect) const
+{
+    // A full pen width rather than half covers square caps and bevel
+    // joins; one more device pixel covers the antialiasing fringe
+    qreal width = 0;
+    if (m_pen.style() != Qt::NoPen) {
+        width = m_pen.isCosmetic() ? qMax<qreal>(m_pen.widthF(), 1.0) / m_lod
+                                   : qMax(m_pen.widthF(), 1.0 / m_lod);
+    }
+    const qreal margin = width + 1.0 / m_lod;
+    return rect.adjusted(-margin, -margin, margin, margin);
+}
@@ -0,0 +1,124 @@
+/**
+ * @file RenderList.h
+ * @brief Draw batches compiled from shapes and replayed with few state changes
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QBrush>
+#include <QFont>
+#include <QLineF>
+#include <QPen>
+#include <QPolygonF>
+#include <QRectF>
+#include <QString>
+#include <QVector>
+
+class QPainter;
+class DiagramShape;
+class TextLayoutCache;
+
+// Shapes describe themselves into a render list instead of drawing
+// directly: the current pen and brush are set like on a QPainter, then
+// primitives are added. Primitives with the same kind and style go into
+// one batch, which replay() draws with a single drawRects/drawLines call
+// (or a tight loop for ellipses, polygons and text) after setting the pen
+// and brush once.
+//
+// Paint order is kept wherever it is visible: a primitive only joins an
+// earlier batch if it does not overlap anything added after that batch,
+// and filled shapes never join a batch they overlap, since drawRects fills
+// all rects before stroking any of them.
+class RenderList
+{
+public:
+    enum Kind {
+        Rects,
+        Ellipses,
+        Polygons,
+        Lines,
+        Polylines,
+        Texts
+    };
+
+    // lod is the device pixels per document unit the list will be drawn at
+    explicit RenderList(qreal lod = 1.0);
+
+    // Scale of a unit square under the painter's transform
+    static qreal levelOfDetail(const QPainter* painter);
+    qreal levelOfDetail() const { return m_lod; }
+
+    void clear();
+    bool isEmpty() const { return m_batches.isEmpty(); }
+    int batchCount() const { return m_batches.size(); }
+    int primitiveCount() const { return m_primitiveCount; }
+
+    // Text is normally drawn through the shapes' layout caches, which are
+    // not thread safe. A detached list draws text with QPainter::drawText
+    // and keeps no pointers into the shapes, so it can be replayed on any
+    // thread (and by several threads at once) after compiling.
+    void setDetachedText(bool detached) { m_detachedText = detached; }
+    bool detachedText() const { return m_detachedText; }
+
+    // Selection outlines and handles are editor chrome; exports turn them off
+    void setDrawSelection(bool draw) { m_drawSelection = draw; }
+    bool drawSelection() const { return m_drawSelection; }
+
+    void setPen(const QPen& pen) { m_pen = pen; }
+    void setBrush(const QBrush& brush) { m_brush = brush; }
+
+    void addRect(const QRectF& rect);
+    void addEllipse(const QRectF& rect);
+    void addPolygon(const QPolygonF& polygon);
+    void addLine(const QLineF& line);
+    void addPolyline(const QPolygonF& polyline);
+    // Drawn through the shape's layout cache, centred in rect. The layout
+    // must outlive the list unless the list is detached.
+    void addText(TextLayoutCache* layout, const QRectF& rect, const QString& text,
+                 const QFont& font, int flags);
+
+    // Compiles each shape in order
+    void addShapes(const QVector<DiagramShape*>& shapes);
+
+    // Compiles shapes (in paint order) at the painter's level of detail
+    // and replays them
+    static void paintShapes(QPainter* painter, const QVector<DiagramShape*>& shapes);
+
+    // Draws all batches. The painter state is saved and restored once
+    // around the whole list, not per shape.
+    void replay(QPainter* painter) const;
+
+private:
+    struct TextItem {
+        TextLayoutCache* layout; // null in detached lists
+        QRectF rect;
+        QString text;
+        QFont font;
+        int flags;
+    };
+
+    struct Batch {
+        Kind kind;
+        QPen pen;
+        QBrush brush;
+        QRectF bounds; // union of the painted area of every primitive
+        QVector<QRectF> rects;
+        QVector<QLineF> lines;
+        QVector<QPolygonF> polygons;
+        QVector<TextItem> texts;
+    };
+
+    // Finds a batch the primitive may join without changing the result, or
+    // opens a new one
+    Batch& batchFor(Kind kind, const QRectF& bounds);
+    QRectF strokeBounds(const QRectF& rect) const;
+
+    qreal m_lod;
+    bool m_detachedText;
+    bool m_drawSelection;
+    QPen m_pen;
+    QBrush m_brush;
+    QVector<Batch> m_batches;
+    int m_primitiveCount;
+};
@@ -0,0 +1,195 @@
+/**
+ * @file SegmentHitTest.cpp
+ * @brief Implementation of batch point-to-segment distance queries
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "SegmentHitTest.h"
+#include <QtGlobal>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SEGMENT_HIT_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SEGMENT_HIT_SSE2 1
+#endif
+
+namespace {
+
+// Distance from p to segment a + t*d, t clamped to [0, 1]
+inline double distanceSq(double px, double py, double x0, double y0,
+                         double dx, double dy, double invLengthSq)
+{
+    const double rx = px - x0;
+    const double ry = py - y0;
+    double t = (rx * dx + ry * dy) * invLengthSq;
+    t = t < 0.0 ? 0.0 : (t > 1.0 ? 1.0 : t);
+    const double ex = rx - t * dx;
+    const double ey = ry - t * dy;
+    return ex * ex + ey * ey;
+}
+
+} // namespace
+
+void SegmentBuffer::clear()
+{
+    m_count = 0;
+    m_data.clear();
+}
+
+void SegmentBuffer::assign(const QPolygonF& polyline)
+{
+    m_count = qMax(0, int(polyline.size()) - 1);
+    m_data.resize(ColumnCount * m_count);
+
+    double* x0 = column(X0);
+    double* y0 = column(Y0);
+    double* dx = column(Dx);
+    double* dy = column(Dy);
+    double* inv = column(InvLengthSq);
+    double* minX = column(MinX);
+    double* minY = column(MinY);
+    double* maxX = column(MaxX);
+    double* maxY = column(MaxY);
+    for (int i = 0; i < m_count; ++i) {
+        const QPointF& from = polyline[i];
+        const QPointF& to = polyline[i + 1];
+        x0[i] = from.x();
+        y0[i] = from.y();
+        dx[i] = to.x() - from.x();
+        dy[i] = to.y() - from.y();
+        const double lengthSq = dx[i] * dx[i] + dy[i] * dy[i];
+        inv[i] = lengthSq > 0.0 ? 1.0 / lengthSq : 0.0;
+        minX[i] = qMin(from.x(), to.x());
+        minY[i] = qMin(from.y(), to.y());
+        maxX[i] = qMax(from.x(), to.x());
+        maxY[i] = qMax(from.y(), to.y());
+    }
+}
+
+void SegmentBuffer::translate(const QPointF& delta)
+{
+    // Directions and lengths are unaffected by a translation
+    for (Column c : { X0, MinX, MaxX }) {
+        double* x = column(c);
+        for (int i = 0; i < m_count; ++i) {
+            x[i] += delta.x();
+        }
+    }
+    for (Column c : { Y0, MinY, MaxY }) {
+        double* y = column(c);
+        for (int i = 0; i < m_count; ++i) {
+            y[i] += delta.y();
+        }
+    }
+}
+
+bool SegmentBuffer::anyWithin(double px, double py, double tolerance) const
+{
+    // The box and distance tests run in the vector lanes together, and the
+    // loop stops at the first lane that passes both
+    const double* x0 = column(X0);
+    const double* y0 = column(Y0);
+    const double* dx = column(Dx);
+    const double* dy = column(Dy);
+    const double* inv = column(InvLengthSq);
+    const double* minX = column(MinX);
+    const double* minY = column(MinY);
+    const double* maxX = column(MaxX);
+    const double* maxY = column(MaxY);
+    const int n = m_count;
+    const double toleranceSq = tolerance * tolerance;
+    int i = 0;
+
+#if defined(SEGMENT_HIT_AVX)
+    const __m256d vpx = _mm256_set1_pd(px);
+    const __m256d vpy = _mm256_set1_pd(py);
+    const __m256d vtol = _mm256_set1_pd(tolerance);
+    const __m256d vtolSq = _mm256_set1_pd(toleranceSq);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    for (; i + 4 <= n; i += 4) {
+        const __m256d inX = _mm256_and_pd(
+            _mm256_cmp_pd(vpx, _mm256_sub_pd(_mm256_loadu_pd(minX + i), vtol), _CMP_GE_OQ),
+            _mm256_cmp_pd(vpx, _mm256_add_pd(_mm256_loadu_pd(maxX + i), vtol), _CMP_LE_OQ));
+        const __m256d inY = _mm256_and_pd(
+            _mm256_cmp_pd(vpy, _mm256_sub_pd(_mm256_loadu_pd(minY + i), vtol), _CMP_GE_OQ),
+            _mm256_cmp_pd(vpy, _mm256_add_pd(_mm256_loadu_pd(maxY + i), vtol), _CMP_LE_OQ));
+        const __m256d inBox = _mm256_and_pd(inX, inY);
+        if (_mm256_movemask_pd(inBox) == 0) continue;
+
+        const __m256d vdx = _mm256_loadu_pd(dx + i);
+        const __m256d vdy = _mm256_loadu_pd(dy + i);
+        const __m256d rx = _mm256_sub_pd(vpx, _mm256_loadu_pd(x0 + i));
+        const __m256d ry = _mm256_sub_pd(vpy, _mm256_loadu_pd(y0 + i));
+        __m256d t = _mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(rx, vdx), _mm256_mul_pd(ry, vdy)),
+                                  _mm256_loadu_pd(inv + i));
+        t = _mm256_min_pd(_mm256_max_pd(t, zero), one);
+        const __m256d ex = _mm256_sub_pd(rx, _mm256_mul_pd(t, vdx));
+        const __m256d ey = _mm256_sub_pd(ry, _mm256_mul_pd(t, vdy));
+        const __m256d d = _mm256_add_pd(_mm256_mul_pd(ex, ex), _mm256_mul_pd(ey, ey));
+        if (_mm256_movemask_pd(_mm256_and_pd(inBox, _mm256_cmp_pd(d, vtolSq, _CMP_LE_OQ)))) {
+            return true;
+        }
+    }
+#elif defined(SEGMENT_HIT_SSE2)
+    const __m128d vpx = _mm_set1_pd(px);
+    const __m128d vpy = _mm_set1_pd(py);
+    const __m128d vtol = _mm_set1_pd(tolerance);
+    const __m128d vtolSq = _mm_set1_pd(toleranceSq);
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d one = _mm_set1_pd(1.0);
+    for (; i + 2 <= n; i += 2) {
+        const __m128d inX = _mm_and_pd(
+            _mm_cmpge_pd(vpx, _mm_sub_pd(_mm_loadu_pd(minX + i), vtol)),
+            _mm_cmple_pd(vpx, _mm_add_pd(_mm_loadu_pd(maxX + i), vtol)));
+        const __m128d inY = _mm_and_pd(
+            _mm_cmpge_pd(vpy, _mm_sub_pd(_mm_loadu_pd(minY + i), vtol)),
+            _mm_cmple_pd(vpy, _mm_add_pd(_mm_loadu_pd(maxY + i), vtol)));
+        const __m128d inBox = _mm_and_pd(inX, inY);
+        if (_mm_movemask_pd(inBox) == 0) continue;
+
+        const __m128d vdx = _mm_loadu_pd(dx + i);
+        const __m128d vdy = _mm_loadu_pd(dy + i);
+        const __m128d rx = _mm_sub_pd(vpx, _mm_loadu_pd(x0 + i));
+        const __m128d ry = _mm_sub_pd(vpy, _mm_loadu_pd(y0 + i));
+        __m128d t = _mm_mul_pd(_mm_add_pd(_mm_mul_pd(rx, vdx), _mm_mul_pd(ry, vdy)),
+                               _mm_loadu_pd(inv + i));
+        t = _mm_min_pd(_mm_max_pd(t, zero), one);
+        const __m128d ex = _mm_sub_pd(rx, _mm_mul_pd(t, vdx));
+        const __m128d ey = _mm_sub_pd(ry, _mm_mul_pd(t, vdy));
+        const __m128d d = _mm_add_pd(_mm_mul_pd(ex, ex), _mm_mul_pd(ey, ey));
+        if (_mm_movemask_pd(_mm_and_pd(inBox, _mm_cmple_pd(d, vtolSq)))) {
+            return true;
+        }
+    }
+#endif
+
+    // Scalar tail, or the whole range without SIMD support
+    for (; i < n; ++i) {
+        if (px >= minX[i] - tolerance && px <= maxX[i] + tolerance
+            && py >= minY[i] - tolerance && py <= maxY[i] + tolerance
+            && distanceSq(px, py, x0[i], y0[i], dx[i], dy[i], inv[i]) <= toleranceSq) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SegmentBuffer::anyWithin(const QPointF& point, double tolerance) const
+{
+    return anyWithin(point.x(), point.y(), tolerance);
+}
+
+void SegmentBuffer::anyWithin(const QVector<const SegmentBuffer*>& buffers, const QPointF& point,
+                              double tolerance, QVector<bool>& hits)
+{
+    hits.resize(buffers.size());
+    const double px = point.x();
+    const double py = point.y();
+    for (int b = 0; b < buffers.size(); ++b) {
+        hits[b] = buffers[b]->anyWithin(px, py, tolerance);
+    }
+}
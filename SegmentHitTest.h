@@ -0,0 +1,62 @@
+/**
+ * @file SegmentHitTest.h
+ * @brief Packed line segments and batch point-distance queries
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QPointF>
+#include <QPolygonF>
+#include <QVector>
+
+// The segments of a polyline, stored as a structure of arrays (start
+// point, direction, inverse squared length and bounding box per segment)
+// packed into a single allocation.
+//
+// Queries run an SIMD kernel (AVX or SSE2, scalar otherwise) straight over
+// the columns: each group of lanes tests the segments' boxes and exact
+// distances at once, and the kernel stops at the first segment that
+// passes both. The batch form runs it over all candidates of a spatial
+// query in one call.
+class SegmentBuffer
+{
+public:
+    void clear();
+    // Replaces the contents with the segments between consecutive points
+    void assign(const QPolygonF& polyline);
+    void translate(const QPointF& delta);
+
+    int size() const { return m_count; }
+    bool isEmpty() const { return m_count == 0; }
+
+    // True if any segment passes within tolerance of point
+    bool anyWithin(const QPointF& point, double tolerance) const;
+
+    // Sets hits[i] to whether buffers[i] has a segment within tolerance
+    // of point; hits is resized to match
+    static void anyWithin(const QVector<const SegmentBuffer*>& buffers, const QPointF& point,
+                          double tolerance, QVector<bool>& hits);
+
+private:
+    enum Column {
+        X0,
+        Y0,
+        Dx,
+        Dy,
+        InvLengthSq, // 0 for degenerate segments
+        MinX,
+        MinY,
+        MaxX,
+        MaxY,
+        ColumnCount
+    };
+
+    const double* column(Column c) const { return m_data.constData() + c * m_count; }
+    double* column(Column c) { return m_data.data() + c * m_count; }
+    bool anyWithin(double px, double py, double tolerance) const;
+
+    int m_count = 0;
+    // ColumnCount columns of m_count values each, one after the other
+    QVector<double> m_data;
+};
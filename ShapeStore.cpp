@@ -0,0 +1,451 @@
+/**
+ * @file ShapeStore.cpp
+ * @brief Implementation of the paint-ordered shape store
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "ShapeStore.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+std::pmr::memory_resource* ShapeStore::pool()
+{
+    // Synchronized because batch export loads documents on pool threads.
+    // Never destroyed, so shapes still alive during static destruction
+    // can be freed safely.
+    static auto* resource = new std::pmr::synchronized_pool_resource();
+    return resource;
+}
+
+ShapeStore::ShapeStore(qreal cellSize)
+    : m_index(&m_bounds, cellSize)
+{
+}
+
+ShapeId ShapeStore::append(const std::shared_ptr<DiagramShape>& shape, quint8 flags)
+{
+    return insert(shape, m_paint.isEmpty() ? 0 : m_z[m_paint.last()] + 1, flags);
+}
+
+ShapeId ShapeStore::insert(const std::shared_ptr<DiagramShape>& shape, qreal z, quint8 flags)
+{
+    if (!shape) return 0;
+    if (contains(shape.get())) return shape->getId();
+
+    ShapeId id = shape->getId();
+    if (id == 0 || m_rows.contains(id)) {
+        id = m_nextId;
+    }
+    m_nextId = qMax(m_nextId, id + 1);
+    shape->setId(id);
+
+    // A restack in the meantime may have taken the key
+    int at = paintPositionFor(z);
+    while (at < m_paint.size() && m_z[m_paint[at]] == z) {
+        z = std::nextafter(z, std::numeric_limits<qreal>::infinity());
+        ++at;
+    }
+
+    const int row = m_objects.size();
+    m_rows.insert(id, row);
+    m_ids.append(id);
+    m_types.append(shape->getType());
+    m_flags.append(flags);
+    m_z.append(z);
+    m_bounds.append(shape->boundingRect().normalized());
+    m_objects.append(shape);
+    m_index.insert(row);
+    m_paint.insert(at, row);
+    return id;
+}
+
+void ShapeStore::remove(DiagramShape* shape)
+{
+    const int row = rowOf(shape);
+    if (row < 0) return;
+    m_paint.remove(paintPosition(row));
+    m_rows.remove(m_ids[row]);
+    m_index.remove(row);
+
+    // Swap-remove keeps every other row where it is
+    const int last = m_objects.size() - 1;
+    if (row != last) {
+        m_paint[paintPosition(last)] = row;
+        m_ids[row] = m_ids[last];
+        m_types[row] = m_types[last];
+        m_flags[row] = m_flags[last];
+        m_z[row] = m_z[last];
+        m_bounds[row] = m_bounds[last];
+        m_objects[row] = std::move(m_objects[last]);
+        m_rows[m_ids[row]] = row;
+        m_index.move(last, row);
+    }
+    m_ids.removeLast();
+    m_types.removeLast();
+    m_flags.removeLast();
+    m_z.removeLast();
+    m_bounds.removeLast();
+    m_objects.removeLast();
+}
+
+void ShapeStore::clear()
+{
+    m_ids.clear();
+    m_types.clear();
+    m_flags.clear();
+    m_z.clear();
+    m_bounds.clear();
+    m_objects.clear();
+    m_index.clear();
+    m_paint.clear();
+    m_rows.clear();
+}
+
+void ShapeStore::reserveIds(ShapeId highest)
+{
+    m_nextId = qMax(m_nextId, highest + 1);
+}
+
+void ShapeStore::assign(const QList<std::shared_ptr<DiagramShape>>& shapes, const QSet<ShapeId>& pinned)
+{
+    clear();
+    m_ids.reserve(shapes.size());
+    m_types.reserve(shapes.size());
+    m_flags.reserve(shapes.size());
+    m_z.reserve(shapes.size());
+    m_bounds.reserve(shapes.size());
+    m_objects.reserve(shapes.size());
+    m_paint.reserve(shapes.size());
+    m_rows.reserve(shapes.size());
+    for (const auto& shape : shapes) {
+        if (shape) {
+            append(shape, pinned.contains(shape->getId()) ? Pinned : 0);
+        }
+    }
+}
+
+int ShapeStore::rowOf(const DiagramShape* shape) const
+{
+    if (!shape) return -1;
+    const int row = m_rows.value(shape->getId(), -1);
+    return row >= 0 && m_objects[row].get() == shape ? row : -1;
+}
+
+DiagramShape* ShapeStore::find(ShapeId id) const
+{
+    const int row = m_rows.value(id, -1);
+    return row >= 0 ? m_objects[row].get() : nullptr;
+}
+
+std::shared_ptr<DiagramShape> ShapeStore::shared(const DiagramShape* shape) const
+{
+    const int row = rowOf(shape);
+    return row >= 0 ? m_objects[row] : nullptr;
+}
+
+qreal ShapeStore::zOf(const DiagramShape* shape) const
+{
+    const int row = rowOf(shape);
+    return row >= 0 ? m_z[row] : 0;
+}
+
+bool ShapeStore::isPinned(const DiagramShape* shape) const
+{
+    const int row = rowOf(shape);
+    return row >= 0 && (m_flags[row] & Pinned);
+}
+
+void ShapeStore::setPinned(const DiagramShape* shape, bool pinned)
+{
+    const int row = rowOf(shape);
+    if (row < 0) return;
+    m_flags[row] = pinned ? quint8(m_flags[row] | Pinned) : quint8(m_flags[row] & ~Pinned);
+}
+
+QSet<ShapeId> ShapeStore::pinnedIds() const
+{
+    QSet<ShapeId> pinned;
+    for (int row = 0; row < m_flags.size(); ++row) {
+        if (m_flags[row] & Pinned) {
+            pinned.insert(m_ids[row]);
+        }
+    }
+    return pinned;
+}
+
+bool ShapeStore::bringToFront(const QVector<DiagramShape*>& shapes)
+{
+    const QVector<int> rows = rowsInPaintOrder(shapes);
+    if (rows.isEmpty()) return false;
+
+    // Nothing to do if they already are the topmost shapes, in this order
+    int top = m_paint.size() - 1;
+    int i = rows.size() - 1;
+    while (i >= 0 && m_paint[top] == rows[i]) {
+        --top;
+        --i;
+    }
+    if (i < 0) return false;
+
+    const qreal base = m_z[m_paint.last()] + 1;
+    takeFromPaint(rows);
+    for (int j = 0; j < rows.size(); ++j) {
+        m_z[rows[j]] = base + j;
+        m_paint.append(rows[j]);
+    }
+    return true;
+}
+
+bool ShapeStore::sendToBack(const QVector<DiagramShape*>& shapes)
+{
+    const QVector<int> rows = rowsInPaintOrder(shapes);
+    if (rows.isEmpty()) return false;
+
+    int bottom = 0;
+    int i = 0;
+    while (i < rows.size() && m_paint[bottom] == rows[i]) {
+        ++bottom;
+        ++i;
+    }
+    if (i == rows.size()) return false;
+
+    const qreal base = m_z[m_paint.first()] - rows.size();
+    takeFromPaint(rows);
+    for (int j = 0; j < rows.size(); ++j) {
+        m_z[rows[j]] = base + j;
+    }
+    m_paint = rows + m_paint;
+    return true;
+}
+
+bool ShapeStore::bringForward(const QVector<DiagramShape*>& shapes)
+{
+    const QVector<int> rows = rowsInPaintOrder(shapes);
+    const QSet<int> selected(rows.constBegin(), rows.constEnd());
+
+    // Top-down, so a shape never jumps over one of the selection that has
+    // not had its turn yet. Each move swaps two neighbours in m_paint;
+    // renumbering rewrites keys only, so positions stay valid.
+    bool moved = false;
+    for (int i = rows.size() - 1; i >= 0; --i) {
+        const int at = paintPosition(rows[i]);
+        if (at + 1 == m_paint.size() || selected.contains(m_paint[at + 1])) continue;
+
+        qreal key = m_z[m_paint[at + 1]] + 1;
+        if (at + 2 < m_paint.size() && !keyBetween(m_z[m_paint[at + 1]], m_z[m_paint[at + 2]], key)) {
+            renumber();
+            keyBetween(m_z[m_paint[at + 1]], m_z[m_paint[at + 2]], key);
+        }
+        m_z[rows[i]] = key;
+        std::swap(m_paint[at], m_paint[at + 1]);
+        moved = true;
+    }
+    return moved;
+}
+
+bool ShapeStore::sendBackward(const QVector<DiagramShape*>& shapes)
+{
+    const QVector<int> rows = rowsInPaintOrder(shapes);
+    const QSet<int> selected(rows.constBegin(), rows.constEnd());
+
+    bool moved = false;
+    for (int i = 0; i < rows.size(); ++i) {
+        const int at = paintPosition(rows[i]);
+        if (at == 0 || selected.contains(m_paint[at - 1])) continue;
+
+        qreal key = m_z[m_paint[at - 1]] - 1;
+        if (at >= 2 && !keyBetween(m_z[m_paint[at - 2]], m_z[m_paint[at - 1]], key)) {
+            renumber();
+            keyBetween(m_z[m_paint[at - 2]], m_z[m_paint[at - 1]], key);
+        }
+        m_z[rows[i]] = key;
+        std::swap(m_paint[at], m_paint[at - 1]);
+        moved = true;
+    }
+    return moved;
+}
+
+ShapeId ShapeStore::idBelow(const DiagramShape* shape) const
+{
+    const int row = rowOf(shape);
+    if (row < 0) return 0;
+    const int at = paintPosition(row);
+    return at == 0 ? 0 : m_ids[m_paint[at - 1]];
+}
+
+void ShapeStore::placeAbove(DiagramShape* shape, ShapeId below)
+{
+    const int row = rowOf(shape);
+    if (row < 0) return;
+    // Taken out first, so it is never its own neighbour
+    m_paint.remove(paintPosition(row));
+
+    const int under = below != 0 ? rowOf(find(below)) : -1;
+    qreal key = 0;
+    int at = 0;
+    if (under < 0 || under == row) {
+        key = m_paint.isEmpty() ? 0 : m_z[m_paint.first()] - 1;
+    }
+    else {
+        at = paintPosition(under) + 1;
+        if (at == m_paint.size()) {
+            key = m_z[under] + 1;
+        }
+        else if (!keyBetween(m_z[under], m_z[m_paint[at]], key)) {
+            renumber();
+            keyBetween(m_z[under], m_z[m_paint[at]], key);
+        }
+    }
+    m_z[row] = key;
+    m_paint.insert(at, row);
+}
+
+int ShapeStore::paintPosition(int row) const
+{
+    return paintPositionFor(m_z[row]);
+}
+
+int ShapeStore::paintPositionFor(qreal z) const
+{
+    auto it = std::lower_bound(m_paint.constBegin(), m_paint.constEnd(), z, [this](int row, qreal key) {
+        return m_z[row] < key;
+    });
+    return int(it - m_paint.constBegin());
+}
+
+QVector<int> ShapeStore::rowsInPaintOrder(const QVector<DiagramShape*>& shapes) const
+{
+    QVector<int> rows;
+    rows.reserve(shapes.size());
+    for (DiagramShape* shape : shapes) {
+        const int row = rowOf(shape);
+        if (row >= 0) {
+            rows.append(row);
+        }
+    }
+    std::sort(rows.begin(), rows.end(), [this](int a, int b) {
+        return m_z[a] < m_z[b];
+    });
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+    return rows;
+}
+
+void ShapeStore::takeFromPaint(const QVector<int>& rows)
+{
+    // Positions ascend with the rows, so one pass closes all the gaps
+    QVector<int> positions;
+    positions.reserve(rows.size());
+    for (int row : rows) {
+        positions.append(paintPosition(row));
+    }
+    int out = positions.first();
+    int next = 0;
+    for (int in = positions.first(); in < m_paint.size(); ++in) {
+        if (next < positions.size() && in == positions[next]) {
+            ++next;
+            continue;
+        }
+        m_paint[out++] = m_paint[in];
+    }
+    m_paint.resize(out);
+}
+
+bool ShapeStore::keyBetween(qreal lo, qreal hi, qreal& key) const
+{
+    const qreal mid = lo + (hi - lo) / 2;
+    if (mid <= lo || mid >= hi) return false;
+    key = mid;
+    return true;
+}
+
+void ShapeStore::renumber()
+{
+    // Back to whole numbers, which leaves about 50 halvings of room in
+    // every gap again
+    for (int i = 0; i < m_paint.size(); ++i) {
+        m_z[m_paint[i]] = i;
+    }
+}
+
+void ShapeStore::updateBounds(DiagramShape* shape)
+{
+    const int row = rowOf(shape);
+    if (row < 0) return;
+    const QRectF rect = shape->boundingRect().normalized();
+    if (rect == m_bounds[row]) return;
+    const QRectF oldRect = m_bounds[row];
+    m_bounds[row] = rect;
+    m_index.update(row, oldRect);
+}
+
+QRectF ShapeStore::boundsOf(const DiagramShape* shape) const
+{
+    const int row = rowOf(shape);
+    return row >= 0 ? m_bounds[row] : QRectF();
+}
+
+QRectF ShapeStore::boundsUnion() const
+{
+    QRectF united;
+    for (const QRectF& rect : m_bounds) {
+        united |= rect;
+    }
+    return united;
+}
+
+QVector<DiagramShape*> ShapeStore::query(const QPointF& point) const
+{
+    return shapesAt(m_index.query(point));
+}
+
+QVector<DiagramShape*> ShapeStore::query(const QRectF& rect) const
+{
+    return shapesAt(m_index.query(rect));
+}
+
+QVector<DiagramShape*> ShapeStore::queryInPaintOrder(const QRectF& rect) const
+{
+    // Sorted on the z column, without touching the shapes
+    QVector<int> rows = m_index.query(rect);
+    std::sort(rows.begin(), rows.end(), [this](int a, int b) {
+        return m_z[a] < m_z[b];
+    });
+    return shapesAt(rows);
+}
+
+QVector<DiagramShape*> ShapeStore::queryContained(const QRectF& rect) const
+{
+    return shapesAt(m_index.queryContained(rect));
+}
+
+QVector<DiagramShape*> ShapeStore::shapesAt(const QVector<int>& rows) const
+{
+    QVector<DiagramShape*> shapes;
+    shapes.reserve(rows.size());
+    for (int row : rows) {
+        shapes.append(m_objects[row].get());
+    }
+    return shapes;
+}
+
+QVector<DiagramShape*> ShapeStore::inPaintOrder(const QVector<DiagramShape*>& shapes) const
+{
+    return shapesAt(rowsInPaintOrder(shapes));
+}
+
+QVector<DiagramShape*> ShapeStore::paintOrder() const
+{
+    return shapesAt(m_paint);
+}
+
+QList<std::shared_ptr<DiagramShape>> ShapeStore::toList() const
+{
+    QList<std::shared_ptr<DiagramShape>> shapes;
+    shapes.reserve(m_paint.size());
+    for (int row : m_paint) {
+        shapes.append(m_objects[row]);
+    }
+    return shapes;
+}
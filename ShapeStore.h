@@ -0,0 +1,166 @@
+/**
+ * @file ShapeStore.h
+ * @brief Paint-ordered shape storage with stable IDs and pooled allocation
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QHash>
+#include <QList>
+#include <QRectF>
+#include <QSet>
+#include <QVector>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+#include "DiagramShape.h"
+#include "SpatialIndex.h"
+
+// Owns the canvas' shapes.
+//
+// What culling, hit testing, layout and arranging walk over - id, type,
+// flags, z and bounds - is kept in parallel columns, one row per shape, so
+// those loops stream through contiguous memory instead of chasing one
+// heap object per shape. The columns are the only copy: shapes carry
+// neither their z nor their flags, and the spatial index reads the bounds
+// column directly. The shape objects keep what is drawn. Rows are in no
+// particular order; removal swaps the last row into the gap.
+//
+// Paint order is an array of row numbers sorted by z, bottom first.
+// Arranging k shapes computes their new keys in O(k log n) by binary
+// search over it: a shape moved between two neighbours gets the midpoint
+// of their keys, and only when doubles run out of room between two keys
+// are all keys renumbered. Moving the rows within the array is one pass
+// over 4-byte entries at most.
+//
+// Every shape gets a 64-bit id when it is added. Ids are never reused
+// within a store; a shape that already carries an id keeps it unless it
+// clashes, so documents that store ids can round-trip them.
+class ShapeStore
+{
+public:
+    enum Flag : quint8 {
+        // Keeps its place when a force layout runs
+        Pinned = 0x01
+    };
+
+    // cellSize is the spatial index's grid cell, in document units
+    explicit ShapeStore(qreal cellSize = 128.0);
+    ShapeStore(const ShapeStore&) = delete;
+    ShapeStore& operator=(const ShapeStore&) = delete;
+
+    // Shapes are allocated from a shared pool rather than one heap block
+    // each; object and reference count come from a single chunk
+    template <typename T, typename... Args>
+    static std::shared_ptr<T> allocate(Args&&... args)
+    {
+        return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(pool()), std::forward<Args>(args)...);
+    }
+
+    int size() const { return m_objects.size(); }
+    bool isEmpty() const { return m_objects.isEmpty(); }
+
+    // Adds on top of everything else; returns the shape's id
+    ShapeId append(const std::shared_ptr<DiagramShape>& shape, quint8 flags = 0);
+    // Adds with the given paint-order key (or the next free one above it),
+    // for loaders that deliver shapes out of order
+    ShapeId insert(const std::shared_ptr<DiagramShape>& shape, qreal z, quint8 flags = 0);
+    // Keeps ids up to highest free for shapes that are still on their way
+    void reserveIds(ShapeId highest);
+    // An id no shape has had yet, which a shape added later keeps
+    ShapeId newId() { return m_nextId++; }
+    void remove(DiagramShape* shape);
+    void clear();
+    // Replaces the contents; shapes are in paint order
+    void assign(const QList<std::shared_ptr<DiagramShape>>& shapes, const QSet<ShapeId>& pinned);
+
+    // Rows, in storage order
+    DiagramShape* at(int row) const { return m_objects[row].get(); }
+    const QVector<ShapeId>& ids() const { return m_ids; }
+    const QVector<DiagramShape::Type>& types() const { return m_types; }
+    const QVector<quint8>& flags() const { return m_flags; }
+    const QVector<qreal>& zValues() const { return m_z; }
+    const QVector<QRectF>& bounds() const { return m_bounds; }
+
+    // -1 when the shape is not in the store
+    int rowOf(const DiagramShape* shape) const;
+    DiagramShape* find(ShapeId id) const;
+    // The owning pointer of a stored shape; null otherwise
+    std::shared_ptr<DiagramShape> shared(const DiagramShape* shape) const;
+    bool contains(const DiagramShape* shape) const { return rowOf(shape) >= 0; }
+
+    // Stacking key; higher values paint on top
+    qreal zOf(const DiagramShape* shape) const;
+    bool isPinned(const DiagramShape* shape) const;
+    void setPinned(const DiagramShape* shape, bool pinned);
+    // Ids of the pinned shapes, for documents
+    QSet<ShapeId> pinnedIds() const;
+
+    // Arrange operations on a whole selection. The shapes keep their order
+    // relative to each other; shapes not in the store are ignored. Each
+    // returns whether anything moved.
+    bool bringToFront(const QVector<DiagramShape*>& shapes);
+    bool sendToBack(const QVector<DiagramShape*>& shapes);
+    // One step: each shape moves past the nearest other shape above
+    // (below) it, unless that one is part of the selection too
+    bool bringForward(const QVector<DiagramShape*>& shapes);
+    bool sendBackward(const QVector<DiagramShape*>& shapes);
+
+    // The shape painted just below, 0 for the bottom one. Undo records
+    // stacking this way because z keys change when they are renumbered.
+    ShapeId idBelow(const DiagramShape* shape) const;
+    // Restacks the shape right above the one with id below (to the bottom
+    // for 0 or an unknown id)
+    void placeAbove(DiagramShape* shape, ShapeId below);
+
+    // Refreshes the cached bounds, and the index, after the shape's
+    // geometry changed
+    void updateBounds(DiagramShape* shape);
+    // The bounds the shape is indexed under; null if it is not stored
+    QRectF boundsOf(const DiagramShape* shape) const;
+    QRectF boundsUnion() const;
+
+    // Shapes whose cached bounds contain the point, in no particular order
+    QVector<DiagramShape*> query(const QPointF& point) const;
+    // Shapes whose cached bounds intersect the rect, each reported once
+    QVector<DiagramShape*> query(const QRectF& rect) const;
+    // The same, bottom first
+    QVector<DiagramShape*> queryInPaintOrder(const QRectF& rect) const;
+    // Shapes whose cached bounds lie completely inside the rect
+    QVector<DiagramShape*> queryContained(const QRectF& rect) const;
+
+    // The stored ones among shapes, bottom first and each once
+    QVector<DiagramShape*> inPaintOrder(const QVector<DiagramShape*>& shapes) const;
+    QVector<DiagramShape*> paintOrder() const;
+    QList<std::shared_ptr<DiagramShape>> toList() const;
+
+private:
+    static std::pmr::memory_resource* pool();
+
+    // Index of row in m_paint, found by its key
+    int paintPosition(int row) const;
+    // Where a row with key z belongs in m_paint
+    int paintPositionFor(qreal z) const;
+    QVector<int> rowsInPaintOrder(const QVector<DiagramShape*>& shapes) const;
+    // Takes the rows out of m_paint; they are in paint order
+    void takeFromPaint(const QVector<int>& rows);
+    // Midpoint of lo and hi; false when no double is left between them,
+    // in which case the caller renumbers and looks the neighbours up again
+    bool keyBetween(qreal lo, qreal hi, qreal& key) const;
+    void renumber();
+    QVector<DiagramShape*> shapesAt(const QVector<int>& rows) const;
+
+    // One row per shape; bounds are normalized
+    QVector<ShapeId> m_ids;
+    QVector<DiagramShape::Type> m_types;
+    QVector<quint8> m_flags;
+    QVector<qreal> m_z;
+    QVector<QRectF> m_bounds;
+    QVector<std::shared_ptr<DiagramShape>> m_objects;
+    SpatialIndex m_index; // over m_bounds
+
+    QVector<int> m_paint; // rows sorted by m_z, keys unique
+    QHash<ShapeId, int> m_rows;
+    ShapeId m_nextId = 1;
+};
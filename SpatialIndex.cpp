@@ -0,0 +1,273 @@
+/**
+ * @file SpatialIndex.cpp
+ * @brief Implementation of the uniform grid shape index
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "SpatialIndex.h"
+#include <QtMath>
+
+namespace {
+
+// Cell coordinates are clamped so that far-away or degenerate rects cannot
+// overflow the key packing or make a single shape span billions of cells
+const qreal kMaxCell = 1 << 24;
+// Shapes spanning more cells than this (swimlanes, long connectors, page
+// frames) go into a list every query scans instead, so a single huge
+// shape cannot cost thousands of cell updates on every move
+const qint64 kMaxCellsPerShape = 64;
+
+// Inclusive overlap test; unlike QRectF::intersects it also accepts
+// zero-width or zero-height rects
+bool overlaps(const QRectF& a, const QRectF& b)
+{
+    return a.left() <= b.right() && b.left() <= a.right()
+        && a.top() <= b.bottom() && b.top() <= a.bottom();
+}
+
+bool covers(const QRectF& r, const QPointF& p)
+{
+    return p.x() >= r.left() && p.x() <= r.right()
+        && p.y() >= r.top() && p.y() <= r.bottom();
+}
+
+// Order inside a cell is irrelevant, so swap-remove
+void removeRow(QVector<int>& rows, int row)
+{
+    for (int i = 0; i < rows.size(); ++i) {
+        if (rows[i] == row) {
+            rows[i] = rows.last();
+            rows.removeLast();
+            return;
+        }
+    }
+}
+
+void replaceRow(QVector<int>& rows, int from, int to)
+{
+    for (int& row : rows) {
+        if (row == from) {
+            row = to;
+            return;
+        }
+    }
+}
+
+} // namespace
+
+SpatialIndex::SpatialIndex(const QVector<QRectF>* bounds, qreal cellSize)
+    : m_bounds(bounds)
+    , m_cellSize(cellSize > 0 ? cellSize : 128.0)
+{
+}
+
+void SpatialIndex::insert(int row)
+{
+    addToCells(row, cellRange((*m_bounds)[row]));
+}
+
+void SpatialIndex::update(int row, const QRectF& oldRect)
+{
+    CellRange oldRange = cellRange(oldRect);
+    CellRange newRange = cellRange((*m_bounds)[row]);
+    // Within the same cells there is nothing to do: the rect is read from
+    // the column
+    if (oldRange.left == newRange.left && oldRange.top == newRange.top
+        && oldRange.right == newRange.right && oldRange.bottom == newRange.bottom) {
+        return;
+    }
+    removeFromCells(row, oldRange);
+    addToCells(row, newRange);
+}
+
+void SpatialIndex::remove(int row)
+{
+    removeFromCells(row, cellRange((*m_bounds)[row]));
+}
+
+void SpatialIndex::move(int from, int to)
+{
+    CellRange range = cellRange((*m_bounds)[to]);
+    if (isOversize(range)) {
+        replaceRow(m_oversize, from, to);
+        return;
+    }
+    for (int y = range.top; y <= range.bottom; ++y) {
+        for (int x = range.left; x <= range.right; ++x) {
+            auto it = m_cells.find(cellKey(x, y));
+            if (it != m_cells.end()) {
+                replaceRow(*it, from, to);
+            }
+        }
+    }
+}
+
+void SpatialIndex::clear()
+{
+    m_cells.clear();
+    m_oversize.clear();
+}
+
+QVector<int> SpatialIndex::query(const QPointF& point) const
+{
+    const QVector<QRectF>& bounds = *m_bounds;
+    QVector<int> result;
+    for (int row : m_oversize) {
+        if (covers(bounds[row], point)) {
+            result.append(row);
+        }
+    }
+    auto it = m_cells.constFind(cellKey(cellCoord(point.x()), cellCoord(point.y())));
+    if (it == m_cells.constEnd()) return result;
+
+    for (int row : *it) {
+        if (covers(bounds[row], point)) {
+            result.append(row);
+        }
+    }
+    return result;
+}
+
+QVector<int> SpatialIndex::query(const QRectF& rect) const
+{
+    const QVector<QRectF>& bounds = *m_bounds;
+    QVector<int> result;
+    QRectF r = rect.normalized();
+    CellRange range = cellRange(r);
+
+    qint64 cellCount = qint64(range.right - range.left + 1) * (range.bottom - range.top + 1);
+    if (cellCount > m_cells.size()) {
+        // The query covers more cells than are occupied; a flat scan is cheaper
+        for (int row = 0; row < bounds.size(); ++row) {
+            if (overlaps(bounds[row], r)) {
+                result.append(row);
+            }
+        }
+        return result;
+    }
+
+    for (int row : m_oversize) {
+        if (overlaps(bounds[row], r)) {
+            result.append(row);
+        }
+    }
+    for (int y = range.top; y <= range.bottom; ++y) {
+        for (int x = range.left; x <= range.right; ++x) {
+            auto it = m_cells.constFind(cellKey(x, y));
+            if (it == m_cells.constEnd()) continue;
+
+            for (int row : *it) {
+                const QRectF& rowRect = bounds[row];
+                if (!overlaps(rowRect, r)) continue;
+                // A shape spanning several cells is reported only from the
+                // first cell where it and the query range overlap
+                int firstX = qMax(range.left, cellCoord(rowRect.left()));
+                int firstY = qMax(range.top, cellCoord(rowRect.top()));
+                if (x == firstX && y == firstY) {
+                    result.append(row);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+QVector<int> SpatialIndex::queryContained(const QRectF& rect) const
+{
+    const QVector<QRectF>& bounds = *m_bounds;
+    QVector<int> result;
+    QRectF r = rect.normalized();
+    CellRange range = cellRange(r);
+
+    qint64 cellCount = qint64(range.right - range.left + 1) * (range.bottom - range.top + 1);
+    if (cellCount > m_cells.size()) {
+        for (int row = 0; row < bounds.size(); ++row) {
+            if (r.contains(bounds[row])) {
+                result.append(row);
+            }
+        }
+        return result;
+    }
+
+    for (int row : m_oversize) {
+        if (r.contains(bounds[row])) {
+            result.append(row);
+        }
+    }
+    for (int y = range.top; y <= range.bottom; ++y) {
+        for (int x = range.left; x <= range.right; ++x) {
+            auto it = m_cells.constFind(cellKey(x, y));
+            if (it == m_cells.constEnd()) continue;
+
+            for (int row : *it) {
+                // A contained shape lies in the query range entirely, so its
+                // own first cell is always visited; report it from there
+                const QRectF& rowRect = bounds[row];
+                if (x == cellCoord(rowRect.left()) && y == cellCoord(rowRect.top())
+                    && r.contains(rowRect)) {
+                    result.append(row);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+int SpatialIndex::cellCoord(qreal v) const
+{
+    qreal c = qFloor(v / m_cellSize);
+    return (int)qBound(-kMaxCell, c, kMaxCell);
+}
+
+SpatialIndex::CellRange SpatialIndex::cellRange(const QRectF& rect) const
+{
+    return CellRange{
+        cellCoord(rect.left()),
+        cellCoord(rect.top()),
+        cellCoord(rect.right()),
+        cellCoord(rect.bottom())
+    };
+}
+
+quint64 SpatialIndex::cellKey(int x, int y)
+{
+    return (quint64(quint32(x)) << 32) | quint32(y);
+}
+
+bool SpatialIndex::isOversize(const CellRange& range)
+{
+    return qint64(range.right - range.left + 1) * (range.bottom - range.top + 1) > kMaxCellsPerShape;
+}
+
+void SpatialIndex::addToCells(int row, const CellRange& range)
+{
+    if (isOversize(range)) {
+        m_oversize.append(row);
+        return;
+    }
+    for (int y = range.top; y <= range.bottom; ++y) {
+        for (int x = range.left; x <= range.right; ++x) {
+            m_cells[cellKey(x, y)].append(row);
+        }
+    }
+}
+
+void SpatialIndex::removeFromCells(int row, const CellRange& range)
+{
+    if (isOversize(range)) {
+        removeRow(m_oversize, row);
+        return;
+    }
+    for (int y = range.top; y <= range.bottom; ++y) {
+        for (int x = range.left; x <= range.right; ++x) {
+            auto it = m_cells.find(cellKey(x, y));
+            if (it == m_cells.end()) continue;
+
+            removeRow(*it, row);
+            if (it->isEmpty()) {
+                m_cells.erase(it);
+            }
+        }
+    }
+}
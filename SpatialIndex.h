@@ -0,0 +1,64 @@
+/**
+ * @file SpatialIndex.h
+ * @brief Uniform grid index for looking up shapes by position
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QHash>
+#include <QRectF>
+#include <QPointF>
+#include <QVector>
+
+// Buckets rows of a bounds column into fixed-size grid cells, so point and
+// rectangle queries only have to look at the rows near the query. Rows too
+// large for that are kept in a short list of their own that every query
+// scans.
+//
+// The index keeps no rects of its own: it reads the owner's column (see
+// ShapeStore), which must hold normalized rects and have every row
+// indexed. The owner changes the column first and then tells the index.
+class SpatialIndex
+{
+public:
+    explicit SpatialIndex(const QVector<QRectF>* bounds, qreal cellSize = 128.0);
+
+    void insert(int row);
+    // oldRect is the rect the row was indexed under
+    void update(int row, const QRectF& oldRect);
+    // Called while the row still holds its rect
+    void remove(int row);
+    // The rect of row from has been moved to row to
+    void move(int from, int to);
+    void clear();
+
+    // Rows whose rect contains the point, in no particular order
+    QVector<int> query(const QPointF& point) const;
+    // Rows whose rect intersects the rect, each reported once
+    QVector<int> query(const QRectF& rect) const;
+    // Rows whose rect lies completely inside the rect
+    QVector<int> queryContained(const QRectF& rect) const;
+
+private:
+    struct CellRange {
+        int left;
+        int top;
+        int right;
+        int bottom;
+    };
+
+    int cellCoord(qreal v) const;
+    CellRange cellRange(const QRectF& rect) const;
+    static quint64 cellKey(int x, int y);
+    // Too many cells to bucket the row into
+    static bool isOversize(const CellRange& range);
+
+    void addToCells(int row, const CellRange& range);
+    void removeFromCells(int row, const CellRange& range);
+
+    const QVector<QRectF>* m_bounds;
+    qreal m_cellSize;
+    QHash<quint64, QVector<int>> m_cells;
+    QVector<int> m_oversize;
+};
@@ -0,0 +1,394 @@
+/**
+ * @file SvgWriter.cpp
+ * @brief Implementation of the direct SVG writer
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "SvgWriter.h"
+#include "DiagramShape.h"
+#include "ConnectorShape.h"
+#include "TextShape.h"
+#include <QSaveFile>
+#include <QStringList>
+#include <QTextLayout>
+#include <QTextLine>
+#include <QTextOption>
+#include <QXmlStreamWriter>
+
+namespace {
+
+// Two decimals are more than enough for document units; trailing zeros
+// are dropped to keep the file small
+QString num(qreal value)
+{
+    QString text = QString::number(value, 'f', 2);
+    if (text.contains(QLatin1Char('.'))) {
+        while (text.endsWith(QLatin1Char('0'))) text.chop(1);
+        if (text.endsWith(QLatin1Char('.'))) text.chop(1);
+    }
+    if (text == QLatin1String("-0")) text = QStringLiteral("0");
+    return text;
+}
+
+QString points(const QVector<QPointF>& pts)
+{
+    QString text;
+    for (const QPointF& p : pts) {
+        if (!text.isEmpty()) text += QLatin1Char(' ');
+        text += num(p.x()) + QLatin1Char(',') + num(p.y());
+    }
+    return text;
+}
+
+// "fill:#rrggbb" plus an opacity when the colour is translucent
+QString paint(const char* property, const QColor& color)
+{
+    if (color.alpha() == 0) {
+        return QString::fromLatin1(property) + QStringLiteral(":none");
+    }
+    QString css = QString::fromLatin1(property) + QLatin1Char(':') + color.name();
+    if (color.alpha() < 255) {
+        css += QLatin1Char(';') + QString::fromLatin1(property) + QStringLiteral("-opacity:")
+            + num(color.alphaF());
+    }
+    return css;
+}
+
+qreal pixelSize(const QFont& font)
+{
+    return font.pixelSize() > 0 ? font.pixelSize() : font.pointSizeF() * 96.0 / 72.0;
+}
+
+} // namespace
+
+SvgWriter::SvgWriter(const QVector<DiagramShape*>& shapes, const QRectF& area, const QColor& background)
+    : m_shapes(shapes)
+    , m_area(area)
+    , m_background(background)
+    , m_metricsDevice(1, 1, QImage::Format_ARGB32_Premultiplied)
+{
+}
+
+bool SvgWriter::write(const QString& fileName)
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        m_error = file.errorString();
+        return false;
+    }
+    if (!write(&file)) {
+        file.cancelWriting();
+        return false;
+    }
+    if (!file.commit()) {
+        m_error = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool SvgWriter::write(QIODevice* device)
+{
+    m_classes.clear();
+    m_classOrder.clear();
+    m_markerIndex.clear();
+    m_markers.clear();
+    collectStyles();
+
+    QXmlStreamWriter xml(device);
+    xml.writeStartDocument();
+    xml.writeStartElement(QStringLiteral("svg"));
+    xml.writeDefaultNamespace(QStringLiteral("http://www.w3.org/2000/svg"));
+    xml.writeAttribute(QStringLiteral("version"), QStringLiteral("1.1"));
+    xml.writeAttribute(QStringLiteral("width"), num(m_area.width()));
+    xml.writeAttribute(QStringLiteral("height"), num(m_area.height()));
+    xml.writeAttribute(QStringLiteral("viewBox"), QStringList({ num(m_area.x()), num(m_area.y()),
+        num(m_area.width()), num(m_area.height()) }).join(QLatin1Char(' ')));
+
+    xml.writeTextElement(QStringLiteral("title"), QStringLiteral("Diagram"));
+    xml.writeTextElement(QStringLiteral("desc"), QStringLiteral("Generated by DiagramEditor"));
+    writeDefs(xml);
+
+    xml.writeEmptyElement(QStringLiteral("rect"));
+    xml.writeAttribute(QStringLiteral("x"), num(m_area.x()));
+    xml.writeAttribute(QStringLiteral("y"), num(m_area.y()));
+    xml.writeAttribute(QStringLiteral("width"), num(m_area.width()));
+    xml.writeAttribute(QStringLiteral("height"), num(m_area.height()));
+    xml.writeAttribute(QStringLiteral("style"), paint("fill", m_background));
+
+    for (const DiagramShape* shape : m_shapes) {
+        writeShape(xml, shape);
+        if (xml.hasError()) break;
+    }
+
+    xml.writeEndElement();
+    xml.writeEndDocument();
+    if (xml.hasError()) {
+        m_error = device->errorString();
+        return false;
+    }
+    return true;
+}
+
+void SvgWriter::collectStyles()
+{
+    for (const DiagramShape* shape : m_shapes) {
+        shapeClass(shape);
+        if (shape->getType() == DiagramShape::Connector) {
+            const ConnectorShape* connector = static_cast<const ConnectorShape*>(shape);
+            const ConnectorShape::ArrowStyle arrows = connector->getArrowStyle();
+            if (arrows == ConnectorShape::Start || arrows == ConnectorShape::Both) {
+                markerFor(shape->getLineColor(), shape->getLineWidth(), true);
+            }
+            if (arrows == ConnectorShape::End || arrows == ConnectorShape::Both) {
+                markerFor(shape->getLineColor(), shape->getLineWidth(), false);
+            }
+        }
+        Label label;
+        if (labelFor(shape, label)) {
+            labelClass(label);
+        }
+    }
+}
+
+QString SvgWriter::shapeClass(const DiagramShape* shape)
+{
+    const QString stroke = paint("stroke", shape->getLineColor())
+        + QStringLiteral(";stroke-width:") + num(shape->getLineWidth());
+    switch (shape->getType()) {
+    case DiagramShape::Connector:
+        return classFor(QStringLiteral("fill:none;") + stroke);
+    case DiagramShape::Text:
+        // Text boxes only have an optional background
+        return classFor(paint("fill", shape->getColor()) + QStringLiteral(";stroke:none"));
+    default:
+        return classFor(paint("fill", shape->getColor()) + QLatin1Char(';') + stroke);
+    }
+}
+
+QString SvgWriter::labelClass(const Label& label)
+{
+    QString css = QStringLiteral("font-family:'%1';font-size:%2px;")
+        .arg(label.font.family(), num(pixelSize(label.font)));
+    if (label.font.bold()) css += QStringLiteral("font-weight:bold;");
+    if (label.font.italic()) css += QStringLiteral("font-style:italic;");
+    css += paint("fill", label.color) + QStringLiteral(";text-anchor:middle");
+    return classFor(css);
+}
+
+QString SvgWriter::markerFor(const QColor& color, int width, bool start)
+{
+    const QString key = color.name(QColor::HexArgb) + QLatin1Char('/') + QString::number(width)
+        + (start ? QStringLiteral("/s") : QStringLiteral("/e"));
+    int index = m_markerIndex.value(key, -1);
+    if (index < 0) {
+        index = m_markers.size();
+        m_markerIndex.insert(key, index);
+        m_markers.append(Marker{ color, width, start });
+    }
+    return QStringLiteral("url(#m%1)").arg(index);
+}
+
+QString SvgWriter::classFor(const QString& style)
+{
+    auto it = m_classes.constFind(style);
+    if (it != m_classes.constEnd()) {
+        return it.value();
+    }
+    const QString name = QStringLiteral("s%1").arg(m_classOrder.size());
+    m_classes.insert(style, name);
+    m_classOrder.append(style);
+    return name;
+}
+
+bool SvgWriter::labelFor(const DiagramShape* shape, Label& label) const
+{
+    label.text = shape->getText();
+    if (label.text.isEmpty()) {
+        return false;
+    }
+    switch (shape->getType()) {
+    case DiagramShape::Connector:
+        label.rect = static_cast<const ConnectorShape*>(shape)->labelRect();
+        label.font = QFont();
+        label.color = Qt::black;
+        label.wrap = false;
+        break;
+    case DiagramShape::Text: {
+        const TextShape* text = static_cast<const TextShape*>(shape);
+        label.rect = shape->boundingRect();
+        label.font = text->getFont();
+        label.color = text->getTextColor();
+        label.wrap = true;
+        break;
+    }
+    default:
+        // Same font the canvas uses for shape labels
+        label.rect = shape->boundingRect();
+        label.font = QFont();
+        label.font.setPointSize(10);
+        label.color = Qt::black;
+        label.wrap = true;
+        break;
+    }
+    return true;
+}
+
+void SvgWriter::writeDefs(QXmlStreamWriter& xml)
+{
+    // Qt's default square caps and bevel joins, so outlines match the canvas
+    QString css = QStringLiteral("rect,ellipse,polygon,path{stroke-linecap:square;stroke-linejoin:bevel}");
+    for (int i = 0; i < m_classOrder.size(); ++i) {
+        css += QStringLiteral("\n.s%1{%2}").arg(i).arg(m_classOrder[i]);
+    }
+    xml.writeTextElement(QStringLiteral("style"), css);
+
+    if (m_markers.isEmpty()) return;
+
+    // Arrowheads drawn in user space with the tip on the path's end point:
+    // an equilateral triangle pointing along the path (or against it for
+    // start markers), as on the canvas
+    xml.writeStartElement(QStringLiteral("defs"));
+    for (int i = 0; i < m_markers.size(); ++i) {
+        const Marker& marker = m_markers[i];
+        xml.writeStartElement(QStringLiteral("marker"));
+        xml.writeAttribute(QStringLiteral("id"), QStringLiteral("m%1").arg(i));
+        xml.writeAttribute(QStringLiteral("markerUnits"), QStringLiteral("userSpaceOnUse"));
+        xml.writeAttribute(QStringLiteral("orient"), QStringLiteral("auto"));
+        xml.writeAttribute(QStringLiteral("markerWidth"), QStringLiteral("1"));
+        xml.writeAttribute(QStringLiteral("markerHeight"), QStringLiteral("1"));
+        xml.writeAttribute(QStringLiteral("overflow"), QStringLiteral("visible"));
+        xml.writeEmptyElement(QStringLiteral("path"));
+        xml.writeAttribute(QStringLiteral("d"), marker.start ? QStringLiteral("M0,0L8.66,-5L8.66,5Z")
+                                                              : QStringLiteral("M0,0L-8.66,-5L-8.66,5Z"));
+        xml.writeAttribute(QStringLiteral("style"), paint("fill", marker.color) + QLatin1Char(';')
+            + paint("stroke", marker.color) + QStringLiteral(";stroke-width:") + num(marker.width));
+        xml.writeEndElement();
+    }
+    xml.writeEndElement();
+}
+
+void SvgWriter::writeShape(QXmlStreamWriter& xml, const DiagramShape* shape)
+{
+    const QString cssClass = shapeClass(shape);
+    const QRectF rect = shape->boundingRect();
+
+    switch (shape->getType()) {
+    case DiagramShape::Rectangle:
+        xml.writeEmptyElement(QStringLiteral("rect"));
+        xml.writeAttribute(QStringLiteral("x"), num(rect.x()));
+        xml.writeAttribute(QStringLiteral("y"), num(rect.y()));
+        xml.writeAttribute(QStringLiteral("width"), num(rect.width()));
+        xml.writeAttribute(QStringLiteral("height"), num(rect.height()));
+        xml.writeAttribute(QStringLiteral("class"), cssClass);
+        break;
+    case DiagramShape::Ellipse:
+        xml.writeEmptyElement(QStringLiteral("ellipse"));
+        xml.writeAttribute(QStringLiteral("cx"), num(rect.center().x()));
+        xml.writeAttribute(QStringLiteral("cy"), num(rect.center().y()));
+        xml.writeAttribute(QStringLiteral("rx"), num(rect.width() / 2));
+        xml.writeAttribute(QStringLiteral("ry"), num(rect.height() / 2));
+        xml.writeAttribute(QStringLiteral("class"), cssClass);
+        break;
+    case DiagramShape::Diamond:
+        xml.writeEmptyElement(QStringLiteral("polygon"));
+        xml.writeAttribute(QStringLiteral("points"), points({
+            QPointF(rect.center().x(), rect.top()), QPointF(rect.right(), rect.center().y()),
+            QPointF(rect.center().x(), rect.bottom()), QPointF(rect.left(), rect.center().y()) }));
+        xml.writeAttribute(QStringLiteral("class"), cssClass);
+        break;
+    case DiagramShape::Triangle:
+        xml.writeEmptyElement(QStringLiteral("polygon"));
+        xml.writeAttribute(QStringLiteral("points"), points({
+            QPointF(rect.center().x(), rect.top()), rect.bottomRight(), rect.bottomLeft() }));
+        xml.writeAttribute(QStringLiteral("class"), cssClass);
+        break;
+    case DiagramShape::Connector: {
+        const ConnectorShape* connector = static_cast<const ConnectorShape*>(shape);
+        QVector<QPointF> pts = connector->getControlPoints();
+        pts.prepend(connector->getStartPoint());
+        pts.append(connector->getEndPoint());
+        QString d = QStringLiteral("M") + num(pts[0].x()) + QLatin1Char(',') + num(pts[0].y());
+        for (int i = 1; i < pts.size(); ++i) {
+            d += QStringLiteral("L") + num(pts[i].x()) + QLatin1Char(',') + num(pts[i].y());
+        }
+        xml.writeEmptyElement(QStringLiteral("path"));
+        xml.writeAttribute(QStringLiteral("d"), d);
+        xml.writeAttribute(QStringLiteral("class"), cssClass);
+        const ConnectorShape::ArrowStyle arrows = connector->getArrowStyle();
+        if (arrows == ConnectorShape::Start || arrows == ConnectorShape::Both) {
+            xml.writeAttribute(QStringLiteral("marker-start"),
+                               markerFor(shape->getLineColor(), shape->getLineWidth(), true));
+        }
+        if (arrows == ConnectorShape::End || arrows == ConnectorShape::Both) {
+            xml.writeAttribute(QStringLiteral("marker-end"),
+                               markerFor(shape->getLineColor(), shape->getLineWidth(), false));
+        }
+        break;
+    }
+    case DiagramShape::Text:
+        if (shape->getColor().alpha() != 0) {
+            xml.writeEmptyElement(QStringLiteral("rect"));
+            xml.writeAttribute(QStringLiteral("x"), num(rect.x()));
+            xml.writeAttribute(QStringLiteral("y"), num(rect.y()));
+            xml.writeAttribute(QStringLiteral("width"), num(rect.width()));
+            xml.writeAttribute(QStringLiteral("height"), num(rect.height()));
+            xml.writeAttribute(QStringLiteral("class"), cssClass);
+        }
+        break;
+    default:
+        break;
+    }
+
+    Label label;
+    if (labelFor(shape, label)) {
+        writeLabel(xml, label);
+    }
+}
+
+void SvgWriter::writeLabel(QXmlStreamWriter& xml, const Label& label)
+{
+    // Lines are broken with QTextLayout exactly like TextLayoutCache does
+    // on the canvas; SVG 1.1 has no wrapping of its own
+    QString text = label.text;
+    text.replace(QLatin1Char('\n'), QChar::LineSeparator);
+    QTextLayout layout(text, label.font, &m_metricsDevice);
+    QTextOption option;
+    option.setWrapMode(label.wrap ? QTextOption::WordWrap : QTextOption::NoWrap);
+    layout.setTextOption(option);
+
+    QVector<QPair<QString, qreal>> lines; // text and baseline offset
+    qreal height = 0;
+    layout.beginLayout();
+    for (QTextLine line = layout.createLine(); line.isValid(); line = layout.createLine()) {
+        line.setLineWidth(qMax<qreal>(label.rect.width(), 0));
+        QString lineText = text.mid(line.textStart(), line.textLength());
+        lineText.remove(QChar::LineSeparator);
+        lines.append(qMakePair(lineText.trimmed(), height + line.ascent()));
+        height += line.height();
+    }
+    layout.endLayout();
+    if (lines.isEmpty()) return;
+
+    const qreal x = label.rect.center().x();
+    const qreal top = label.rect.top() + (label.rect.height() - height) / 2;
+
+    xml.writeStartElement(QStringLiteral("text"));
+    xml.writeAttribute(QStringLiteral("class"), labelClass(label));
+    xml.writeAttribute(QStringLiteral("x"), num(x));
+    xml.writeAttribute(QStringLiteral("y"), num(top + lines[0].second));
+    if (lines.size() == 1) {
+        xml.writeCharacters(lines[0].first);
+    }
+    else {
+        for (const auto& line : lines) {
+            xml.writeStartElement(QStringLiteral("tspan"));
+            xml.writeAttribute(QStringLiteral("x"), num(x));
+            xml.writeAttribute(QStringLiteral("y"), num(top + line.second));
+            xml.writeCharacters(line.first);
+            xml.writeEndElement();
+        }
+    }
+    xml.writeEndElement();
+}
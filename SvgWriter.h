@@ -0,0 +1,78 @@
+/**
+ * @file SvgWriter.h
+ * @brief Direct SVG serialisation of diagram shapes
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QColor>
+#include <QFont>
+#include <QHash>
+#include <QImage>
+#include <QRectF>
+#include <QString>
+#include <QVector>
+
+class QIODevice;
+class QXmlStreamWriter;
+class DiagramShape;
+
+// Writes shapes as SVG elements (<rect>, <ellipse>, <polygon>, <path>,
+// <text>) rather than replaying painter calls through QSvgGenerator.
+// Repeated styles become CSS classes in one <style> block and arrowheads
+// are shared <marker>s, which keeps files small. Elements are streamed to
+// the device as they are generated.
+//
+// Like the other exporters, selection handles are not written.
+class SvgWriter
+{
+public:
+    // shapes are in paint order; area is the document rect shown
+    SvgWriter(const QVector<DiagramShape*>& shapes, const QRectF& area, const QColor& background);
+
+    // Writes through QSaveFile, so a failed export leaves no partial file
+    bool write(const QString& fileName);
+    bool write(QIODevice* device);
+
+    QString errorString() const { return m_error; }
+
+private:
+    struct Label {
+        QRectF rect;
+        QString text;
+        QFont font;
+        QColor color;
+        bool wrap;
+    };
+
+    struct Marker {
+        QColor color;
+        int width;
+        bool start;
+    };
+
+    // Both passes call the same functions: the first registers every
+    // class and marker so the defs can be written up front, the second
+    // finds them already registered
+    void collectStyles();
+    QString shapeClass(const DiagramShape* shape);
+    QString labelClass(const Label& label);
+    QString markerFor(const QColor& color, int width, bool start);
+    bool labelFor(const DiagramShape* shape, Label& label) const;
+    QString classFor(const QString& style);
+
+    void writeDefs(QXmlStreamWriter& xml);
+    void writeShape(QXmlStreamWriter& xml, const DiagramShape* shape);
+    void writeLabel(QXmlStreamWriter& xml, const Label& label);
+
+    QVector<DiagramShape*> m_shapes;
+    QRectF m_area;
+    QColor m_background;
+    QHash<QString, QString> m_classes; // CSS declarations -> class name
+    QVector<QString> m_classOrder;     // declarations in first-use order
+    QHash<QString, int> m_markerIndex;
+    QVector<Marker> m_markers;
+    QImage m_metricsDevice;            // 96 DPI, so text wraps as on the canvas
+    QString m_error;
+};
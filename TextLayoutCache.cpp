@@ -0,0 +1,82 @@
+/**
+ * @file TextLayoutCache.cpp
+ * @brief Implementation of the label text layout cache
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "TextLayoutCache.h"
+#include <QPainter>
+#include <QTextLine>
+#include <QTextOption>
+
+void TextLayoutCache::draw(QPainter* painter, const QRectF& rect, const QString& text,
+                           const QFont& font, int flags)
+{
+    if (text.isEmpty()) return;
+    ensureLayout(text, font, rect.width(), flags);
+
+    // Lines are centred horizontally while laying out; centre the block
+    // vertically here since the rect height does not affect wrapping
+    QPointF origin(rect.left(), rect.top() + (rect.height() - m_naturalSize.height()) / 2);
+
+    bool overflows = m_naturalSize.width() > rect.width() || m_naturalSize.height() > rect.height();
+    if (overflows) {
+        painter->save();
+        painter->setClipRect(rect, Qt::IntersectClip);
+    }
+    m_layout->draw(painter, origin);
+    if (overflows) {
+        painter->restore();
+    }
+}
+
+QSizeF TextLayoutCache::naturalSize(const QString& text, const QFont& font, qreal width, int flags)
+{
+    if (text.isEmpty()) return QSizeF();
+    ensureLayout(text, font, width, flags);
+    return m_naturalSize;
+}
+
+void TextLayoutCache::ensureLayout(const QString& text, const QFont& font, qreal width, int flags)
+{
+    if (m_valid && m_layout && m_width == width && m_flags == flags && m_font == font) {
+        return;
+    }
+
+    if (!m_layout) {
+        m_layout.reset(new QTextLayout);
+    }
+
+    // QTextLayout only breaks lines on the Unicode line separator
+    QString layoutText = text;
+    layoutText.replace(QLatin1Char('\n'), QChar::LineSeparator);
+
+    const bool wrap = flags & Qt::TextWordWrap;
+    QTextOption option;
+    option.setWrapMode(wrap ? QTextOption::WordWrap : QTextOption::NoWrap);
+
+    m_layout->setText(layoutText);
+    m_layout->setFont(font);
+    m_layout->setTextOption(option);
+    m_layout->setCacheEnabled(true);
+
+    qreal height = 0;
+    qreal widest = 0;
+    m_layout->beginLayout();
+    for (QTextLine line = m_layout->createLine(); line.isValid(); line = m_layout->createLine()) {
+        line.setLineWidth(qMax<qreal>(width, 0));
+        // Centre each line in the available width; an unwrapped line that
+        // is wider than the rect spills out evenly on both sides
+        line.setPosition(QPointF((width - line.naturalTextWidth()) / 2, height));
+        height += line.height();
+        widest = qMax(widest, line.naturalTextWidth());
+    }
+    m_layout->endLayout();
+
+    m_naturalSize = QSizeF(widest, height);
+    m_font = font;
+    m_width = width;
+    m_flags = flags;
+    m_valid = true;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file TextLayoutCache.h
+ * @brief Per-shape cache of shaped and wrapped label text
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QFont>
+#include <QRectF>
+#include <QSizeF>
+#include <QString>
+#include <QTextLayout>
+#include <memory>
+
+class QPainter;
+
+// Keeps the QTextLayout for one label so that text is shaped and wrapped
+// once and then only replayed on every repaint. The layout is redone when
+// invalidate() is called (text or font changed) or when the wrap width or
+// flags differ from the last call (shape resized).
+class TextLayoutCache
+{
+public:
+    TextLayoutCache() = default;
+    TextLayoutCache(const TextLayoutCache&) = delete;
+    TextLayoutCache& operator=(const TextLayoutCache&) = delete;
+
+    void invalidate() { m_valid = false; }
+
+    // Draws the text centred in rect, clipped to it like QPainter::drawText
+    void draw(QPainter* painter, const QRectF& rect, const QString& text,
+              const QFont& font, int flags);
+
+    // Size actually covered by the text when laid out at the given width
+    QSizeF naturalSize(const QString& text, const QFont& font, qreal width, int flags);
+
+private:
+    void ensureLayout(const QString& text, const QFont& font, qreal width, int flags);
+
+    std::unique_ptr<QTextLayout> m_layout;
+    QFont m_font;
+    qreal m_width = -1;
+    int m_flags = 0;
+    bool m_valid = false;
+    QSizeF m_naturalSize;
+};
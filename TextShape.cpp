@@ -7,7 +7,7 @@
 
 #include "TextShape.h"
 #include <QFontMetrics>
-#include <QPainter>
+#include <QtMath>
 
 TextShape::TextShape()
     : DiagramShape(Text)
@@ -18,30 +18,27 @@ TextShape::TextShape()
     shapeColor = Qt::transparent; // Default transparent background
 }
 
-void TextShape::paint(QPainter* painter)
+void TextShape::compile(RenderList& list) const
 {
-    painter->save();
-
     QRectF rect(position, size);
 
     // Draw background if not transparent
     if (shapeColor != Qt::transparent) {
-        painter->setBrush(shapeColor);
-        painter->setPen(Qt::NoPen);
-        painter->drawRect(rect);
+        list.setBrush(shapeColor);
+        list.setPen(Qt::NoPen);
+        list.addRect(rect);
     }
 
-    // Draw text
-    painter->setFont(font);
-    painter->setPen(textColor);
-    painter->drawText(rect, Qt::AlignCenter | Qt::TextWordWrap, m_text);
+    // Draw text, unless it is too small to read at the current zoom
+    if (!labelText().isEmpty() && isTextReadable(list, font)) {
+        list.setPen(textColor);
+        list.addText(textLayout(), rect, labelText(), font, Qt::AlignCenter | Qt::TextWordWrap);
+    }
 
     // Draw selection handles if selected
-    if (isSelected) {
-        paintSelectionHandles(painter, rect);
+    if (showSelection(list)) {
+        compileSelectionHandles(list, rect);
     }
-
-    painter->restore();
 }
 
 bool TextShape::contains(const QPointF& point) const
@@ -72,8 +69,9 @@ QSizeF TextShape::getSize() const
 void TextShape::setFont(const QFont& newFont)
 {
     font = newFont;
+    invalidateTextLayout();
     // Optionally auto-resize based on new font
-    if (!m_text.isEmpty()) {
+    if (!labelText().isEmpty()) {
         size = calculateTextSize();
     }
 }
@@ -95,15 +93,15 @@ QColor TextShape::getTextColor() const
 
 QSizeF TextShape::calculateTextSize() const
 {
-    if (m_text.isEmpty()) {
+    if (labelText().isEmpty()) {
         return QSizeF(100, 30); // Default size
     }
 
-    QFontMetrics fm(font);
-    QRect textRect = fm.boundingRect(QRect(0, 0, 1000, 1000), Qt::TextWordWrap, m_text);
+    // Measured with the same cached layout that paint() draws
+    QSizeF textSize = textLayout()->naturalSize(labelText(), font, 1000, Qt::TextWordWrap);
 
     // Add some padding
-    return QSizeF(textRect.width() + 20, textRect.height() + 10);
+    return QSizeF(qCeil(textSize.width()) + 20, qCeil(textSize.height()) + 10);
 }
 
 void TextShape::save(QDataStream& out) const
@@ -120,4 +118,5 @@ void TextShape::load(QDataStream& in)
     in >> size;
     in >> font;
     in >> textColor;
-}
\ No newline at end of file
+    invalidateTextLayout();
+}
\ No newline at end of file
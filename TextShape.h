@@ -15,7 +15,7 @@ class TextShape : public DiagramShape {
 public:
     TextShape();
 
-    void paint(QPainter* painter) override;
+    void compile(RenderList& list) const override;
     bool contains(const QPointF& point) const override;
     QRectF boundingRect() const override;
     void moveBy(const QPointF& delta) override;
@@ -0,0 +1,115 @@
+/**
+ * @file TileCache.cpp
+ * @brief Implementation of the canvas tile cache
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "TileCache.h"
+#include <QtMath>
+#include <limits>
+
+TileCache::TileCache(qint64 memoryLimit)
+    : m_memoryLimit(0)
+    , m_devicePixelRatio(1.0)
+    , m_hits(0)
+    , m_misses(0)
+{
+    setMemoryLimit(memoryLimit);
+}
+
+void TileCache::setMemoryLimit(qint64 bytes)
+{
+    // QCache costs are int-sized on Qt 5
+    m_memoryLimit = qBound<qint64>(0, bytes, std::numeric_limits<int>::max());
+    m_tiles.setMaxCost(m_memoryLimit);
+}
+
+void TileCache::setDevicePixelRatio(qreal ratio)
+{
+    if (qFuzzyCompare(ratio, m_devicePixelRatio)) return;
+    m_devicePixelRatio = ratio;
+    m_tiles.clear();
+}
+
+const QImage* TileCache::find(const QPoint& tile)
+{
+    const QImage* image = m_tiles.object(tileKey(tile));
+    if (image) {
+        ++m_hits;
+    }
+    else {
+        ++m_misses;
+    }
+    return image;
+}
+
+void TileCache::insert(const QPoint& tile, const QImage& image)
+{
+    // QCache deletes the copy itself if it is larger than the whole budget
+    m_tiles.insert(tileKey(tile), new QImage(image), image.sizeInBytes());
+}
+
+void TileCache::invalidate(const QRect& area)
+{
+    if (area.isEmpty() || m_tiles.isEmpty()) return;
+
+    QRect range = tilesCovering(area);
+    qint64 rangeCount = qint64(range.width()) * range.height();
+    if (rangeCount > m_tiles.size()) {
+        // Cheaper to check every cached tile than every tile in the range
+        const auto keys = m_tiles.keys();
+        for (quint64 key : keys) {
+            QPoint tile(qint32(key >> 32), qint32(key & 0xffffffff));
+            if (range.contains(tile)) {
+                m_tiles.remove(key);
+            }
+        }
+        return;
+    }
+
+    for (int y = range.top(); y <= range.bottom(); ++y) {
+        for (int x = range.left(); x <= range.right(); ++x) {
+            m_tiles.remove(tileKey(QPoint(x, y)));
+        }
+    }
+}
+
+void TileCache::clear()
+{
+    m_tiles.clear();
+}
+
+void TileCache::resetStats()
+{
+    m_hits = 0;
+    m_misses = 0;
+}
+
+QImage TileCache::createTileImage() const
+{
+    int pixels = qCeil(TileSize * m_devicePixelRatio);
+    QImage image(pixels, pixels, QImage::Format_ARGB32_Premultiplied);
+    image.setDevicePixelRatio(m_devicePixelRatio);
+    return image;
+}
+
+QRect TileCache::tileRect(const QPoint& tile)
+{
+    return QRect(tile.x() * TileSize, tile.y() * TileSize, TileSize, TileSize);
+}
+
+QRect TileCache::tilesCovering(const QRect& area)
+{
+    // Floor division so that negative coordinates land in the right tile
+    int left = qFloor(area.left() / qreal(TileSize));
+    int top = qFloor(area.top() / qreal(TileSize));
+    int right = qFloor(area.right() / qreal(TileSize));
+    int bottom = qFloor(area.bottom() / qreal(TileSize));
+    return QRect(QPoint(left, top), QPoint(right, bottom));
+}
+
+quint64 TileCache::tileKey(const QPoint& tile)
+{
+    return (quint64(quint32(tile.x())) << 32) | quint32(tile.y());
+}
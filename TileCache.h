@@ -0,0 +1,61 @@
+/**
+ * @file TileCache.h
+ * @brief Raster cache of pre-rendered canvas tiles
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QCache>
+#include <QImage>
+#include <QPoint>
+#include <QRect>
+
+// Holds rendered canvas content in fixed-size tiles so that repaints of
+// unchanged areas become image blits. Tiles are addressed in logical pixels
+// and rendered at the device pixel ratio; the least recently used tiles are
+// dropped once the memory limit is reached.
+class TileCache
+{
+public:
+    static const int TileSize = 256;
+
+    explicit TileCache(qint64 memoryLimit = 128 * 1024 * 1024);
+
+    void setMemoryLimit(qint64 bytes);
+    qint64 memoryLimit() const { return m_memoryLimit; }
+    qint64 memoryUsed() const { return m_tiles.totalCost(); }
+    int tileCount() const { return m_tiles.size(); }
+
+    // Changing the ratio makes every cached tile the wrong resolution
+    void setDevicePixelRatio(qreal ratio);
+    qreal devicePixelRatio() const { return m_devicePixelRatio; }
+
+    // Returns the cached tile or nullptr; counts as a hit or a miss
+    const QImage* find(const QPoint& tile);
+    void insert(const QPoint& tile, const QImage& image);
+
+    // Drops all tiles overlapping the area, in logical pixels
+    void invalidate(const QRect& area);
+    void clear();
+
+    quint64 hits() const { return m_hits; }
+    quint64 misses() const { return m_misses; }
+    void resetStats();
+
+    // A blank image of the right size and ratio for one tile
+    QImage createTileImage() const;
+
+    static QRect tileRect(const QPoint& tile);
+    // Range of tile coordinates (inclusive) that covers the area
+    static QRect tilesCovering(const QRect& area);
+
+private:
+    static quint64 tileKey(const QPoint& tile);
+
+    QCache<quint64, QImage> m_tiles;
+    qint64 m_memoryLimit;
+    qreal m_devicePixelRatio;
+    quint64 m_hits;
+    quint64 m_misses;
+};
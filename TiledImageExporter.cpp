@@ -0,0 +1,227 @@
+/**
+ * @file TiledImageExporter.cpp
+ * @brief Implementation of the parallel tiled image exporter
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "TiledImageExporter.h"
+#include "DiagramShape.h"
+#include "PngStreamWriter.h"
+#include <QDataStream>
+#include <QFuture>
+#include <QPainter>
+#include <QSaveFile>
+#include <QtConcurrentMap>
+#include <QtConcurrentRun>
+#include <QtMath>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Shapes paint slightly outside their bounds (pens, handles), same margin
+// the canvas uses when culling
+const qreal kPaintMargin = 12.0;
+
+} // namespace
+
+TiledImageExporter::TiledImageExporter(const QVector<DiagramShape*>& shapes, const QRectF& sourceRect,
+                                       const QColor& background, qreal scale, int tileSize)
+    : m_sourceRect(sourceRect)
+    , m_background(background)
+    , m_scale(scale > 0 ? scale : 1.0)
+    , m_tileSize(qMax(tileSize, 16))
+    , m_index(&m_bounds, m_tileSize / m_scale)
+{
+    m_imageSize = QSize(qCeil(sourceRect.width() * m_scale), qCeil(sourceRect.height() * m_scale));
+    if (m_imageSize.isEmpty()) {
+        return;
+    }
+
+    // Copied through the shapes' own serialization, as the clipboard does.
+    // Rows follow the paint order, which sorts the per-tile query results.
+    m_shapes.reserve(shapes.size());
+    m_bounds.reserve(shapes.size());
+    for (DiagramShape* shape : shapes) {
+        QByteArray data;
+        QDataStream out(&data, QIODevice::WriteOnly);
+        shape->save(out);
+        auto copy = DiagramShape::createShape(shape->getType());
+        if (!copy) continue;
+        QDataStream in(data);
+        copy->load(in);
+        m_shapes.append(copy);
+        m_bounds.append(copy->boundingRect().normalized());
+        m_index.insert(m_shapes.size() - 1);
+    }
+
+    for (int y = 0; y < m_imageSize.height(); y += m_tileSize) {
+        for (int x = 0; x < m_imageSize.width(); x += m_tileSize) {
+            m_tileRects.append(QRect(x, y, m_tileSize, m_tileSize) & QRect(QPoint(0, 0), m_imageSize));
+        }
+    }
+}
+
+QRectF TiledImageExporter::contentBounds(const QVector<DiagramShape*>& shapes, qreal margin)
+{
+    QRectF bounds;
+    for (const DiagramShape* shape : shapes) {
+        bounds |= shape->boundingRect();
+    }
+    if (bounds.isNull()) {
+        return QRectF();
+    }
+    return bounds.adjusted(-margin, -margin, margin, margin);
+}
+
+QImage TiledImageExporter::render(const ProgressCallback& progress, const std::atomic<bool>* cancelled) const
+{
+    std::atomic<int> done(0);
+    return renderArea(QRect(QPoint(0, 0), m_imageSize), done, progress, cancelled);
+}
+
+bool TiledImageExporter::exportToPng(const QString& fileName, qreal dpi, const ProgressCallback& progress,
+                                     const std::atomic<bool>* cancelled) const
+{
+    if (m_imageSize.isEmpty()) {
+        return false;
+    }
+
+    // Written to a temporary file and renamed at the end, so a failed or
+    // cancelled export never leaves a truncated PNG behind
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    PngStreamWriter writer;
+    writer.setDotsPerInch(dpi);
+    if (!writer.begin(&file, m_imageSize, m_background.alpha() < 255)) {
+        file.cancelWriting();
+        return false;
+    }
+
+    // Bands are one row of tiles high. Each band is encoded on another
+    // thread while the next one renders.
+    std::atomic<int> done(0);
+    QFuture<bool> encoding;
+    bool encodingPending = false;
+    bool ok = true;
+    for (int y = 0; y < m_imageSize.height(); y += m_tileSize) {
+        const QRect band(0, y, m_imageSize.width(), qMin(m_tileSize, m_imageSize.height() - y));
+        const QImage image = renderArea(band, done, progress, cancelled);
+        // The writer needs the bands in order, so the previous one has to
+        // be finished before the next is queued
+        if (encodingPending && !encoding.result()) {
+            ok = false;
+            break;
+        }
+        if (image.isNull()) {
+            ok = false;
+            break;
+        }
+        encoding = QtConcurrent::run([&writer, image]() {
+            return writer.writeRows(image);
+        });
+        encodingPending = true;
+    }
+    if (encodingPending && !encoding.result()) {
+        ok = false;
+    }
+
+    if (!ok || !writer.finish()) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+QImage TiledImageExporter::renderArea(const QRect& area, std::atomic<int>& done, const ProgressCallback& progress,
+                                      const std::atomic<bool>* cancelled) const
+{
+    if (area.isEmpty()) {
+        return QImage();
+    }
+
+    QImage image(area.size(), QImage::Format_ARGB32_Premultiplied);
+    if (image.isNull()) {
+        return QImage();
+    }
+
+    // Workers copy their tiles into disjoint parts of this buffer, so they
+    // never share a QImage or a QPainter
+    uchar* bits = image.bits();
+    const qsizetype bytesPerLine = image.bytesPerLine();
+    const int total = m_tileRects.size();
+
+    // One row of tiles at a time: its lists are compiled here, rendered
+    // in parallel, and freed before the next row is compiled
+    int next = 0;
+    while (next < m_tileRects.size() && !(cancelled && cancelled->load())) {
+        const int y = m_tileRects[next].y();
+        QVector<Tile> tiles;
+        for (; next < m_tileRects.size() && m_tileRects[next].y() == y; ++next) {
+            if (m_tileRects[next].intersects(area)) {
+                tiles.append({ m_tileRects[next], compileTile(m_tileRects[next]) });
+            }
+        }
+
+        QtConcurrent::blockingMap(tiles, [&](Tile& tile) {
+            if (cancelled && cancelled->load()) {
+                return;
+            }
+            const QImage rendered = renderTile(tile);
+            const QRect part = tile.rect & area;
+            const size_t rowBytes = size_t(part.width()) * 4;
+            for (int row = 0; row < part.height(); ++row) {
+                uchar* dst = bits + (part.y() - area.y() + row) * bytesPerLine
+                    + size_t(part.x() - area.x()) * 4;
+                const uchar* src = rendered.constScanLine(part.y() - tile.rect.y() + row)
+                    + size_t(part.x() - tile.rect.x()) * 4;
+                std::memcpy(dst, src, rowBytes);
+            }
+            const int finished = ++done;
+            if (progress) {
+                progress(finished, total);
+            }
+        });
+    }
+
+    if (cancelled && cancelled->load()) {
+        return QImage();
+    }
+    return image;
+}
+
+RenderList TiledImageExporter::compileTile(const QRect& rect) const
+{
+    const QRectF docArea(m_sourceRect.topLeft() + QPointF(rect.topLeft()) / m_scale,
+                         QSizeF(rect.size()) / m_scale);
+    QVector<int> rows = m_index.query(docArea.adjusted(-kPaintMargin, -kPaintMargin, kPaintMargin, kPaintMargin));
+    std::sort(rows.begin(), rows.end());
+    QVector<DiagramShape*> tileShapes;
+    tileShapes.reserve(rows.size());
+    for (int row : rows) {
+        tileShapes.append(m_shapes[row].get());
+    }
+
+    RenderList list(m_scale);
+    list.setDetachedText(true);
+    list.setDrawSelection(false);
+    list.addShapes(tileShapes);
+    return list;
+}
+
+QImage TiledImageExporter::renderTile(const Tile& tile) const
+{
+    QImage image(tile.rect.size(), QImage::Format_ARGB32_Premultiplied);
+    image.fill(m_background);
+
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.translate(-tile.rect.topLeft());
+    painter.scale(m_scale, m_scale);
+    painter.translate(-m_sourceRect.topLeft());
+    tile.list.replay(&painter);
+    return image;
+}
@@ -0,0 +1,89 @@
+/**
+ * @file TiledImageExporter.h
+ * @brief Parallel tile-based rendering of diagrams to images
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QColor>
+#include <QImage>
+#include <QRect>
+#include <QRectF>
+#include <QString>
+#include <QVector>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include "RenderList.h"
+#include "SpatialIndex.h"
+
+class DiagramShape;
+
+// Renders a document area into an image by splitting the output into
+// square tiles and rendering the tiles on the global thread pool.
+//
+// The constructor copies the shapes and indexes the copies, so it has to
+// run on the thread that owns the shapes (normally the GUI thread). After
+// that the exporter no longer touches the originals: render() and
+// exportToPng() can run on any thread, and the document can be edited
+// while they do. Selection handles are never exported.
+//
+// Render lists are compiled from the copies one row of tiles at a time,
+// just before the row renders, and dropped after it, so memory follows
+// the document and the band height rather than the image area.
+class TiledImageExporter
+{
+public:
+    // Called from the worker threads after each finished tile
+    using ProgressCallback = std::function<void(int done, int total)>;
+
+    // shapes are in paint order; sourceRect is the document area mapped
+    // onto the image and scale the image pixels per document unit
+    TiledImageExporter(const QVector<DiagramShape*>& shapes, const QRectF& sourceRect,
+                       const QColor& background, qreal scale = 1.0, int tileSize = 512);
+
+    // Union of the shapes' bounds plus a margin, for exporting just the
+    // content instead of the whole page. Null when there are no shapes.
+    static QRectF contentBounds(const QVector<DiagramShape*>& shapes, qreal margin = 20.0);
+
+    QSize imageSize() const { return m_imageSize; }
+    int tileCount() const { return m_tileRects.size(); }
+
+    // Renders all tiles and stitches them into one image. Returns a null
+    // image when cancelled or when the image cannot be allocated.
+    QImage render(const ProgressCallback& progress = ProgressCallback(),
+                  const std::atomic<bool>* cancelled = nullptr) const;
+
+    // Streams the image into a PNG one row of tiles at a time, so peak
+    // memory is two bands (one rendering, one encoding) rather than the
+    // whole image. dpi is stored in the file when > 0.
+    bool exportToPng(const QString& fileName, qreal dpi = 0,
+                     const ProgressCallback& progress = ProgressCallback(),
+                     const std::atomic<bool>* cancelled = nullptr) const;
+
+private:
+    struct Tile {
+        QRect rect; // in image pixels
+        RenderList list;
+    };
+
+    QImage renderArea(const QRect& area, std::atomic<int>& done, const ProgressCallback& progress,
+                      const std::atomic<bool>* cancelled) const;
+    // Compiles the shapes reaching into rect (image pixels). Not thread
+    // safe: compiling fills the copies' text layout caches.
+    RenderList compileTile(const QRect& rect) const;
+    QImage renderTile(const Tile& tile) const;
+
+    QRectF m_sourceRect;
+    QColor m_background;
+    qreal m_scale;
+    int m_tileSize;
+    QSize m_imageSize;
+    QVector<QRect> m_tileRects; // row by row
+    // Private copies of the shapes and their bounds, one row per shape in
+    // paint order, and an index over the rows with one cell per tile
+    QVector<std::shared_ptr<DiagramShape>> m_shapes;
+    QVector<QRectF> m_bounds;
+    SpatialIndex m_index;
+};
@@ -0,0 +1,205 @@
+/**
+ * @file UndoJournal.cpp
+ * @brief Implementation of the undo/redo journal
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#include "UndoJournal.h"
+#include <QHash>
+#include <algorithm>
+
+namespace {
+
+// What a shape held by an entry is assumed to cost besides its text
+const qint64 kShapeCost = 256;
+
+qint64 textCost(const QVariant& value)
+{
+    return value.userType() == QMetaType::QString ? value.toString().size() * qint64(sizeof(QChar)) : 0;
+}
+
+// Whether both change the same properties of the same shapes
+bool sameTargets(const QVector<UndoJournal::PropertyChange>& a, const QVector<UndoJournal::PropertyChange>& b)
+{
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+                      [](const UndoJournal::PropertyChange& x, const UndoJournal::PropertyChange& y) {
+                          return x.shape == y.shape && x.property == y.property;
+                      });
+}
+
+} // namespace
+
+bool UndoJournal::Entry::isEmpty() const
+{
+    return inserted.isEmpty() && (moved.isEmpty() || delta.isNull()) && placed.isEmpty()
+        && routes.isEmpty() && properties.isEmpty() && restacks.isEmpty() && removed.isEmpty();
+}
+
+qint64 UndoJournal::Entry::cost() const
+{
+    qint64 bytes = sizeof(Entry);
+    bytes += moved.size() * qint64(sizeof(ShapeId));
+    bytes += placed.size() * qint64(sizeof(ShapeId) + 2 * sizeof(QPointF));
+    for (const RouteChange& route : routes) {
+        bytes += sizeof(RouteChange) + (route.before.size() + route.after.size()) * qint64(sizeof(QPointF));
+    }
+    for (const PropertyChange& change : properties) {
+        bytes += sizeof(PropertyChange) + textCost(change.before) + textCost(change.after);
+    }
+    bytes += restacks.size() * qint64(sizeof(Restack));
+    for (const QVector<Insertion>* shapes : { &inserted, &removed }) {
+        for (const Insertion& insertion : *shapes) {
+            bytes += sizeof(Insertion) + kShapeCost + insertion.shape->getText().size() * qint64(sizeof(QChar));
+        }
+    }
+    return bytes;
+}
+
+void UndoJournal::record(Entry entry)
+{
+    // Property panels report values that did not change, too
+    entry.properties.erase(std::remove_if(entry.properties.begin(), entry.properties.end(),
+                                          [](const PropertyChange& change) { return change.before == change.after; }),
+                           entry.properties.end());
+    if (entry.isEmpty()) return;
+
+    // Whatever was undone cannot be redone any more
+    while (int(m_entries.size()) > m_cursor) {
+        m_used -= m_costs.back();
+        m_entries.pop_back();
+        m_costs.pop_back();
+    }
+
+    const Coalescing coalescing = entry.coalescing;
+    if (m_open && !m_entries.empty() && merge(m_entries.back(), entry)) {
+        const qint64 cost = m_entries.back().cost();
+        m_used += cost - m_costs.back();
+        m_costs.back() = cost;
+    }
+    else {
+        const qint64 cost = entry.cost();
+        m_entries.push_back(std::move(entry));
+        m_costs.push_back(cost);
+        m_used += cost;
+        ++m_cursor;
+    }
+    m_open = coalescing != NoCoalescing;
+    evict();
+}
+
+void UndoJournal::clear()
+{
+    m_entries.clear();
+    m_costs.clear();
+    m_cursor = 0;
+    m_open = false;
+    m_used = 0;
+}
+
+const UndoJournal::Entry* UndoJournal::undo()
+{
+    if (!canUndo()) return nullptr;
+    m_open = false;
+    --m_cursor;
+    return &m_entries[m_cursor];
+}
+
+const UndoJournal::Entry* UndoJournal::redo()
+{
+    if (!canRedo()) return nullptr;
+    m_open = false;
+    return &m_entries[m_cursor++];
+}
+
+void UndoJournal::setMemoryLimit(qint64 bytes)
+{
+    m_limit = bytes;
+    evict();
+}
+
+bool UndoJournal::merge(Entry& into, const Entry& entry)
+{
+    if (entry.coalescing == NoCoalescing || entry.coalescing != into.coalescing) return false;
+    // Structural changes always get a step of their own
+    if (!into.inserted.isEmpty() || !into.removed.isEmpty() || !into.restacks.isEmpty()
+        || !entry.inserted.isEmpty() || !entry.removed.isEmpty() || !entry.restacks.isEmpty()) {
+        return false;
+    }
+    // Moves add up only when the same shapes moved
+    if (!entry.moved.isEmpty() && !into.moved.isEmpty() && entry.moved != into.moved) return false;
+    // Likewise property edits: a label typed and then a line width
+    // stepped are two steps, not one
+    if (!entry.properties.isEmpty() && !into.properties.isEmpty()
+        && !sameTargets(into.properties, entry.properties)) {
+        return false;
+    }
+
+    if (!entry.moved.isEmpty()) {
+        if (into.moved.isEmpty()) {
+            into.moved = entry.moved;
+        }
+        into.delta += entry.delta;
+    }
+
+    // Everything else keeps the oldest before and the newest after
+    if (!entry.placed.isEmpty()) {
+        if (into.placed == entry.placed) {
+            into.placedAfter = entry.placedAfter;
+        }
+        else {
+            QHash<ShapeId, int> index;
+            index.reserve(into.placed.size());
+            for (int i = 0; i < into.placed.size(); ++i) {
+                index.insert(into.placed[i], i);
+            }
+            for (int i = 0; i < entry.placed.size(); ++i) {
+                const int at = index.value(entry.placed[i], -1);
+                if (at >= 0) {
+                    into.placedAfter[at] = entry.placedAfter[i];
+                }
+                else {
+                    into.placed.append(entry.placed[i]);
+                    into.placedBefore.append(entry.placedBefore[i]);
+                    into.placedAfter.append(entry.placedAfter[i]);
+                }
+            }
+        }
+    }
+
+    for (const RouteChange& route : entry.routes) {
+        auto it = std::find_if(into.routes.begin(), into.routes.end(),
+                               [&](const RouteChange& r) { return r.connector == route.connector; });
+        if (it != into.routes.end()) {
+            it->after = route.after;
+        }
+        else {
+            into.routes.append(route);
+        }
+    }
+
+    for (const PropertyChange& change : entry.properties) {
+        auto it = std::find_if(into.properties.begin(), into.properties.end(), [&](const PropertyChange& c) {
+            return c.shape == change.shape && c.property == change.property;
+        });
+        if (it != into.properties.end()) {
+            it->after = change.after;
+        }
+        else {
+            into.properties.append(change);
+        }
+    }
+    return true;
+}
+
+void UndoJournal::evict()
+{
+    // Oldest first. Only steps that are done can go, and the newest one
+    // always stays.
+    while (m_used > m_limit && m_cursor > 0 && m_entries.size() > 1) {
+        m_used -= m_costs.front();
+        m_entries.pop_front();
+        m_costs.pop_front();
+        --m_cursor;
+    }
+}
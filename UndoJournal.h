@@ -0,0 +1,138 @@
+/**
+ * @file UndoJournal.h
+ * @brief Delta-based undo/redo history with a memory limit
+ * @author Ehcochwy
+ * @date 2026-10-16
+ */
+
+#pragma once
+#include <QPointF>
+#include <QPolygonF>
+#include <QVariant>
+#include <QVector>
+#include <deque>
+#include <memory>
+#include "DiagramShape.h"
+
+// Undo history as a list of deltas. An entry holds only what an edit
+// changed - a translation shared by all dragged shapes, per-shape
+// positions for layouts, property before/after pairs, restacking, and
+// the shapes added or removed - never a copy of the document. Shapes are
+// referred to by id; removed shapes are kept alive by their entry, so
+// undoing a delete puts back the very same object.
+//
+// The journal only keeps the entries. DiagramCanvas records them as it
+// edits and replays them on undo and redo.
+//
+// Consecutive entries with the same coalescing key merge until the
+// journal is sealed, so a drag or a run of keystrokes is one step. The
+// history is capped by an estimate of its memory use; the oldest entries
+// go first.
+class UndoJournal
+{
+public:
+    enum Property {
+        FillColor,
+        LineColor,
+        LineWidth,
+        Text,
+        RoutingStyle,
+        Pinned,
+        StartBinding, // QVariantList { id, port }
+        EndBinding
+    };
+
+    enum Coalescing {
+        NoCoalescing,
+        Drag,
+        Typing,
+        Layout
+    };
+
+    struct PropertyChange {
+        ShapeId shape = 0;
+        Property property = FillColor;
+        QVariant before;
+        QVariant after;
+    };
+
+    // Connector path: start point, bends, end point
+    struct RouteChange {
+        ShapeId connector = 0;
+        QPolygonF before;
+        QPolygonF after;
+    };
+
+    // Paint order is restored by putting a shape back above its old
+    // neighbour (0 for the bottom), which stays valid however the z keys
+    // are renumbered in between
+    struct Restack {
+        ShapeId shape = 0;
+        ShapeId belowBefore = 0;
+        ShapeId belowAfter = 0;
+    };
+
+    // The pin lives in the canvas' store, not the shape, so it travels
+    // with the entry
+    struct Insertion {
+        std::shared_ptr<DiagramShape> shape;
+        ShapeId below = 0;
+        bool pinned = false;
+    };
+
+    // Redo applies the parts in declaration order, undo in reverse
+    struct Entry {
+        QVector<Insertion> inserted;
+        // Every shape in moved went by delta: one translate to undo
+        QVector<ShapeId> moved;
+        QPointF delta;
+        // Shapes placed one by one (layouts), as top-left corners
+        QVector<ShapeId> placed;
+        QVector<QPointF> placedBefore;
+        QVector<QPointF> placedAfter;
+        QVector<RouteChange> routes;
+        QVector<PropertyChange> properties;
+        QVector<Restack> restacks; // in paint order, bottom first
+        QVector<Insertion> removed;
+        Coalescing coalescing = NoCoalescing;
+
+        bool isEmpty() const;
+        // Rough heap footprint, for the memory limit
+        qint64 cost() const;
+    };
+
+    UndoJournal() = default;
+    UndoJournal(const UndoJournal&) = delete;
+    UndoJournal& operator=(const UndoJournal&) = delete;
+
+    // Drops everything that could be redone, then merges the entry into the
+    // last one or appends it
+    void record(Entry entry);
+    // Ends coalescing; the next entry starts a new step
+    void seal() { m_open = false; }
+    void clear();
+
+    bool canUndo() const { return m_cursor > 0; }
+    bool canRedo() const { return m_cursor < int(m_entries.size()); }
+    // Step back (forward) and return the entry to revert (reapply); null
+    // when there is none. The reference stays valid until the next record.
+    const Entry* undo();
+    const Entry* redo();
+
+    void setMemoryLimit(qint64 bytes);
+    qint64 memoryLimit() const { return m_limit; }
+    qint64 memoryUsed() const { return m_used; }
+
+    // Folds entry into into if both belong to one coalesced step
+    static bool merge(Entry& into, const Entry& entry);
+
+private:
+    void evict();
+
+    std::deque<Entry> m_entries;
+    std::deque<qint64> m_costs;
+    int m_cursor = 0; // entries before it are done, the rest undone
+    bool m_open = false;
+    qint64 m_limit = 64 * 1024 * 1024;
+    qint64 m_used = 0;
+};
@@ -6,13 +6,28 @@
  */
 
 #include <QApplication>
+#include <QGuiApplication>
 #include <QTranslator>
 #include <QLibraryInfo>
 #include "MainWindow.h"
+#include "BatchExporter.h"
 
 int main(int argc, char *argv[])
 {
+    // flow --export ...: convert files without any widgets. Rendering only
+    // needs fonts, so the offscreen platform works on machines without a
+    // display unless the caller picked another one.
+    if (BatchExporter::isRequested(argc, argv)) {
+        if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+        }
+        QGuiApplication app(argc, argv);
+        return BatchExporter::run(app.arguments());
+    }
+
     QApplication app(argc, argv);
+    // Names the data directory autosave journals are registered in
+    app.setApplicationName("DiagramEditor");
     
     // 加载翻译文件
     QTranslator translator;